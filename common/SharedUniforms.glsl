@@ -0,0 +1,14 @@
+// Uniforms shared by every program, in uniform buffers : see common/shaderreflection.hpp.
+// The layouts must match the C++ structs.
+
+layout(std140) uniform FrameUniforms{
+	vec4 LightPosition_worldspace; // w is unused
+	float Time;
+} Frame;
+
+layout(std140) uniform ViewUniforms{
+	mat4 V;
+	mat4 P;
+	mat4 VP;
+	vec4 CameraPosition_worldspace; // w is unused
+} View;
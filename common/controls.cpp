@@ -34,42 +34,52 @@ float mouseSpeed = 0.005f;
 
 
 
-void computeMatricesFromInputs(){
-
-	// glfwGetTime is called only once, the first time this function is called
-	static double lastTime = glfwGetTime();
-
-	// Compute time difference between current and last frame
-	double currentTime = glfwGetTime();
-	float deltaTime = float(currentTime - lastTime);
-
-	// Get mouse position
-	double xpos, ypos;
-	glfwGetCursorPos(window, &xpos, &ypos);
+// Position at the previous simulation step, for interpolateControls()
+glm::vec3 previousPosition = position;
 
-	// Reset mouse position for next frame
-	glfwSetCursorPos(window, 1024/2, 768/2);
 
-	// Compute new orientation
-	horizontalAngle += mouseSpeed * float(1024/2 - xpos );
-	verticalAngle   += mouseSpeed * float( 768/2 - ypos );
 
+static glm::vec3 getDirection(){
 	// Direction : Spherical coordinates to Cartesian coordinates conversion
-	glm::vec3 direction(
+	return glm::vec3(
 		cos(verticalAngle) * sin(horizontalAngle), 
 		sin(verticalAngle),
 		cos(verticalAngle) * cos(horizontalAngle)
 	);
-	
+}
+
+static glm::vec3 getRight(){
 	// Right vector
-	glm::vec3 right = glm::vec3(
+	return glm::vec3(
 		sin(horizontalAngle - 3.14f/2.0f), 
 		0,
 		cos(horizontalAngle - 3.14f/2.0f)
 	);
-	
-	// Up vector
-	glm::vec3 up = glm::cross( right, direction );
+}
+
+void pollControls(){
+
+	// The center of the window, whatever its size
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+
+	// Get mouse position
+	double xpos, ypos;
+	glfwGetCursorPos(window, &xpos, &ypos);
+
+	// Reset mouse position for next frame
+	glfwSetCursorPos(window, width/2, height/2);
+
+	// Compute new orientation. It isn't simulated : the view turns as soon as the mouse moves.
+	horizontalAngle += mouseSpeed * float(width/2 - xpos );
+	verticalAngle   += mouseSpeed * float(height/2 - ypos );
+}
+
+void updateControls(float deltaTime){
+
+	glm::vec3 direction = getDirection();
+	glm::vec3 right = getRight();
+	previousPosition = position;
 
 	// Move forward
 	if (glfwGetKey( window, GLFW_KEY_UP ) == GLFW_PRESS){
@@ -87,17 +97,47 @@ void computeMatricesFromInputs(){
 	if (glfwGetKey( window, GLFW_KEY_LEFT ) == GLFW_PRESS){
 		position -= right * deltaTime * speed;
 	}
+}
+
+void interpolateControls(float alpha){
+
+	// Between the last two simulation steps
+	glm::vec3 cameraPosition = glm::mix(previousPosition, position, alpha);
+	glm::vec3 direction = getDirection();
+	
+	// Up vector
+	glm::vec3 up = glm::cross( getRight(), direction );
+
+	// The aspect ratio of the window
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+	float aspect = height > 0 ? (float)width / (float)height : 4.0f / 3.0f;
 
 	float FoV = initialFoV;// - 5 * glfwGetMouseWheel(); // Now GLFW 3 requires setting up a callback for this. It's a bit too complicated for this beginner's tutorial, so it's disabled instead.
 
-	// Projection matrix : 45 Field of View, 4:3 ratio, display range : 0.1 unit <-> 100 units
-	ProjectionMatrix = glm::perspective(glm::radians(FoV), 4.0f / 3.0f, 0.1f, 100.0f);
+	// Projection matrix : 45 Field of View, ratio of the window, display range : 0.1 unit <-> 100 units
+	ProjectionMatrix = glm::perspective(glm::radians(FoV), aspect, 0.1f, 100.0f);
 	// Camera matrix
 	ViewMatrix       = glm::lookAt(
-								position,           // Camera is here
-								position+direction, // and looks here : at the same position, plus "direction"
-								up                  // Head is up (set to 0,-1,0 to look upside-down)
+								cameraPosition,           // Camera is here
+								cameraPosition+direction, // and looks here : at the same position, plus "direction"
+								up                        // Head is up (set to 0,-1,0 to look upside-down)
 						   );
+}
+
+void computeMatricesFromInputs(){
+
+	// glfwGetTime is called only once, the first time this function is called
+	static double lastTime = glfwGetTime();
+
+	// Compute time difference between current and last frame
+	double currentTime = glfwGetTime();
+	float deltaTime = float(currentTime - lastTime);
+
+	// One step as long as the frame, nothing to interpolate
+	pollControls();
+	updateControls(deltaTime);
+	interpolateControls(1.0f);
 
 	// For the next frame, the "last time" will be "now"
 	lastTime = currentTime;
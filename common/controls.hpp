@@ -1,7 +1,16 @@
 #ifndef CONTROLS_HPP
 #define CONTROLS_HPP
 
+// Moves the camera by the time since the last call.
 void computeMatricesFromInputs();
+
+// The same in parts, for a fixed simulation step (see mainloop.hpp) : pollControls()
+// once per frame, updateControls() once per step, then interpolateControls() with
+// getMainLoopAlpha() before rendering.
+void pollControls();
+void updateControls(float deltaTime);
+void interpolateControls(float alpha);
+
 glm::mat4 getViewMatrix();
 glm::mat4 getProjectionMatrix();
 
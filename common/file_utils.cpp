@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "file_utils.hpp"
+
+// mmap() refuses empty files, so they all point here instead.
+static const char emptyFile[1] = {0};
+
+bool mapFile(const char * path, MappedFile & file){
+
+	file.data = NULL;
+	file.size = 0;
+	file.fileHandle = NULL;
+	file.mappingHandle = NULL;
+
+#ifdef _WIN32
+
+	HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(fileHandle, &fileSize)){
+		CloseHandle(fileHandle);
+		return false;
+	}
+	if (fileSize.QuadPart == 0){
+		CloseHandle(fileHandle);
+		file.data = emptyFile;
+		return true;
+	}
+
+	HANDLE mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == NULL){
+		CloseHandle(fileHandle);
+		return false;
+	}
+	void * view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (view == NULL){
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		return false;
+	}
+
+	file.data = (const char *)view;
+	file.size = (size_t)fileSize.QuadPart;
+	file.fileHandle = fileHandle;
+	file.mappingHandle = mappingHandle;
+
+#else
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0){
+		close(fd);
+		return false;
+	}
+	if (st.st_size == 0){
+		close(fd);
+		file.data = emptyFile;
+		return true;
+	}
+
+	void * view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // The mapping keeps its own reference to the file
+	if (view == MAP_FAILED)
+		return false;
+
+	// We almost always read the whole file from start to end : ask for aggressive read-ahead
+	madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+	file.data = (const char *)view;
+	file.size = (size_t)st.st_size;
+
+#endif
+
+	return true;
+}
+
+void unmapFile(MappedFile & file){
+
+	if (file.data != NULL && file.data != emptyFile){
+#ifdef _WIN32
+		UnmapViewOfFile(file.data);
+		CloseHandle((HANDLE)file.mappingHandle);
+		CloseHandle((HANDLE)file.fileHandle);
+#else
+		munmap((void *)file.data, file.size);
+#endif
+	}
+
+	file.data = NULL;
+	file.size = 0;
+	file.fileHandle = NULL;
+	file.mappingHandle = NULL;
+}
+
+bool getFileInfo(const char * path, unsigned long long & size, long long & modificationTime){
+#ifdef _WIN32
+	struct _stat64 st;
+	if (_stat64(path, &st) != 0)
+		return false;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+#endif
+	size = (unsigned long long)st.st_size;
+	modificationTime = (long long)st.st_mtime;
+	return true;
+}
+
+bool getCanonicalPath(const char * path, std::string & out_path){
+#ifdef _WIN32
+	char fullPath[MAX_PATH];
+	if (GetFullPathNameA(path, MAX_PATH, fullPath, NULL) == 0 || GetFileAttributesA(fullPath) == INVALID_FILE_ATTRIBUTES)
+		return false;
+	// The file system isn't case sensitive
+	for (char * c = fullPath; *c; c++){
+		if (*c == '/')
+			*c = '\\';
+		else if (*c >= 'A' && *c <= 'Z')
+			*c += 'a' - 'A';
+	}
+	out_path = fullPath;
+#else
+	char * fullPath = realpath(path, NULL);
+	if (fullPath == NULL)
+		return false;
+	out_path = fullPath;
+	free(fullPath);
+#endif
+	return true;
+}
+
+static inline unsigned long long mixHash(unsigned long long h, unsigned long long word){
+	word *= 0x87c37b91114253d5ull;
+	word ^= word >> 31;
+	h ^= word;
+	h *= 0x4cf5ad432745937full;
+	return h ^ (h >> 29);
+}
+
+unsigned long long hashMemory(const void * data, size_t size){
+
+	const unsigned char * bytes = (const unsigned char *)data;
+	unsigned long long h = 0x9e3779b97f4a7c15ull ^ ((unsigned long long)size * 0xff51afd7ed558ccdull);
+
+	// 4 independent lanes of 8 bytes, so that the multiplications can overlap
+	unsigned long long lanes[4] = { h, h ^ 1, h ^ 2, h ^ 3 };
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32){
+		unsigned long long words[4];
+		memcpy(words, bytes + i, 32);
+		lanes[0] = mixHash(lanes[0], words[0]);
+		lanes[1] = mixHash(lanes[1], words[1]);
+		lanes[2] = mixHash(lanes[2], words[2]);
+		lanes[3] = mixHash(lanes[3], words[3]);
+	}
+	h = mixHash(mixHash(mixHash(mixHash(h, lanes[0]), lanes[1]), lanes[2]), lanes[3]);
+
+	// Leftovers, 8 bytes then 1 byte at a time
+	for (; i + 8 <= size; i += 8){
+		unsigned long long word;
+		memcpy(&word, bytes + i, 8);
+		h = mixHash(h, word);
+	}
+	unsigned long long tail = 0;
+	for (size_t k = 0; i < size; i++, k++)
+		tail |= (unsigned long long)bytes[i] << (8*k);
+	return mixHash(h, tail);
+}
@@ -0,0 +1,33 @@
+#ifndef FILE_UTILS_HPP
+#define FILE_UTILS_HPP
+
+#include <stddef.h>
+#include <string>
+
+// A read-only view of a whole file, mapped in memory.
+// Nothing is copied : the OS pages the file in when the data is first read.
+struct MappedFile{
+	const char * data;
+	size_t size;
+	void * fileHandle;    // Only used on Windows
+	void * mappingHandle; // Only used on Windows
+};
+
+// Maps the whole file. Returns false (and leaves "file" empty) if it can't be opened.
+bool mapFile(const char * path, MappedFile & file);
+
+// Releases the mapping. "file.data" must not be used afterwards.
+void unmapFile(MappedFile & file);
+
+// Size and last modification time (in seconds) of a file. Returns false if it doesn't exist.
+bool getFileInfo(const char * path, unsigned long long & size, long long & modificationTime);
+
+// Absolute path of a file, without "." and "..", and with symbolic links resolved :
+// two paths to the same file give the same string. Returns false if the file doesn't exist.
+bool getCanonicalPath(const char * path, std::string & out_path);
+
+// Fast 64-bit hash of a block of memory, to detect that a file changed.
+// Not a cryptographic hash !
+unsigned long long hashMemory(const void * data, size_t size);
+
+#endif
@@ -0,0 +1,384 @@
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "texture.hpp"
+#include "textureatlas.hpp"
+#include "glyphcache.hpp"
+
+#define GLYPH_GRID_SIZE 16 // Cells per row and per column of the font texture
+#define GLYPH_ALPHA_THRESHOLD 8 // Less than that isn't ink
+
+// What a cell of the font holds, measured once
+struct SourceGlyph{
+	bool measured;
+	int minX, minY, maxX, maxY;        // Ink bounds in the cell, minX > maxX if there is none
+	std::vector<short> rowLeft, rowRight; // Ink bounds of each row, -1 if there is none
+};
+
+struct GlyphPage{
+	GLuint texture;
+	SkylinePacker packer;
+	std::vector<unsigned char> pixels; // RGBA, the first row at the top of the glyphs
+	int dirtyLeft, dirtyTop, dirtyRight, dirtyBottom; // Empty if left >= right
+	unsigned int lastUse; // GlyphCacheFrame
+	std::vector<unsigned long long> glyphs; // Keys in GlyphCacheGlyphs
+};
+
+std::vector<unsigned char> GlyphCacheFont; // The font texture, RGBA
+unsigned int GlyphCacheFontSize;
+unsigned int GlyphCacheCellSize;
+SourceGlyph GlyphCacheSources[GLYPH_GRID_SIZE * GLYPH_GRID_SIZE];
+std::unordered_map<unsigned long long, CachedGlyph> GlyphCacheGlyphs;
+std::unordered_map<unsigned int, float> GlyphCacheKerning; // In pixels of the font
+std::vector<GlyphPage> GlyphCachePages;
+unsigned int GlyphCachePageSize;
+unsigned int GlyphCacheMaxPageCount;
+unsigned int GlyphCacheFrame;
+unsigned int GlyphCacheGeneration;
+
+static unsigned int getGlyphIndex(unsigned int codepoint){
+	return codepoint < GLYPH_GRID_SIZE * GLYPH_GRID_SIZE ? codepoint : '?';
+}
+
+static const unsigned char * getFontPixel(unsigned int index, int x, int y){
+	unsigned int cellX = (index % GLYPH_GRID_SIZE) * GlyphCacheCellSize;
+	unsigned int cellY = (index / GLYPH_GRID_SIZE) * GlyphCacheCellSize;
+	return &GlyphCacheFont[(((size_t)cellY + y) * GlyphCacheFontSize + cellX + x) * 4];
+}
+
+static const SourceGlyph & measureGlyph(unsigned int index){
+	SourceGlyph & glyph = GlyphCacheSources[index];
+	if (glyph.measured)
+		return glyph;
+	int size = (int)GlyphCacheCellSize;
+	glyph.measured = true;
+	glyph.minX = glyph.minY = size;
+	glyph.maxX = glyph.maxY = -1;
+	glyph.rowLeft.assign(size, -1);
+	glyph.rowRight.assign(size, -1);
+	for (int y=0; y<size; y++){
+		for (int x=0; x<size; x++){
+			if (getFontPixel(index, x, y)[3] < GLYPH_ALPHA_THRESHOLD)
+				continue;
+			if (glyph.rowLeft[y] < 0)
+				glyph.rowLeft[y] = (short)x;
+			glyph.rowRight[y] = (short)x;
+			glyph.minX = std::min(glyph.minX, x);
+			glyph.maxX = std::max(glyph.maxX, x);
+			glyph.minY = std::min(glyph.minY, y);
+			glyph.maxY = std::max(glyph.maxY, y);
+		}
+	}
+	return glyph;
+}
+
+// Space between the ink of two glyphs, in pixels of the font
+static float getGlyphSpacing(){
+	return GlyphCacheCellSize / 16.0f;
+}
+
+static GLuint createPageTexture(const std::vector<unsigned char> & pixels){
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, GlyphCachePageSize, GlyphCachePageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	return texture;
+}
+
+static void resetPage(GlyphPage & page){
+	initSkylinePacker(page.packer, GlyphCachePageSize, GlyphCachePageSize);
+	page.dirtyLeft = page.dirtyTop = page.dirtyRight = page.dirtyBottom = 0;
+	page.glyphs.clear();
+}
+
+bool initGlyphCache(const char * fontTexturePath, unsigned int pageSize, unsigned int maxPageCount){
+
+	// Read the font back : the driver decodes whatever format it is in
+	GLuint fontTexture = loadDDS(fontTexturePath);
+	if (fontTexture == 0)
+		return false;
+	GLint width = 0, height = 0;
+	glBindTexture(GL_TEXTURE_2D, fontTexture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+	if (width != height || width < GLYPH_GRID_SIZE){
+		printf("%s : a font must be a square grid of %dx%d characters\n", fontTexturePath, GLYPH_GRID_SIZE, GLYPH_GRID_SIZE);
+		glDeleteTextures(1, &fontTexture);
+		return false;
+	}
+	GlyphCacheFont.resize((size_t)width * height * 4);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, &GlyphCacheFont[0]);
+	glDeleteTextures(1, &fontTexture);
+
+	GlyphCacheFontSize = width;
+	GlyphCacheCellSize = width / GLYPH_GRID_SIZE;
+	for (unsigned int i=0; i<GLYPH_GRID_SIZE * GLYPH_GRID_SIZE; i++)
+		GlyphCacheSources[i].measured = false;
+	GlyphCachePageSize = pageSize;
+	GlyphCacheMaxPageCount = std::max(maxPageCount, 1u);
+	GlyphCacheFrame = 1;
+	GlyphCacheGeneration = 0;
+	return true;
+}
+
+static GlyphPage & addPage(){
+	GlyphCachePages.push_back(GlyphPage());
+	GlyphPage & page = GlyphCachePages.back();
+	page.pixels.assign((size_t)GlyphCachePageSize * GlyphCachePageSize * 4, 0);
+	page.texture = createPageTexture(page.pixels);
+	page.lastUse = 0;
+	resetPage(page);
+	return page;
+}
+
+// Finds room for width x height pixels, emptying the page used the longest ago if needed
+static bool allocateGlyph(unsigned int width, unsigned int height, unsigned int & out_page, unsigned int & out_x, unsigned int & out_y){
+	for (size_t p=0; p<GlyphCachePages.size(); p++){
+		if (addSkylineRectangle(GlyphCachePages[p].packer, width, height, out_x, out_y)){
+			out_page = (unsigned int)p;
+			return true;
+		}
+	}
+
+	// The pages used for this frame can't change before it is drawn
+	size_t oldest = GlyphCachePages.size();
+	for (size_t p=0; p<GlyphCachePages.size(); p++){
+		if (GlyphCachePages[p].lastUse != GlyphCacheFrame && (oldest == GlyphCachePages.size() || GlyphCachePages[p].lastUse < GlyphCachePages[oldest].lastUse))
+			oldest = p;
+	}
+	if (GlyphCachePages.size() < GlyphCacheMaxPageCount || oldest == GlyphCachePages.size()){
+		if (GlyphCachePages.size() >= GlyphCacheMaxPageCount)
+			printf("Glyph cache : all the pages are used by this frame, adding one\n");
+		addPage();
+		oldest = GlyphCachePages.size() - 1;
+	}else{
+		GlyphPage & page = GlyphCachePages[oldest];
+		for (size_t i=0; i<page.glyphs.size(); i++)
+			GlyphCacheGlyphs.erase(page.glyphs[i]);
+		resetPage(page);
+		std::fill(page.pixels.begin(), page.pixels.end(), 0);
+		page.dirtyRight = page.dirtyBottom = (int)GlyphCachePageSize;
+		GlyphCacheGeneration++;
+	}
+	out_page = (unsigned int)oldest;
+	return addSkylineRectangle(GlyphCachePages[oldest].packer, width, height, out_x, out_y);
+}
+
+// Average of the font around (x,y), in pixels of the cell, with alpha-weighted colors
+static void sampleFont(unsigned int index, float x, float y, float * out_rgba){
+	int size = (int)GlyphCacheCellSize;
+	int x0 = (int)floorf(x), y0 = (int)floorf(y);
+	float fx = x - x0, fy = y - y0;
+	for (int dy=0; dy<2; dy++){
+		for (int dx=0; dx<2; dx++){
+			int sx = x0 + dx, sy = y0 + dy;
+			if (sx < 0 || sy < 0 || sx >= size || sy >= size)
+				continue; // Transparent around the cell
+			float weight = (dx ? fx : 1.0f - fx) * (dy ? fy : 1.0f - fy);
+			const unsigned char * pixel = getFontPixel(index, sx, sy);
+			float alpha = weight * pixel[3];
+			out_rgba[0] += alpha * pixel[0];
+			out_rgba[1] += alpha * pixel[1];
+			out_rgba[2] += alpha * pixel[2];
+			out_rgba[3] += alpha;
+		}
+	}
+}
+
+// Crops the cell to its ink, and resamples it : n x n bilinear samples per pixel,
+// so that big reductions average the whole area of each pixel.
+static CachedGlyph rasterizeGlyph(unsigned int index, unsigned int pixelSize, unsigned long long key){
+	const SourceGlyph & source = measureGlyph(index);
+	float scale = (float)pixelSize / GlyphCacheCellSize;
+
+	CachedGlyph glyph;
+	memset(&glyph, 0, sizeof(glyph));
+	if (source.minX > source.maxX){
+		glyph.advance = GlyphCacheCellSize * 0.3f * scale; // A space
+		return glyph;
+	}
+	glyph.advance = (source.maxX + 1 - source.minX + getGlyphSpacing()) * scale;
+
+	int left   = (int)floorf(source.minX * scale);
+	int top    = (int)floorf(source.minY * scale);
+	int right  = (int)ceilf((source.maxX + 1) * scale);
+	int bottom = (int)ceilf((source.maxY + 1) * scale);
+	glyph.width  = right - left;
+	glyph.height = bottom - top;
+	glyph.offsetX = 0; // The pen is where the ink starts
+	glyph.offsetY = (int)pixelSize - top;
+
+	// 1 pixel of padding, so that linear filtering never reads the neighbours
+	unsigned int pageIndex, x, y;
+	if (!allocateGlyph(glyph.width + 2, glyph.height + 2, pageIndex, x, y)){
+		printf("Glyph cache : a %ux%u glyph doesn't fit in a page\n", glyph.width, glyph.height);
+		glyph.width = glyph.height = 0;
+		return glyph;
+	}
+	GlyphPage & page = GlyphCachePages[pageIndex];
+	x++;
+	y++;
+
+	int samples = std::max(1, std::min(8, (int)ceilf(1.0f / scale)));
+	float sampleWeight = 1.0f / (samples * samples);
+	for (int row=0; row<glyph.height; row++){
+		unsigned char * out = &page.pixels[(((size_t)y + row) * GlyphCachePageSize + x) * 4];
+		for (int column=0; column<glyph.width; column++, out+=4){
+			float rgba[4] = { 0, 0, 0, 0 };
+			for (int sy=0; sy<samples; sy++){
+				for (int sx=0; sx<samples; sx++){
+					// Centers of the samples, in the pixels of the cell
+					float fontX = (left + column + (sx + 0.5f) / samples) / scale - 0.5f;
+					float fontY = (top  + row    + (sy + 0.5f) / samples) / scale - 0.5f;
+					sampleFont(index, fontX, fontY, rgba);
+				}
+			}
+			float alpha = rgba[3] * sampleWeight;
+			for (int c=0; c<3; c++)
+				out[c] = rgba[3] > 0.0f ? (unsigned char)(rgba[c] / rgba[3] + 0.5f) : 0;
+			out[3] = (unsigned char)std::min(255.0f, alpha + 0.5f);
+		}
+	}
+
+	// The padding is already transparent
+	if (page.dirtyLeft >= page.dirtyRight){
+		page.dirtyLeft = x;
+		page.dirtyTop = y;
+		page.dirtyRight = x + glyph.width;
+		page.dirtyBottom = y + glyph.height;
+	}else{
+		page.dirtyLeft   = std::min(page.dirtyLeft,   (int)x);
+		page.dirtyTop    = std::min(page.dirtyTop,    (int)y);
+		page.dirtyRight  = std::max(page.dirtyRight,  (int)x + glyph.width);
+		page.dirtyBottom = std::max(page.dirtyBottom, (int)y + glyph.height);
+	}
+	page.glyphs.push_back(key);
+
+	glyph.page = pageIndex;
+	glyph.uv[0] = (float)x / GlyphCachePageSize;
+	glyph.uv[1] = (float)y / GlyphCachePageSize;
+	glyph.uv[2] = (float)(x + glyph.width) / GlyphCachePageSize;
+	glyph.uv[3] = (float)(y + glyph.height) / GlyphCachePageSize;
+	return glyph;
+}
+
+const CachedGlyph * getGlyph(unsigned int codepoint, unsigned int pixelSize){
+	unsigned int index = getGlyphIndex(codepoint);
+	unsigned long long key = ((unsigned long long)index << 32) | pixelSize;
+	std::unordered_map<unsigned long long, CachedGlyph>::iterator it = GlyphCacheGlyphs.find(key);
+	if (it == GlyphCacheGlyphs.end())
+		it = GlyphCacheGlyphs.insert(std::make_pair(key, rasterizeGlyph(index, pixelSize, key))).first;
+	if (it->second.width > 0)
+		markGlyphPageUsed(it->second.page);
+	return &it->second;
+}
+
+float getGlyphKerning(unsigned int left, unsigned int right, unsigned int pixelSize){
+	unsigned int a = getGlyphIndex(left), b = getGlyphIndex(right);
+	unsigned int key = (a << 8) | b;
+	std::unordered_map<unsigned int, float>::iterator it = GlyphCacheKerning.find(key);
+	if (it == GlyphCacheKerning.end()){
+		// The smallest gap between the two shapes, on the rows where both have ink.
+		// Half of what is more than the usual spacing is taken back, so that "AV" or "To"
+		// look as far apart as "HH".
+		const SourceGlyph & first = measureGlyph(a);
+		const SourceGlyph & second = measureGlyph(b);
+		float kerning = 0.0f;
+		int smallestGap = -1;
+		for (size_t y=0; y<first.rowRight.size(); y++){
+			if (first.rowRight[y] < 0 || second.rowLeft[y] < 0)
+				continue;
+			int gap = (first.maxX - first.rowRight[y]) + (second.rowLeft[y] - second.minX);
+			if (smallestGap < 0 || gap < smallestGap)
+				smallestGap = gap;
+		}
+		if (smallestGap > 0)
+			kerning = -0.5f * std::min((float)smallestGap, GlyphCacheCellSize / 4.0f);
+		it = GlyphCacheKerning.insert(std::make_pair(key, kerning)).first;
+	}
+	return it->second * pixelSize / GlyphCacheCellSize;
+}
+
+unsigned int decodeUTF8(const char * & text){
+	const unsigned char * bytes = (const unsigned char *)text;
+	unsigned int codepoint;
+	int length;
+	if (bytes[0] < 0x80)               { codepoint = bytes[0];        length = 1; }
+	else if ((bytes[0] & 0xE0) == 0xC0){ codepoint = bytes[0] & 0x1F; length = 2; }
+	else if ((bytes[0] & 0xF0) == 0xE0){ codepoint = bytes[0] & 0x0F; length = 3; }
+	else if ((bytes[0] & 0xF8) == 0xF0){ codepoint = bytes[0] & 0x07; length = 4; }
+	else{
+		text++;
+		return 0xFFFD;
+	}
+	for (int i=1; i<length; i++){
+		if ((bytes[i] & 0xC0) != 0x80){
+			text += i; // The byte that broke the sequence starts the next character
+			return 0xFFFD;
+		}
+		codepoint = (codepoint << 6) | (bytes[i] & 0x3F);
+	}
+	text += length;
+	// Overlong forms, surrogates and values past U+10FFFF are invalid too
+	static const unsigned int smallest[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+	if (codepoint < smallest[length] || (codepoint >= 0xD800 && codepoint <= 0xDFFF) || codepoint > 0x10FFFF)
+		return 0xFFFD;
+	return codepoint;
+}
+
+void markGlyphPageUsed(unsigned int page){
+	GlyphCachePages[page].lastUse = GlyphCacheFrame;
+}
+
+unsigned int getGlyphCacheGeneration(){
+	return GlyphCacheGeneration;
+}
+
+unsigned int getGlyphCachePageCount(){
+	return (unsigned int)GlyphCachePages.size();
+}
+
+GLuint getGlyphCachePageTexture(unsigned int page){
+	return GlyphCachePages[page].texture;
+}
+
+void flushGlyphCache(){
+	for (size_t p=0; p<GlyphCachePages.size(); p++){
+		GlyphPage & page = GlyphCachePages[p];
+		if (page.dirtyLeft >= page.dirtyRight)
+			continue;
+		glBindTexture(GL_TEXTURE_2D, page.texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, GlyphCachePageSize);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, page.dirtyLeft);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, page.dirtyTop);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, page.dirtyLeft, page.dirtyTop,
+			page.dirtyRight - page.dirtyLeft, page.dirtyBottom - page.dirtyTop, GL_RGBA, GL_UNSIGNED_BYTE, &page.pixels[0]);
+		page.dirtyLeft = page.dirtyTop = page.dirtyRight = page.dirtyBottom = 0;
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+	GlyphCacheFrame++;
+}
+
+void cleanupGlyphCache(){
+	for (size_t p=0; p<GlyphCachePages.size(); p++)
+		glDeleteTextures(1, &GlyphCachePages[p].texture);
+	GlyphCachePages.clear();
+	GlyphCacheGlyphs.clear();
+	GlyphCacheKerning.clear();
+	GlyphCacheFont.clear();
+}
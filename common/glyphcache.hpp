@@ -0,0 +1,51 @@
+#ifndef GLYPHCACHE_HPP
+#define GLYPHCACHE_HPP
+
+// Glyphs made on demand, at the pixel size they are drawn at, and kept in atlas pages.
+//
+// There is no font rasterizer in the tree : the glyphs come from a bitmap font, a
+// 16x16 grid of cells like Holstein.DDS, which is read back once. The cell of a character
+// is cropped to its ink and resampled to the asked size, so every size is sharp and
+// has its own proportional advance, and the pairs are kerned from the shapes of the
+// glyphs. The grid holds the first 256 code points (ASCII and Latin-1) : the others
+// are drawn as '?'.
+//
+// Glyphs are packed in pages of pageSize x pageSize pixels (RGBA, like the font). When
+// they are all full, the page used the longest ago is emptied and reused. Only the
+// rectangle of a page that changed is uploaded, in flushGlyphCache().
+
+struct CachedGlyph{
+	unsigned int page;        // getGlyphCachePageTexture(page)
+	float uv[4];              // Left, top, right, bottom
+	int offsetX, offsetY;     // From the pen position to the top left corner, y up
+	int width, height;        // Pixels, 0 for a space
+	float advance;            // Pixels to the next pen position
+};
+
+bool initGlyphCache(const char * fontTexturePath, unsigned int pageSize, unsigned int maxPageCount);
+
+// The glyph of a code point at a size (the height of a cell of the grid, in pixels),
+// made now if needed. The pointer stays valid until the next getGlyph().
+const CachedGlyph * getGlyph(unsigned int codepoint, unsigned int pixelSize);
+
+// Pixels to add between two glyphs, usually negative, at that size
+float getGlyphKerning(unsigned int left, unsigned int right, unsigned int pixelSize);
+
+// Reading the next character of a UTF-8 string : U+FFFD for invalid sequences
+unsigned int decodeUTF8(const char * & text);
+
+// A glyph used for this frame : its page must not be reused before the next flush
+void markGlyphPageUsed(unsigned int page);
+
+// Incremented each time a page is emptied : the UVs of the glyphs kept from before are wrong
+unsigned int getGlyphCacheGeneration();
+
+unsigned int getGlyphCachePageCount();
+GLuint getGlyphCachePageTexture(unsigned int page);
+
+// Uploads what changed, before drawing. Then the pages used for this frame can be reused.
+void flushGlyphCache();
+
+void cleanupGlyphCache();
+
+#endif
@@ -0,0 +1,159 @@
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "mainloop.hpp"
+
+#define MAINLOOP_AVERAGE    0.05  // Weight of the last frame in the averages
+#define MAINLOOP_SLEEP_TIME 0.001 // Seconds, at most, between two checks of the fences
+
+typedef std::chrono::steady_clock MainLoopClock;
+
+double MainLoopStep;
+double MainLoopFramePeriod;
+double MainLoopAccumulator;   // Seconds not simulated yet
+MainLoopClock::time_point MainLoopLastFrame;
+MainLoopClock::time_point MainLoopNextFrame; // When the next frame is due, with a frame period
+MainLoopClock::time_point MainLoopInputTime;
+double MainLoopFrameTime;     // Milliseconds, averaged
+double MainLoopLatency;       // Milliseconds, averaged
+double MainLoopSpinTime;      // Seconds before a deadline that sleeping stops
+
+// The frames the GPU may still be working on, oldest first
+GLsync MainLoopFences[MAINLOOP_FRAMES_IN_FLIGHT];
+MainLoopClock::time_point MainLoopFenceInputTimes[MAINLOOP_FRAMES_IN_FLIGHT];
+unsigned int MainLoopFenceCount;
+
+static double getSeconds(MainLoopClock::duration duration){
+	return std::chrono::duration<double>(duration).count();
+}
+
+void initMainLoop(double stepSeconds, double frameSeconds){
+	MainLoopStep = stepSeconds;
+	MainLoopFramePeriod = frameSeconds;
+	MainLoopAccumulator = 0.0;
+	MainLoopLastFrame = MainLoopClock::now();
+	MainLoopNextFrame = MainLoopLastFrame;
+	MainLoopInputTime = MainLoopLastFrame;
+	MainLoopFrameTime = 0.0;
+	MainLoopLatency = 0.0;
+	MainLoopSpinTime = 0.002; // Most systems sleep within 1 or 2 ms : it adapts below
+	MainLoopFenceCount = 0;
+}
+
+bool stepMainLoop(){
+	if (MainLoopAccumulator < MainLoopStep)
+		return false;
+	MainLoopAccumulator -= MainLoopStep;
+	return true;
+}
+
+double getMainLoopStep(){
+	return MainLoopStep;
+}
+
+float getMainLoopAlpha(){
+	return (float)std::min(1.0, MainLoopAccumulator / MainLoopStep);
+}
+
+// The frames the GPU has finished : their latency is known
+static void checkMainLoopFences(bool waitForOldest){
+	while (MainLoopFenceCount > 0){
+		GLuint64 timeout = waitForOldest ? 1000000000 : 0;
+		GLenum status = glClientWaitSync(MainLoopFences[0], GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (status == GL_TIMEOUT_EXPIRED){
+			// All the frames in flight are still queued : keep waiting, there is no room for another fence
+			if (waitForOldest)
+				continue;
+			return;
+		}
+		waitForOldest = false;
+
+		double latency = getSeconds(MainLoopClock::now() - MainLoopFenceInputTimes[0]) * 1000.0;
+		MainLoopLatency = MainLoopLatency == 0.0 ? latency : MainLoopLatency + (latency - MainLoopLatency) * MAINLOOP_AVERAGE;
+
+		glDeleteSync(MainLoopFences[0]);
+		MainLoopFenceCount--;
+		for (unsigned int i=0; i<MainLoopFenceCount; i++){
+			MainLoopFences[i] = MainLoopFences[i + 1];
+			MainLoopFenceInputTimes[i] = MainLoopFenceInputTimes[i + 1];
+		}
+	}
+}
+
+// Sleeps while it is safe, then spins. How late the sleeps wake up is measured, so
+// that the spinning is as short as this system allows. The sleeps are short, to
+// notice the frames the GPU finishes meanwhile.
+static void waitUntil(MainLoopClock::time_point deadline){
+	for (;;){
+		checkMainLoopFences(false);
+		MainLoopClock::time_point now = MainLoopClock::now();
+		double remaining = getSeconds(deadline - now);
+		if (remaining <= MainLoopSpinTime)
+			break;
+		double sleepTime = std::min(remaining - MainLoopSpinTime, MAINLOOP_SLEEP_TIME);
+		std::this_thread::sleep_for(std::chrono::duration<double>(sleepTime));
+		double overshoot = getSeconds(MainLoopClock::now() - now) - sleepTime;
+		// Quick to grow, slow to shrink, with a margin
+		double wanted = std::min(0.004, std::max(0.0002, overshoot * 1.5));
+		if (wanted > MainLoopSpinTime)
+			MainLoopSpinTime = wanted;
+		else
+			MainLoopSpinTime += (wanted - MainLoopSpinTime) * MAINLOOP_AVERAGE;
+	}
+	while (MainLoopClock::now() < deadline)
+		std::this_thread::yield();
+}
+
+void beginMainLoopFrame(){
+
+	// Waiting before reading the input, not after : the input is as recent as possible
+	if (MainLoopFramePeriod > 0.0){
+		MainLoopClock::duration period = std::chrono::duration_cast<MainLoopClock::duration>(std::chrono::duration<double>(MainLoopFramePeriod));
+		MainLoopClock::time_point now = MainLoopClock::now();
+		MainLoopNextFrame += period;
+		// More than a frame late : start again from now, instead of rushing the next frames
+		if (MainLoopNextFrame < now - period)
+			MainLoopNextFrame = now;
+		waitUntil(MainLoopNextFrame);
+	}
+
+	glfwPollEvents();
+	MainLoopClock::time_point now = MainLoopClock::now();
+	MainLoopInputTime = now;
+
+	double frameTime = getSeconds(now - MainLoopLastFrame);
+	MainLoopLastFrame = now;
+	MainLoopFrameTime += (frameTime * 1000.0 - MainLoopFrameTime) * MAINLOOP_AVERAGE;
+
+	// After a very long frame (loading, a breakpoint...), don't try to catch up
+	MainLoopAccumulator += std::min(frameTime, MAINLOOP_MAX_FRAME_TIME);
+}
+
+void endMainLoopFrame(){
+
+	// Don't get more than MAINLOOP_FRAMES_IN_FLIGHT frames ahead : the input of a frame
+	// would be old by the time it is drawn.
+	checkMainLoopFences(MainLoopFenceCount == MAINLOOP_FRAMES_IN_FLIGHT);
+	MainLoopFences[MainLoopFenceCount] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	MainLoopFenceInputTimes[MainLoopFenceCount] = MainLoopInputTime;
+	MainLoopFenceCount++;
+	checkMainLoopFences(false);
+}
+
+double getMainLoopFrameTime(){
+	return MainLoopFrameTime;
+}
+
+double getMainLoopLatency(){
+	return MainLoopLatency;
+}
+
+void cleanupMainLoop(){
+	for (unsigned int i=0; i<MainLoopFenceCount; i++)
+		glDeleteSync(MainLoopFences[i]);
+	MainLoopFenceCount = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef MAINLOOP_HPP
+#define MAINLOOP_HPP
+
+// A render loop with a fixed simulation step :
+//
+//	initMainLoop(1.0/120.0, 0.0);
+//	do{
+//		beginMainLoopFrame();
+//		while (stepMainLoop())
+//			updateControls((float)getMainLoopStep()); // And the rest of the simulation
+//		interpolateControls(getMainLoopAlpha());
+//		... draw ...
+//		glfwSwapBuffers(window);
+//		endMainLoopFrame();
+//	}while(...);
+//
+// The simulation always advances by the same step, whatever the frame rate : it
+// behaves the same at 30 or 300 frames per second. What is drawn is interpolated
+// between its last two states, so that motion stays smooth when the frames and the
+// steps don't line up.
+//
+// endMainLoopFrame() keeps the CPU at most MAINLOOP_FRAMES_IN_FLIGHT frames ahead of
+// the GPU. With a frame period, beginMainLoopFrame() waits until the next frame is due,
+// before reading the input : it sleeps, then spins only for the last moment the system
+// can't sleep precisely. Without vsync, the CPU doesn't spin at 100% anymore.
+
+#define MAINLOOP_MAX_FRAME_TIME   0.25 // Seconds simulated at most after a long frame ; the rest is dropped
+#define MAINLOOP_FRAMES_IN_FLIGHT 2    // Frames the GPU can be behind
+
+// stepSeconds : the simulation step.
+// frameSeconds : the shortest time between two frames, 0 to draw as fast as possible (or vsync).
+// Call it with the OpenGL context current.
+void initMainLoop(double stepSeconds, double frameSeconds);
+
+// Waits for the frame to be due, polls the events, then measures the time to simulate
+void beginMainLoopFrame();
+
+// True while a step is due : call it in a loop, one simulation step each time
+bool stepMainLoop();
+
+double getMainLoopStep();
+
+// Where the frame is between the last two simulation steps, from 0 to 1
+float getMainLoopAlpha();
+
+// After swapping the buffers
+void endMainLoopFrame();
+
+// Milliseconds, averaged over the last frames
+double getMainLoopFrameTime();
+
+// Milliseconds from the input events read by beginMainLoopFrame() to the GPU finishing
+// that frame : a bit more than the time until it is presented. Averaged.
+double getMainLoopLatency();
+
+void cleanupMainLoop();
+
+#endif
@@ -0,0 +1,280 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "file_utils.hpp"
+#include "objloader.hpp"
+#include "vboindexer.hpp"
+#include "meshoptimizer.hpp"
+#include "meshlod.hpp"
+#include "meshcache.hpp"
+
+static uint64_t alignTo16(uint64_t offset){
+	return (offset + 15) & ~(uint64_t)15;
+}
+
+// Checks that an array described in the header is aligned and fits in the file
+static bool isArrayInFile(uint64_t offset, uint64_t count, uint64_t elementSize, size_t fileSize){
+	return offset % 16 == 0 && offset <= fileSize && count * elementSize <= fileSize - offset;
+}
+
+// Validates a cache file and points "mesh" into it
+static bool readMeshCache(const char * data, size_t size, MeshCacheHeader & header, MeshCacheView & mesh){
+
+	if (size < sizeof(MeshCacheHeader))
+		return false;
+	memcpy(&header, data, sizeof(header));
+
+	if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION)
+		return false;
+	if (header.indexSize != 2 && header.indexSize != 4)
+		return false;
+	if (!isArrayInFile(header.lodsOffset,     header.lodCount,    sizeof(MeshLOD),      size) ||
+	    !isArrayInFile(header.indicesOffset,  header.indexCount,  header.indexSize,     size) ||
+	    !isArrayInFile(header.verticesOffset, header.vertexCount, sizeof(glm::vec3), size) ||
+	    !isArrayInFile(header.uvsOffset,      header.vertexCount, sizeof(glm::vec2), size) ||
+	    !isArrayInFile(header.normalsOffset,  header.vertexCount, sizeof(glm::vec3), size))
+		return false;
+
+	// Every level must be inside the index buffer
+	const MeshLOD * lods = (const MeshLOD *)(data + header.lodsOffset);
+	if (header.lodCount == 0)
+		return false;
+	for (uint32_t l=0; l<header.lodCount; l++){
+		if (lods[l].indexOffset > header.indexCount || lods[l].indexCount > header.indexCount - lods[l].indexOffset)
+			return false;
+	}
+
+	mesh.indexSize   = header.indexSize;
+	mesh.indexCount  = header.indexCount;
+	mesh.vertexCount = header.vertexCount;
+	mesh.lodCount    = header.lodCount;
+	mesh.lods     = lods;
+	mesh.indices  = data + header.indicesOffset;
+	mesh.vertices = (const glm::vec3 *)(data + header.verticesOffset);
+	mesh.uvs      = (const glm::vec2 *)(data + header.uvsOffset);
+	mesh.normals  = (const glm::vec3 *)(data + header.normalsOffset);
+	return true;
+}
+
+template <typename T>
+static void copyArray(std::vector<char> & out, uint64_t offset, const std::vector<T> & array){
+	if (!array.empty())
+		memcpy(&out[(size_t)offset], &array[0], array.size() * sizeof(T));
+}
+
+// Lays out the whole cache file in memory
+static void buildMeshCache(
+	MeshCacheHeader & header, // source* fields already filled
+	const std::vector<unsigned short> & indices16,
+	const std::vector<unsigned int> & indices32,
+	unsigned int indexSize,
+	const std::vector<MeshLOD> & lods,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	std::vector<char> & out
+){
+	header.magic       = MESH_CACHE_MAGIC;
+	header.version     = MESH_CACHE_VERSION;
+	header.indexSize   = indexSize;
+	header.indexCount  = (uint32_t)(indexSize == 2 ? indices16.size() : indices32.size());
+	header.vertexCount = (uint32_t)vertices.size();
+	header.lodCount    = (uint32_t)lods.size();
+
+	header.lodsOffset     = alignTo16(sizeof(MeshCacheHeader));
+	header.indicesOffset  = alignTo16(header.lodsOffset     + (uint64_t)lods.size() * sizeof(MeshLOD));
+	header.verticesOffset = alignTo16(header.indicesOffset  + (uint64_t)header.indexCount * header.indexSize);
+	header.uvsOffset      = alignTo16(header.verticesOffset + (uint64_t)vertices.size() * sizeof(glm::vec3));
+	header.normalsOffset  = alignTo16(header.uvsOffset      + (uint64_t)uvs.size()      * sizeof(glm::vec2));
+	uint64_t fileSize     = header.normalsOffset + (uint64_t)normals.size() * sizeof(glm::vec3);
+
+	out.assign((size_t)fileSize, 0);
+	memcpy(&out[0], &header, sizeof(header));
+	copyArray(out, header.lodsOffset, lods);
+	if (indexSize == 2) copyArray(out, header.indicesOffset, indices16);
+	else                copyArray(out, header.indicesOffset, indices32);
+	copyArray(out, header.verticesOffset, vertices);
+	copyArray(out, header.uvsOffset,      uvs);
+	copyArray(out, header.normalsOffset,  normals);
+}
+
+// Writes in a temporary file first, so that a crash never leaves a half-written cache behind
+static bool writeWholeFile(const std::string & path, const std::vector<char> & data){
+
+	std::string temporaryPath = path + ".tmp";
+	FILE * file = fopen(temporaryPath.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+	ok = (fclose(file) == 0) && ok;
+
+	if (ok){
+		remove(path.c_str()); // rename() doesn't replace existing files on Windows
+		ok = rename(temporaryPath.c_str(), path.c_str()) == 0;
+	}
+	if (!ok)
+		remove(temporaryPath.c_str());
+	return ok;
+}
+
+static void resetMeshCacheView(MeshCacheView & mesh){
+	mesh.file.data = NULL;
+	mesh.file.size = 0;
+	mesh.file.fileHandle = NULL;
+	mesh.file.mappingHandle = NULL;
+	std::vector<char>().swap(mesh.memory);
+	mesh.indexSize = 0;
+	mesh.indexCount = 0;
+	mesh.vertexCount = 0;
+	mesh.lodCount = 0;
+	mesh.lods = NULL;
+	mesh.indices = NULL;
+	mesh.vertices = NULL;
+	mesh.uvs = NULL;
+	mesh.normals = NULL;
+}
+
+// Optimizes the mesh, then replaces "indices" by all its levels of detail
+template <typename IndexType>
+static void buildLODs(
+	std::vector<IndexType> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	std::vector<MeshLOD> & lods
+){
+	optimizeMesh(indices, vertices, uvs, normals);
+
+	std::vector<IndexType> levels;
+	generateLODChain(indices, vertices, MESH_CACHE_LOD_LEVELS, 0.5f, levels, lods);
+
+	// Simplification keeps the triangle order of level 0, which isn't that good anymore
+	for (size_t l=1; l<lods.size(); l++){
+		std::vector<IndexType> level(levels.begin() + lods[l].indexOffset, levels.begin() + lods[l].indexOffset + lods[l].indexCount);
+		optimizeVertexCache(level, vertices.size());
+		std::copy(level.begin(), level.end(), levels.begin() + lods[l].indexOffset);
+	}
+	indices.swap(levels);
+
+	printf("LODs :");
+	for (size_t l=0; l<lods.size(); l++)
+		printf(" %u triangles (error %g)%s", lods[l].indexCount / 3, lods[l].error, l + 1 < lods.size() ? "," : "\n");
+}
+
+static bool hashFile(const char * path, unsigned long long & hash){
+	MappedFile file;
+	if (!mapFile(path, file))
+		return false;
+	hash = hashMemory(file.data, file.size);
+	unmapFile(file);
+	return true;
+}
+
+// The content of the OBJ didn't change, only its date : store the new one, so that the
+// next launches don't hash the whole file again.
+static bool updateCacheModificationTime(const std::string & cachePath, long long sourceModificationTime){
+	FILE * file = fopen(cachePath.c_str(), "r+b");
+	if (file == NULL)
+		return false;
+	int64_t modificationTime = sourceModificationTime;
+	bool ok = fseek(file, offsetof(MeshCacheHeader, sourceModificationTime), SEEK_SET) == 0
+		&& fwrite(&modificationTime, sizeof(modificationTime), 1, file) == 1;
+	ok = (fclose(file) == 0) && ok;
+	return ok;
+}
+
+bool loadOBJCached(const char * path, MeshCacheView & mesh){
+
+	resetMeshCacheView(mesh);
+	std::string cachePath = std::string(path) + ".meshcache";
+
+	unsigned long long sourceSize;
+	long long sourceModificationTime;
+	if (!getFileInfo(path, sourceSize, sourceModificationTime)){
+		printf("Impossible to open %s ! Are you in the right path ? See Tutorial 1 for details\n", path);
+		getchar();
+		return false;
+	}
+
+	// Use the cache if it was built from this very file.
+	// Same size and date : nothing to check. Same size but another date : the file may
+	// just have been touched or copied, so compare the content.
+	bool sourceHashed = false;
+	unsigned long long sourceHash = 0;
+	if (mapFile(cachePath.c_str(), mesh.file)){
+		MeshCacheHeader header;
+		if (readMeshCache(mesh.file.data, mesh.file.size, header, mesh) && header.sourceSize == sourceSize){
+			bool upToDate = (header.sourceModificationTime == sourceModificationTime);
+			if (!upToDate){
+				sourceHashed = hashFile(path, sourceHash);
+				upToDate = sourceHashed && (header.sourceHash == sourceHash);
+				if (upToDate){
+					// The file is mapped read-only (and locked on Windows) : patch it, then map it again
+					unmapFile(mesh.file);
+					resetMeshCacheView(mesh);
+					if (!updateCacheModificationTime(cachePath, sourceModificationTime))
+						printf("Could not update mesh cache %s\n", cachePath.c_str());
+					upToDate = mapFile(cachePath.c_str(), mesh.file) && readMeshCache(mesh.file.data, mesh.file.size, header, mesh);
+				}
+			}
+			if (upToDate){
+				printf("Loading mesh cache %s...\n", cachePath.c_str());
+				return true;
+			}
+		}
+		unmapFile(mesh.file);
+		resetMeshCacheView(mesh);
+	}
+
+	// No valid cache : do it the slow way, and save the result for next time
+	if (!sourceHashed && !hashFile(path, sourceHash))
+		return false;
+
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	if (!loadOBJ(path, vertices, uvs, normals))
+		return false;
+
+	std::vector<unsigned short> indices16;
+	std::vector<unsigned int> indices32;
+	std::vector<glm::vec3> indexed_vertices;
+	std::vector<glm::vec2> indexed_uvs;
+	std::vector<glm::vec3> indexed_normals;
+	unsigned int indexSize = indexVBO_narrowest(vertices, uvs, normals, indices16, indices32, indexed_vertices, indexed_uvs, indexed_normals);
+
+	// This only runs when the cache is rebuilt, so we can afford to reorder for the GPU,
+	// and to build the LODs
+	std::vector<MeshLOD> lods;
+	if (indexSize == 2) buildLODs(indices16, indexed_vertices, indexed_uvs, indexed_normals, lods);
+	else                buildLODs(indices32, indexed_vertices, indexed_uvs, indexed_normals, lods);
+
+	MeshCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	header.sourceSize = sourceSize;
+	header.sourceModificationTime = sourceModificationTime;
+	header.sourceHash = sourceHash;
+	buildMeshCache(header, indices16, indices32, indexSize, lods, indexed_vertices, indexed_uvs, indexed_normals, mesh.memory);
+
+	if (writeWholeFile(cachePath, mesh.memory)){
+		printf("Wrote mesh cache %s\n", cachePath.c_str());
+	}else{
+		// Not fatal (read-only folder...), we still have everything in memory
+		printf("Could not write mesh cache %s\n", cachePath.c_str());
+	}
+
+	MeshCacheHeader check;
+	return readMeshCache(&mesh.memory[0], mesh.memory.size(), check, mesh);
+}
+
+void closeMeshCache(MeshCacheView & mesh){
+	unmapFile(mesh.file);
+	resetMeshCacheView(mesh);
+}
@@ -0,0 +1,71 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <stdint.h>
+
+#include "file_utils.hpp"
+#include "meshlod.hpp"
+
+// Binary cache of what loadOBJ + indexVBO_narrowest + optimizeMesh + generateLODChain produce,
+// so that the OBJ only has to be parsed once. The file is <model.obj>.meshcache, next to the OBJ.
+// Its layout is :
+//
+//   MeshCacheHeader
+//   lods           (lodCount * MeshLOD)
+//   indices        (indexCount * indexSize bytes, all the levels one after the other)
+//   vertices       (vertexCount * glm::vec3)
+//   uvs            (vertexCount * glm::vec2)
+//   normals        (vertexCount * glm::vec3)
+//
+// Each array starts on a 16-byte boundary, at the offset given in the header.
+// Everything is little-endian, as written by the machine that built the cache.
+
+#define MESH_CACHE_MAGIC   0x4D4C474F // "OGLM" in ASCII
+#define MESH_CACHE_VERSION 4 // 2 : 32-bit indices when needed, 3 : optimized triangle and vertex order, 4 : LODs
+#define MESH_CACHE_LOD_LEVELS 5 // Each one with half the triangles of the previous one
+
+struct MeshCacheHeader{
+	uint32_t magic;
+	uint32_t version;
+	// What the cache was built from. If the OBJ changed, the cache is rebuilt.
+	uint64_t sourceSize;
+	int64_t  sourceModificationTime;
+	uint64_t sourceHash; // hashMemory() of the whole OBJ file
+	// The indexed mesh
+	uint32_t indexSize;  // Bytes per index : 2 (GL_UNSIGNED_SHORT) or 4 (GL_UNSIGNED_INT)
+	uint32_t indexCount;
+	uint32_t vertexCount;
+	uint32_t lodCount;
+	uint64_t lodsOffset;
+	uint64_t indicesOffset;
+	uint64_t verticesOffset;
+	uint64_t uvsOffset;
+	uint64_t normalsOffset;
+};
+
+// An indexed mesh read from a cache file. The pointers point straight into the
+// mapped file (or into "memory" if the cache couldn't be written), so they can be
+// given to glBufferData as they are.
+struct MeshCacheView{
+	MappedFile file;
+	std::vector<char> memory;
+	unsigned int indexSize;
+	unsigned int indexCount;  // Of all the levels together
+	unsigned int vertexCount;
+	unsigned int lodCount;    // At least 1 : level 0 is the full mesh
+	const MeshLOD * lods;
+	const void * indices;
+	const glm::vec3 * vertices;
+	const glm::vec2 * uvs;
+	const glm::vec3 * normals;
+};
+
+// Loads an indexed mesh from an OBJ file, going through <path>.meshcache.
+// If the cache is missing, from an older version, or the OBJ changed since, the OBJ
+// is parsed, indexed and optimized again and the cache is rewritten.
+bool loadOBJCached(const char * path, MeshCacheView & mesh);
+
+// Releases what loadOBJCached() mapped or allocated.
+void closeMeshCache(MeshCacheView & mesh);
+
+#endif
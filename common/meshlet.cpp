@@ -0,0 +1,426 @@
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+#include <glm/glm.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MESHLET_SSE2 1
+#endif
+
+#include "meshlet.hpp"
+
+static const unsigned char notInMeshlet = 0xFF;
+
+// For each vertex, the first vertex with exactly the same position, so that
+// triangles on both sides of a UV or normal seam are neighbours too.
+static void findSamePositions(const std::vector<glm::vec3> & vertices, std::vector<unsigned int> & canonical){
+	size_t n = vertices.size();
+	std::vector<unsigned int> order(n);
+	for (size_t i=0; i<n; i++)
+		order[i] = (unsigned int)i;
+	struct PositionLess{
+		const std::vector<glm::vec3> * vertices;
+		bool operator()(unsigned int a, unsigned int b) const {
+			int c = memcmp(&(*vertices)[a], &(*vertices)[b], sizeof(glm::vec3));
+			return c < 0 || (c == 0 && a < b);
+		}
+	};
+	PositionLess less = { &vertices };
+	std::sort(order.begin(), order.end(), less);
+
+	canonical.resize(n);
+	for (size_t i=0; i<n; ){
+		size_t j = i + 1;
+		while (j < n && memcmp(&vertices[order[i]], &vertices[order[j]], sizeof(glm::vec3)) == 0)
+			j++;
+		for (size_t k=i; k<j; k++)
+			canonical[order[k]] = order[i];
+		i = j;
+	}
+}
+
+// Meshlet being built
+struct MeshletBuilder{
+	std::vector<unsigned char> localIndex; // Per vertex of the mesh : index in the meshlet, or notInMeshlet
+	Meshlet meshlet;
+	glm::vec3 centroidSum; // Of the triangles
+	glm::vec3 normalSum;   // Unit normals of the triangles
+
+	void start(const std::vector<unsigned int> & meshletVertices, const std::vector<unsigned char> & meshletTriangles){
+		meshlet.vertexOffset = (unsigned int)meshletVertices.size();
+		meshlet.triangleOffset = (unsigned int)(meshletTriangles.size() / 3);
+		meshlet.vertexCount = meshlet.triangleCount = 0;
+		centroidSum = normalSum = glm::vec3(0.0f);
+	}
+
+	void finish(std::vector<Meshlet> & meshlets, const std::vector<unsigned int> & meshletVertices, const std::vector<unsigned char> & meshletTriangles){
+		for (unsigned int i=0; i<meshlet.vertexCount; i++)
+			localIndex[meshletVertices[meshlet.vertexOffset + i]] = notInMeshlet;
+		meshlets.push_back(meshlet);
+		start(meshletVertices, meshletTriangles);
+	}
+
+	unsigned int newVertices(unsigned int a, unsigned int b, unsigned int c) const {
+		return (localIndex[a] == notInMeshlet) + (localIndex[b] == notInMeshlet && b != a) + (localIndex[c] == notInMeshlet && c != a && c != b);
+	}
+};
+
+// Next to a finished meshlet, the triangle with the less triangles left around it : starting
+// from holes and corners leaves less isolated triangles, which would make small meshlets later.
+template <typename IndexType>
+static size_t findSeed(
+	const Meshlet & meshlet,
+	const std::vector<unsigned int> & meshletVertices,
+	const std::vector<IndexType> & indices,
+	const std::vector<unsigned int> & canonical,
+	const std::vector<unsigned int> & adjacencyOffsets,
+	const std::vector<unsigned int> & adjacency,
+	const std::vector<unsigned int> & liveTriangles,
+	const std::vector<unsigned char> & emitted
+){
+	size_t best = emitted.size();
+	unsigned int bestLive = ~0u;
+	for (unsigned int i=0; i<meshlet.vertexCount; i++){
+		unsigned int position = canonical[meshletVertices[meshlet.vertexOffset + i]];
+		for (unsigned int j=adjacencyOffsets[position]; j<adjacencyOffsets[position + 1] && liveTriangles[position] > 0; j++){
+			unsigned int t = adjacency[j];
+			if (emitted[t])
+				continue;
+			unsigned int live = liveTriangles[canonical[indices[3*t+0]]] + liveTriangles[canonical[indices[3*t+1]]] + liveTriangles[canonical[indices[3*t+2]]];
+			if (live < bestLive){
+				best = t;
+				bestLive = live;
+			}
+		}
+	}
+	return best;
+}
+
+template <typename IndexType>
+size_t buildMeshlets(
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	std::vector<Meshlet> & out_meshlets,
+	std::vector<unsigned int> & out_meshletVertices,
+	std::vector<unsigned char> & out_meshletTriangles
+){
+	out_meshlets.clear();
+	out_meshletVertices.clear();
+	out_meshletTriangles.clear();
+
+	size_t triangleCount = indices.size() / 3;
+	size_t vertexCount = vertices.size();
+	for (size_t i=0; i<triangleCount*3; i++){
+		if (indices[i] >= vertexCount)
+			return 0; // Not an indexVBO output
+	}
+
+	std::vector<unsigned int> canonical;
+	findSamePositions(vertices, canonical);
+
+	// Triangles around each position
+	std::vector<unsigned int> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t i=0; i<triangleCount*3; i++)
+		adjacencyOffsets[canonical[indices[i]] + 1]++;
+	for (size_t v=0; v<vertexCount; v++)
+		adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	std::vector<unsigned int> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i=0; i<triangleCount*3; i++)
+		adjacency[fill[canonical[indices[i]]]++] = (unsigned int)(i / 3);
+	// Triangles not in a meshlet yet, per position : positions without any are skipped
+	std::vector<unsigned int> liveTriangles(vertexCount);
+	for (size_t v=0; v<vertexCount; v++)
+		liveTriangles[v] = adjacencyOffsets[v + 1] - adjacencyOffsets[v];
+
+	std::vector<glm::vec3> centroids(triangleCount);
+	std::vector<glm::vec3> normals(triangleCount);
+	for (size_t t=0; t<triangleCount; t++){
+		const glm::vec3 & a = vertices[indices[3*t+0]];
+		const glm::vec3 & b = vertices[indices[3*t+1]];
+		const glm::vec3 & c = vertices[indices[3*t+2]];
+		centroids[t] = (a + b + c) / 3.0f;
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float length = glm::length(n);
+		normals[t] = length > 0.0f ? n / length : glm::vec3(0.0f);
+	}
+
+	std::vector<unsigned char> emitted(triangleCount, 0);
+	MeshletBuilder builder;
+	builder.localIndex.assign(vertexCount, notInMeshlet);
+	builder.start(out_meshletVertices, out_meshletTriangles);
+
+	size_t nextSeed = triangleCount; // Triangle to start the next meshlet with
+	size_t seed = 0; // Else the first triangle left, in index buffer order : close to the previous meshlets too
+	size_t remaining = triangleCount;
+	while (remaining > 0){
+		Meshlet & meshlet = builder.meshlet;
+		size_t best = triangleCount;
+
+		if (meshlet.triangleCount == 0){
+			if (nextSeed == triangleCount || emitted[nextSeed]){
+				while (emitted[seed])
+					seed++;
+				nextSeed = seed;
+			}
+			best = nextSeed;
+		} else {
+			// The neighbouring triangle that adds the less vertices, then the closest one facing the same way
+			glm::vec3 center = builder.centroidSum / (float)meshlet.triangleCount;
+			float axisLength = glm::length(builder.normalSum);
+			glm::vec3 axis = axisLength > 0.0f ? builder.normalSum / axisLength : glm::vec3(0.0f);
+			unsigned int bestExtra = 4;
+			float bestScore = 0.0f;
+			for (unsigned int i=0; i<meshlet.vertexCount; i++){
+				unsigned int position = canonical[out_meshletVertices[meshlet.vertexOffset + i]];
+				if (liveTriangles[position] == 0)
+					continue;
+				for (unsigned int j=adjacencyOffsets[position]; j<adjacencyOffsets[position + 1]; j++){
+					unsigned int t = adjacency[j];
+					if (emitted[t])
+						continue;
+					unsigned int a = indices[3*t+0], b = indices[3*t+1], c = indices[3*t+2];
+					unsigned int extra = builder.newVertices(a, b, c);
+					if (meshlet.vertexCount + extra > MESHLET_MAX_VERTICES)
+						continue;
+					// The last triangle around a vertex goes first, whatever it costs : else it
+					// would be left alone, and end up in a meshlet of a few triangles.
+					if (liveTriangles[canonical[a]] == 1 || liveTriangles[canonical[b]] == 1 || liveTriangles[canonical[c]] == 1)
+						extra = 0;
+					if (extra > bestExtra)
+						continue;
+					float score = glm::length(centroids[t] - center) * (2.0f - glm::dot(normals[t], axis));
+					if (extra < bestExtra || score < bestScore){
+						best = t;
+						bestExtra = extra;
+						bestScore = score;
+					}
+				}
+			}
+		}
+
+		if (best == triangleCount){
+			// Nothing fits, or nothing around : start a new meshlet
+			nextSeed = findSeed(builder.meshlet, out_meshletVertices, indices, canonical, adjacencyOffsets, adjacency, liveTriangles, emitted);
+			builder.finish(out_meshlets, out_meshletVertices, out_meshletTriangles);
+			continue;
+		}
+
+		for (int k=0; k<3; k++){
+			unsigned int v = indices[3*best+k];
+			if (builder.localIndex[v] == notInMeshlet){
+				builder.localIndex[v] = (unsigned char)meshlet.vertexCount++;
+				out_meshletVertices.push_back(v);
+			}
+			out_meshletTriangles.push_back(builder.localIndex[v]);
+			liveTriangles[canonical[v]]--;
+		}
+		meshlet.triangleCount++;
+		builder.centroidSum += centroids[best];
+		builder.normalSum += normals[best];
+		emitted[best] = 1;
+		remaining--;
+
+		if (meshlet.triangleCount == MESHLET_MAX_TRIANGLES){
+			nextSeed = findSeed(builder.meshlet, out_meshletVertices, indices, canonical, adjacencyOffsets, adjacency, liveTriangles, emitted);
+			builder.finish(out_meshlets, out_meshletVertices, out_meshletTriangles);
+		}
+	}
+	if (builder.meshlet.triangleCount > 0)
+		out_meshlets.push_back(builder.meshlet);
+
+	return out_meshlets.size();
+}
+
+template <typename IndexType>
+void getMeshletIndices(
+	const std::vector<Meshlet> & meshlets,
+	const std::vector<unsigned int> & meshletVertices,
+	const std::vector<unsigned char> & meshletTriangles,
+	std::vector<IndexType> & out_indices
+){
+	out_indices.resize(meshletTriangles.size());
+	for (size_t m=0; m<meshlets.size(); m++){
+		const Meshlet & meshlet = meshlets[m];
+		for (unsigned int i=0; i<meshlet.triangleCount*3; i++){
+			size_t j = (size_t)meshlet.triangleOffset*3 + i;
+			out_indices[j] = (IndexType)meshletVertices[meshlet.vertexOffset + meshletTriangles[j]];
+		}
+	}
+}
+
+MeshletBounds computeMeshletBounds(
+	const Meshlet & meshlet,
+	const std::vector<unsigned int> & meshletVertices,
+	const std::vector<unsigned char> & meshletTriangles,
+	const std::vector<glm::vec3> & vertices
+){
+	MeshletBounds bounds;
+	const unsigned int * localVertices = &meshletVertices[meshlet.vertexOffset];
+	const unsigned char * triangles = &meshletTriangles[(size_t)meshlet.triangleOffset*3];
+
+	bounds.boxMin = bounds.boxMax = meshlet.vertexCount > 0 ? vertices[localVertices[0]] : glm::vec3(0.0f);
+	for (unsigned int i=1; i<meshlet.vertexCount; i++){
+		bounds.boxMin = glm::min(bounds.boxMin, vertices[localVertices[i]]);
+		bounds.boxMax = glm::max(bounds.boxMax, vertices[localVertices[i]]);
+	}
+	bounds.center = (bounds.boxMin + bounds.boxMax) * 0.5f;
+	float radius2 = 0.0f;
+	for (unsigned int i=0; i<meshlet.vertexCount; i++){
+		glm::vec3 d = vertices[localVertices[i]] - bounds.center;
+		radius2 = std::max(radius2, glm::dot(d, d));
+	}
+	bounds.radius = sqrtf(radius2);
+
+	std::vector<glm::vec3> normals;
+	normals.reserve(meshlet.triangleCount);
+	glm::vec3 normalSum(0.0f);
+	for (unsigned int t=0; t<meshlet.triangleCount; t++){
+		const glm::vec3 & a = vertices[localVertices[triangles[3*t+0]]];
+		const glm::vec3 & b = vertices[localVertices[triangles[3*t+1]]];
+		const glm::vec3 & c = vertices[localVertices[triangles[3*t+2]]];
+		glm::vec3 n = glm::cross(b - a, c - a);
+		float length = glm::length(n);
+		if (!(length > 0.0f))
+			continue; // Degenerate triangles are never drawn
+		normals.push_back(n / length);
+		normalSum += n / length;
+	}
+
+	bounds.coneCutoff = 1.0f;
+	float axisLength = glm::length(normalSum);
+	bounds.coneAxis = axisLength > 0.0f ? normalSum / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+	if (axisLength > 0.0f){
+		float minDot = 1.0f;
+		for (size_t i=0; i<normals.size(); i++)
+			minDot = std::min(minDot, glm::dot(normals[i], bounds.coneAxis));
+		// Wider than a half space : some triangle always faces the camera
+		if (minDot > 0.0f)
+			bounds.coneCutoff = std::min(sqrtf(1.0f - minDot * minDot), 1.0f);
+	}
+	return bounds;
+}
+
+// Planes of the view frustum, in the space where MVP is applied, pointing inwards and
+// normalized so that dot(plane, (p,1)) is the distance from p to the plane.
+// (Gribb & Hartmann - "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix")
+static void getFrustumPlanes(const glm::mat4 & MVP, glm::vec4 planes[6]){
+	glm::vec4 row0(MVP[0][0], MVP[1][0], MVP[2][0], MVP[3][0]);
+	glm::vec4 row1(MVP[0][1], MVP[1][1], MVP[2][1], MVP[3][1]);
+	glm::vec4 row2(MVP[0][2], MVP[1][2], MVP[2][2], MVP[3][2]);
+	glm::vec4 row3(MVP[0][3], MVP[1][3], MVP[2][3], MVP[3][3]);
+	planes[0] = row3 + row0; // Left
+	planes[1] = row3 - row0; // Right
+	planes[2] = row3 + row1; // Bottom
+	planes[3] = row3 - row1; // Top
+	planes[4] = row3 + row2; // Near
+	planes[5] = row3 - row2; // Far
+	for (int i=0; i<6; i++){
+		float length = glm::length(glm::vec3(planes[i]));
+		if (length > 0.0f)
+			planes[i] /= length;
+	}
+}
+
+// Every triangle faces away from the camera
+static inline bool isBackfacing(const MeshletBounds & b, const glm::vec3 & cameraPosition){
+	glm::vec3 d = b.center - cameraPosition;
+	return glm::dot(d, b.coneAxis) >= b.coneCutoff * glm::length(d) + b.radius;
+}
+
+size_t cullMeshlets(
+	const std::vector<MeshletBounds> & bounds,
+	const glm::mat4 & MVP,
+	const glm::vec3 & cameraPosition,
+	std::vector<unsigned int> & out_visible
+){
+	// Every meshlet is written, but only the visible ones are kept : no branch to mispredict
+	out_visible.resize(bounds.size());
+	size_t visibleCount = 0;
+	glm::vec4 planes[6];
+	getFrustumPlanes(MVP, planes);
+
+#ifdef MESHLET_SSE2
+	// 4 meshlets at once, one component per register. "center, radius" and "coneAxis, coneCutoff"
+	// are 4 floats next to each other in MeshletBounds : 4 loads and a transpose give them.
+	const __m128 cameraX = _mm_set1_ps(cameraPosition.x);
+	const __m128 cameraY = _mm_set1_ps(cameraPosition.y);
+	const __m128 cameraZ = _mm_set1_ps(cameraPosition.z);
+	const __m128 zero = _mm_setzero_ps();
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p=0; p<6; p++){
+		planeX[p] = _mm_set1_ps(planes[p].x);
+		planeY[p] = _mm_set1_ps(planes[p].y);
+		planeZ[p] = _mm_set1_ps(planes[p].z);
+		planeW[p] = _mm_set1_ps(planes[p].w);
+	}
+	size_t i = 0;
+	for (; i + 4 <= bounds.size(); i += 4){
+		__m128 x = _mm_loadu_ps(&bounds[i+0].center.x);
+		__m128 y = _mm_loadu_ps(&bounds[i+1].center.x);
+		__m128 z = _mm_loadu_ps(&bounds[i+2].center.x);
+		__m128 radius = _mm_loadu_ps(&bounds[i+3].center.x);
+		_MM_TRANSPOSE4_PS(x, y, z, radius);
+		__m128 minusRadius = _mm_sub_ps(zero, radius);
+
+		// Outside if the sphere is entirely behind one of the planes
+		__m128 outside = zero;
+		for (int p=0; p<6; p++){
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)), _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(d, minusRadius));
+		}
+
+		__m128 axisX = _mm_loadu_ps(&bounds[i+0].coneAxis.x);
+		__m128 axisY = _mm_loadu_ps(&bounds[i+1].coneAxis.x);
+		__m128 axisZ = _mm_loadu_ps(&bounds[i+2].coneAxis.x);
+		__m128 cutoff = _mm_loadu_ps(&bounds[i+3].coneAxis.x);
+		_MM_TRANSPOSE4_PS(axisX, axisY, axisZ, cutoff);
+		__m128 dx = _mm_sub_ps(x, cameraX);
+		__m128 dy = _mm_sub_ps(y, cameraY);
+		__m128 dz = _mm_sub_ps(z, cameraZ);
+		__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, axisX), _mm_mul_ps(dy, axisY)), _mm_mul_ps(dz, axisZ));
+		__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+		__m128 backfacing = _mm_cmpge_ps(dot, _mm_add_ps(_mm_mul_ps(cutoff, length), radius));
+
+		int culled = _mm_movemask_ps(_mm_or_ps(outside, backfacing));
+		for (int k=0; k<4; k++){
+			out_visible[visibleCount] = (unsigned int)(i + k);
+			visibleCount += ((culled >> k) & 1) ^ 1;
+		}
+	}
+#else
+	size_t i = 0;
+#endif
+	for (; i<bounds.size(); i++){
+		const MeshletBounds & b = bounds[i];
+		bool outside = false;
+		for (int p=0; p<6 && !outside; p++)
+			outside = glm::dot(glm::vec3(planes[p]), b.center) + planes[p].w < -b.radius;
+		out_visible[visibleCount] = (unsigned int)i;
+		visibleCount += !(outside || isBackfacing(b, cameraPosition));
+	}
+	out_visible.resize(visibleCount);
+	return visibleCount;
+}
+
+template size_t buildMeshlets<unsigned short>(
+	const std::vector<unsigned short> & indices,
+	const std::vector<glm::vec3> & vertices,
+	std::vector<Meshlet> & out_meshlets,
+	std::vector<unsigned int> & out_meshletVertices,
+	std::vector<unsigned char> & out_meshletTriangles
+);
+
+template size_t buildMeshlets<unsigned int>(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	std::vector<Meshlet> & out_meshlets,
+	std::vector<unsigned int> & out_meshletVertices,
+	std::vector<unsigned char> & out_meshletTriangles
+);
+
+template void getMeshletIndices<unsigned short>(const std::vector<Meshlet> & meshlets, const std::vector<unsigned int> & meshletVertices, const std::vector<unsigned char> & meshletTriangles, std::vector<unsigned short> & out_indices);
+template void getMeshletIndices<unsigned int>  (const std::vector<Meshlet> & meshlets, const std::vector<unsigned int> & meshletVertices, const std::vector<unsigned char> & meshletTriangles, std::vector<unsigned int>   & out_indices);
@@ -0,0 +1,76 @@
+#ifndef MESHLET_HPP
+#define MESHLET_HPP
+
+// Meshlets : small clusters of triangles of an indexed mesh (the output of indexVBO),
+// each with bounds that are precise enough to skip the clusters that can't be seen,
+// instead of drawing all the object or nothing.
+//
+// A meshlet is built by adding the neighbouring triangles that bring the less new
+// vertices, and then the closest ones facing the same way : this keeps the bounding
+// spheres small and the normal cones narrow.
+
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+
+struct Meshlet{
+	unsigned int vertexOffset;   // In meshletVertices
+	unsigned int triangleOffset; // In triangles : meshletTriangles[3*triangleOffset], and in the index buffer of getMeshletIndices()
+	unsigned int vertexCount;
+	unsigned int triangleCount;
+};
+
+// cullMeshlets reads "center, radius" and "coneAxis, coneCutoff" as 4 floats each : keep them together.
+struct MeshletBounds{
+	glm::vec3 center;     // Bounding sphere
+	float radius;
+	glm::vec3 boxMin;     // Bounding box
+	glm::vec3 boxMax;
+	glm::vec3 coneAxis;   // Average direction of the normals of the triangles
+	float coneCutoff;     // sin of the angle between coneAxis and the normal that is the furthest from it,
+	                      // 1 if the triangles face too many directions to ever be all backfacing
+};
+
+// Splits the mesh in meshlets.
+// meshletVertices gets the vertices of each meshlet (indices in "vertices"),
+// meshletTriangles 3 bytes per triangle, which are indices in the meshlet's vertices.
+// Returns the number of meshlets.
+template <typename IndexType>
+size_t buildMeshlets(
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	std::vector<Meshlet> & out_meshlets,
+	std::vector<unsigned int> & out_meshletVertices,
+	std::vector<unsigned char> & out_meshletTriangles
+);
+
+// Index buffer with the triangles of the meshlets one after the other. The triangles
+// of meshlet i are the 3*triangleCount indices starting at 3*triangleOffset, so
+// neighbouring visible meshlets can be drawn with a single draw call.
+template <typename IndexType>
+void getMeshletIndices(
+	const std::vector<Meshlet> & meshlets,
+	const std::vector<unsigned int> & meshletVertices,
+	const std::vector<unsigned char> & meshletTriangles,
+	std::vector<IndexType> & out_indices
+);
+
+// Triangles are front-facing when counter-clockwise, like OpenGL's default.
+MeshletBounds computeMeshletBounds(
+	const Meshlet & meshlet,
+	const std::vector<unsigned int> & meshletVertices,
+	const std::vector<unsigned char> & meshletTriangles,
+	const std::vector<glm::vec3> & vertices
+);
+
+// Keeps the meshlets that are at least partly in the view frustum and have at least
+// one triangle facing the camera. Everything is in model space :
+// MVP = Projection * View * Model, and cameraPosition = inverse(Model) * camera position in world space.
+// out_visible gets the numbers of the visible meshlets, in increasing order. Returns how many there are.
+size_t cullMeshlets(
+	const std::vector<MeshletBounds> & bounds,
+	const glm::mat4 & MVP,
+	const glm::vec3 & cameraPosition,
+	std::vector<unsigned int> & out_visible
+);
+
+#endif
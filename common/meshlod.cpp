@@ -0,0 +1,406 @@
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <glm/glm.hpp>
+
+#include "meshlod.hpp"
+
+// Weighted sum of squared distances to a set of planes, as a symmetric 4x4 matrix :
+// [p 1] * Q * [p 1]^T
+struct Quadric{
+	double a00, a01, a02, a11, a12, a22; // Upper 3x3 (n * n^T)
+	double b0, b1, b2;                   // d * n
+	double c;                            // d * d
+	double weight;                       // Sum of the weights
+
+	void clear(){
+		a00 = a01 = a02 = a11 = a12 = a22 = b0 = b1 = b2 = c = weight = 0.0;
+	}
+
+	// Plane n.p + d = 0, with |n| = 1, counted "weight" times
+	void addPlane(const glm::dvec3 & n, double d, double weight){
+		a00 += weight * n.x * n.x; a01 += weight * n.x * n.y; a02 += weight * n.x * n.z;
+		a11 += weight * n.y * n.y; a12 += weight * n.y * n.z;
+		a22 += weight * n.z * n.z;
+		b0 += weight * d * n.x; b1 += weight * d * n.y; b2 += weight * d * n.z;
+		c += weight * d * d;
+		this->weight += weight;
+	}
+
+	void add(const Quadric & q){
+		a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+		b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; weight += q.weight;
+	}
+
+	// Mean squared distance to the planes, in model units squared
+	double evaluate(const glm::vec3 & p) const {
+		if (weight <= 0.0)
+			return 0.0;
+		double x = p.x, y = p.y, z = p.z;
+		double r = a00*x*x + a11*y*y + a22*z*z + 2.0*(a01*x*y + a02*x*z + a12*y*z)
+		         + 2.0*(b0*x + b1*y + b2*z) + c;
+		return r > 0.0 ? r / weight : 0.0; // Rounding can make it slightly negative
+	}
+};
+
+// A possible collapse : vertex "from" moves onto vertex "to"
+struct Collapse{
+	unsigned int from;
+	unsigned int to;
+	double cost;
+	bool operator < (const Collapse & other) const { return cost < other.cost; }
+};
+
+// For each vertex, the first vertex with exactly the same position.
+// Vertices that share a position are the two sides of a UV or normal seam.
+static void findSamePositions(const std::vector<glm::vec3> & vertices, std::vector<unsigned int> & canonical, std::vector<unsigned char> & isSeam){
+	size_t n = vertices.size();
+	std::vector<unsigned int> order(n);
+	for (size_t i=0; i<n; i++)
+		order[i] = (unsigned int)i;
+	struct PositionLess{
+		const std::vector<glm::vec3> * vertices;
+		bool operator()(unsigned int a, unsigned int b) const {
+			int c = memcmp(&(*vertices)[a], &(*vertices)[b], sizeof(glm::vec3));
+			return c < 0 || (c == 0 && a < b);
+		}
+	};
+	PositionLess less = { &vertices };
+	std::sort(order.begin(), order.end(), less);
+
+	canonical.resize(n);
+	isSeam.assign(n, 0);
+	for (size_t i=0; i<n; ){
+		size_t j = i + 1;
+		while (j < n && memcmp(&vertices[order[i]], &vertices[order[j]], sizeof(glm::vec3)) == 0)
+			j++;
+		for (size_t k=i; k<j; k++){
+			canonical[order[k]] = order[i]; // order[i] is the smallest index of the group
+			isSeam[order[k]] = (j - i > 1);
+		}
+		i = j;
+	}
+}
+
+// Vertices on an edge that only one triangle uses, at the position level (so that
+// seams don't count as borders)
+template <typename IndexType>
+static void findBorders(const std::vector<IndexType> & indices, const std::vector<unsigned int> & canonical, std::vector<unsigned char> & isBorder){
+	std::vector<unsigned long long> edges;
+	edges.reserve(indices.size());
+	for (size_t t=0; t+2<indices.size(); t+=3){
+		for (int k=0; k<3; k++){
+			unsigned long long a = canonical[indices[t+k]], b = canonical[indices[t+(k+1)%3]];
+			edges.push_back((a << 32) | b);
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+
+	for (size_t i=0; i<edges.size(); i++){
+		unsigned long long a = edges[i] >> 32, b = edges[i] & 0xFFFFFFFFull;
+		if (a == b)
+			continue;
+		// An interior edge is used in the other direction by the neighbouring triangle
+		if (!std::binary_search(edges.begin(), edges.end(), (b << 32) | a)){
+			isBorder[a] = 1;
+			isBorder[b] = 1;
+		}
+	}
+}
+
+static inline bool isDegenerate(unsigned int a, unsigned int b, unsigned int c, const std::vector<unsigned int> & canonical){
+	return canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[c] == canonical[a];
+}
+
+// The state of a simplification. It can be run several times with smaller and smaller
+// targets : the quadrics keep the planes of the original mesh, so the error of the
+// later levels is still measured against the original surface.
+template <typename IndexType>
+struct MeshSimplifier{
+	const std::vector<glm::vec3> & vertices;
+	std::vector<IndexType> indices; // Current triangles
+	std::vector<unsigned int> canonical;
+	std::vector<unsigned char> locked;
+	std::vector<Quadric> quadrics;
+	double reachedCost; // Highest cost of a collapse so far : the error, squared
+
+	// Temporaries of each pass
+	std::vector<unsigned int> remap;
+	std::vector<unsigned char> lockedThisPass;
+	std::vector<unsigned int> offsets;
+	std::vector<unsigned int> adjacency;
+	std::vector<Collapse> collapses;
+
+	MeshSimplifier(const std::vector<IndexType> & in_indices, const std::vector<glm::vec3> & in_vertices) : vertices(in_vertices), reachedCost(0.0){
+		size_t vertexCount = vertices.size();
+
+		findSamePositions(vertices, canonical, locked);
+		std::vector<unsigned char> isBorder(vertexCount, 0);
+		findBorders(in_indices, canonical, isBorder);
+
+		// Seams and borders stay where they are
+		for (size_t v=0; v<vertexCount; v++)
+			locked[v] = locked[v] || isBorder[canonical[v]];
+
+		// Quadrics of the original triangles, weighted by their area, on the canonical vertices
+		quadrics.resize(vertexCount);
+		for (size_t v=0; v<vertexCount; v++)
+			quadrics[v].clear();
+		indices.reserve(in_indices.size());
+		for (size_t t=0; t+2<in_indices.size(); t+=3){
+			if (isDegenerate(in_indices[t], in_indices[t+1], in_indices[t+2], canonical))
+				continue;
+			indices.push_back(in_indices[t]);
+			indices.push_back(in_indices[t+1]);
+			indices.push_back(in_indices[t+2]);
+
+			glm::dvec3 p0(vertices[in_indices[t]]), p1(vertices[in_indices[t+1]]), p2(vertices[in_indices[t+2]]);
+			glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+			double length = glm::length(normal);
+			if (length == 0.0)
+				continue;
+			normal /= length;
+			double area = 0.5 * length;
+			for (int k=0; k<3; k++)
+				quadrics[canonical[in_indices[t+k]]].addPlane(normal, -glm::dot(normal, p0), area);
+		}
+
+		remap.resize(vertexCount);
+		lockedThisPass.resize(vertexCount);
+		offsets.resize(vertexCount + 1);
+	}
+
+	// Each pass finds the cheapest collapses that don't touch each other, does them, and starts over
+	void simplify(size_t targetTriangleCount, double maxCost){
+		size_t vertexCount = vertices.size();
+
+		while (indices.size() / 3 > targetTriangleCount){
+			size_t triangleCount = indices.size() / 3;
+
+			// Triangles around each vertex
+			std::fill(offsets.begin(), offsets.end(), 0);
+			for (size_t i=0; i<indices.size(); i++)
+				offsets[indices[i] + 1]++;
+			for (size_t v=0; v<vertexCount; v++)
+				offsets[v+1] += offsets[v];
+			adjacency.resize(indices.size());
+			{
+				std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+				for (size_t i=0; i<indices.size(); i++)
+					adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+			}
+
+			// Every edge, in its cheapest direction
+			collapses.clear();
+			for (size_t i=0; i<indices.size(); i++){
+				unsigned int a = indices[i];
+				unsigned int b = indices[i % 3 == 2 ? i - 2 : i + 1];
+				if (a > b)
+					continue; // Interior edges appear twice, once in each direction
+				Quadric q = quadrics[canonical[a]];
+				q.add(quadrics[canonical[b]]);
+				Collapse best = { 0, 0, -1.0 };
+				if (!locked[a]){
+					Collapse c = { a, b, q.evaluate(vertices[b]) };
+					best = c;
+				}
+				if (!locked[b]){
+					Collapse c = { b, a, q.evaluate(vertices[a]) };
+					if (best.cost < 0.0 || c.cost < best.cost)
+						best = c;
+				}
+				if (best.cost >= 0.0 && best.cost <= maxCost)
+					collapses.push_back(best);
+			}
+			if (collapses.empty())
+				break;
+			std::sort(collapses.begin(), collapses.end());
+
+			for (size_t v=0; v<vertexCount; v++)
+				remap[v] = (unsigned int)v;
+			std::fill(lockedThisPass.begin(), lockedThisPass.end(), 0);
+
+			size_t removedTriangles = 0;
+			size_t trianglesToRemove = triangleCount - targetTriangleCount;
+
+			// Most collapses remove 2 triangles, but many of the cheapest ones will be skipped because
+			// they touch another one. Don't go much further than the cost we would need without that :
+			// the next pass will find cheaper ones again.
+			size_t collapseGoal = trianglesToRemove / 2;
+			double passMaxCost = collapseGoal < collapses.size() ? 1.5 * collapses[collapseGoal].cost : maxCost;
+
+			for (size_t c=0; c<collapses.size() && removedTriangles < trianglesToRemove; c++){
+				const Collapse & collapse = collapses[c];
+				if (collapse.cost > passMaxCost && removedTriangles > 0)
+					break;
+				unsigned int from = collapse.from, to = collapse.to;
+				if (lockedThisPass[from] || lockedThisPass[to])
+					continue;
+
+				// Refuse collapses that turn a triangle around (or almost)
+				bool flips = false;
+				size_t removed = 0;
+				for (unsigned int k=offsets[from]; k<offsets[from+1] && !flips; k++){
+					unsigned int t = adjacency[k];
+					unsigned int corner[3] = { indices[3*t], indices[3*t+1], indices[3*t+2] };
+					if (corner[0] == to || corner[1] == to || corner[2] == to){
+						removed++;
+						continue;
+					}
+					glm::vec3 before = glm::cross(vertices[corner[1]] - vertices[corner[0]], vertices[corner[2]] - vertices[corner[0]]);
+					for (int i=0; i<3; i++)
+						if (corner[i] == from) corner[i] = to;
+					glm::vec3 after = glm::cross(vertices[corner[1]] - vertices[corner[0]], vertices[corner[2]] - vertices[corner[0]]);
+					flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+				}
+				if (flips)
+					continue;
+
+				remap[from] = to;
+				quadrics[canonical[to]].add(quadrics[canonical[from]]);
+				removedTriangles += removed;
+				if (collapse.cost > reachedCost)
+					reachedCost = collapse.cost;
+
+				// The flip test above is only valid if nothing else changes around "from" during this pass
+				for (unsigned int k=offsets[from]; k<offsets[from+1]; k++){
+					unsigned int t = adjacency[k];
+					lockedThisPass[indices[3*t]] = 1;
+					lockedThisPass[indices[3*t+1]] = 1;
+					lockedThisPass[indices[3*t+2]] = 1;
+				}
+			}
+			if (removedTriangles == 0)
+				break;
+
+			// Apply the collapses, and remove the triangles that became degenerate
+			size_t written = 0;
+			for (size_t i=0; i+2<indices.size(); i+=3){
+				unsigned int a = remap[indices[i]], b = remap[indices[i+1]], c = remap[indices[i+2]];
+				if (isDegenerate(a, b, c, canonical))
+					continue;
+				indices[written++] = (IndexType)a;
+				indices[written++] = (IndexType)b;
+				indices[written++] = (IndexType)c;
+			}
+			indices.resize(written);
+		}
+	}
+};
+
+template <typename IndexType>
+float simplifyMesh(
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	size_t targetTriangleCount,
+	float maxError,
+	std::vector<IndexType> & out_indices
+){
+	MeshSimplifier<IndexType> simplifier(indices, vertices);
+	simplifier.simplify(targetTriangleCount, (double)maxError * maxError);
+	out_indices.swap(simplifier.indices);
+	return (float)sqrt(simplifier.reachedCost);
+}
+
+template <typename IndexType>
+void generateLODChain(
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	unsigned int maxLevels,
+	float reduction,
+	std::vector<IndexType> & out_indices,
+	std::vector<MeshLOD> & out_lods
+){
+	out_indices.assign(indices.begin(), indices.end() - indices.size() % 3);
+	out_lods.clear();
+	if (maxLevels == 0)
+		return;
+
+	MeshLOD lod0 = { 0, (unsigned int)out_indices.size(), 0.0f };
+	out_lods.push_back(lod0);
+
+	// Each level goes on from the previous one
+	MeshSimplifier<IndexType> simplifier(indices, vertices);
+	size_t triangleCount = out_indices.size() / 3;
+	for (unsigned int l=1; l<maxLevels; l++){
+		size_t target = (size_t)(triangleCount * reduction);
+		simplifier.simplify(target, 1e300);
+		const std::vector<IndexType> & level = simplifier.indices;
+
+		// Not worth a level if it barely has less triangles than the previous one
+		if (level.empty() || level.size() / 3 > triangleCount - triangleCount / 8)
+			break;
+
+		MeshLOD lod = { (unsigned int)out_indices.size(), (unsigned int)level.size(), (float)sqrt(simplifier.reachedCost) };
+		out_lods.push_back(lod);
+		out_indices.insert(out_indices.end(), level.begin(), level.end());
+		triangleCount = level.size() / 3;
+	}
+}
+
+float getLODProjectionScale(float verticalFoVRadians, float screenHeight){
+	return screenHeight / (2.0f * tanf(verticalFoVRadians * 0.5f));
+}
+
+unsigned int selectLOD(
+	const MeshLOD * lods,
+	unsigned int lodCount,
+	float distance,
+	float projectionScale,
+	LODSelector & selector
+){
+	if (lodCount == 0)
+		return 0;
+	if (selector.level >= lodCount)
+		selector.level = lodCount - 1;
+
+	// Error in pixels : the error in model units, seen from "distance" away
+	float pixelsPerUnit = projectionScale / (distance > 1e-4f ? distance : 1e-4f);
+
+	// Too coarse : go back to finer levels until the error is acceptable again
+	while (selector.level > 0 && lods[selector.level].error * pixelsPerUnit > selector.maxPixelError)
+		selector.level--;
+	// Fine enough : go to coarser levels, but only well under the threshold
+	float coarserThreshold = selector.maxPixelError * (1.0f - selector.hysteresis);
+	while (selector.level + 1 < lodCount && lods[selector.level + 1].error * pixelsPerUnit <= coarserThreshold)
+		selector.level++;
+
+	return selector.level;
+}
+
+template float simplifyMesh<unsigned short>(
+	const std::vector<unsigned short> & indices,
+	const std::vector<glm::vec3> & vertices,
+	size_t targetTriangleCount,
+	float maxError,
+	std::vector<unsigned short> & out_indices
+);
+
+template float simplifyMesh<unsigned int>(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	size_t targetTriangleCount,
+	float maxError,
+	std::vector<unsigned int> & out_indices
+);
+
+template void generateLODChain<unsigned short>(
+	const std::vector<unsigned short> & indices,
+	const std::vector<glm::vec3> & vertices,
+	unsigned int maxLevels,
+	float reduction,
+	std::vector<unsigned short> & out_indices,
+	std::vector<MeshLOD> & out_lods
+);
+
+template void generateLODChain<unsigned int>(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	unsigned int maxLevels,
+	float reduction,
+	std::vector<unsigned int> & out_indices,
+	std::vector<MeshLOD> & out_lods
+);
@@ -0,0 +1,70 @@
+#ifndef MESHLOD_HPP
+#define MESHLOD_HPP
+
+// Levels of detail for indexed meshes (the output of indexVBO).
+//
+// Simplification collapses edges by moving a vertex onto one of its neighbours,
+// picking the collapses that change the surface the least (quadric error metric,
+// Garland & Heckbert). No vertex is created or moved, so all the levels use the
+// same vertex buffer : only the index buffer changes.
+// Vertices on a UV or normal seam (several vertices at the same position) and on
+// the border of the mesh never move, and collapses that would turn a triangle
+// around are refused.
+
+// One level in an index buffer that holds all the levels, one after the other
+struct MeshLOD{
+	unsigned int indexOffset; // In indices, not bytes
+	unsigned int indexCount;
+	float error;              // How far the surface may be from the original one, in model units
+};
+
+// Simplifies the mesh down to targetTriangleCount triangles, or less if possible
+// without going over maxError (in model units).
+// Returns the error of the result, in model units.
+template <typename IndexType>
+float simplifyMesh(
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	size_t targetTriangleCount,
+	float maxError,
+	std::vector<IndexType> & out_indices
+);
+
+// Builds up to maxLevels levels, each one with about "reduction" times the triangles
+// of the previous one (0.5 : half). Level 0 is the mesh itself.
+// out_indices gets all the levels one after the other, and out_lods where they are.
+// Stops early once the mesh can't be simplified anymore.
+template <typename IndexType>
+void generateLODChain(
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	unsigned int maxLevels,
+	float reduction,
+	std::vector<IndexType> & out_indices,
+	std::vector<MeshLOD> & out_lods
+);
+
+// Picks a level each frame from its error projected on the screen.
+// Set "level" to 0 and the thresholds once, then give the same LODSelector to
+// selectLOD() every frame.
+struct LODSelector{
+	unsigned int level;  // Level used last frame
+	float maxPixelError; // Use the coarsest level whose error is smaller than this, in pixels
+	float hysteresis;    // 0.25 : only go to a coarser level once its error is 25% under maxPixelError,
+	                     // so that an object right at the limit doesn't switch level every frame
+};
+
+// projectionScale = screen height in pixels / (2 * tan(vertical FoV / 2))
+float getLODProjectionScale(float verticalFoVRadians, float screenHeight);
+
+// distance : from the camera to the closest point of the object.
+// Returns the level to draw, also kept in selector.level.
+unsigned int selectLOD(
+	const MeshLOD * lods,
+	unsigned int lodCount,
+	float distance,
+	float projectionScale,
+	LODSelector & selector
+);
+
+#endif
@@ -0,0 +1,323 @@
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+
+#include <glm/glm.hpp>
+
+#include "meshoptimizer.hpp"
+
+static const unsigned int unusedVertex = 0xFFFFFFFFu;
+
+// FIFO post-transform cache. Each vertex remembers when it entered the cache :
+// it is still there if less than "size" vertices entered after it.
+struct VertexCacheSimulation{
+	std::vector<unsigned int> timestamps;
+	unsigned int time;
+	unsigned int size;
+
+	VertexCacheSimulation(size_t vertexCount, unsigned int cacheSize) : timestamps(vertexCount, 0), time(cacheSize + 1), size(cacheSize){}
+
+	// Returns 1 if the vertex had to be transformed
+	unsigned int access(unsigned int vertex){
+		if (time - timestamps[vertex] > size){
+			timestamps[vertex] = time++;
+			return 1;
+		}
+		return 0;
+	}
+
+	// Empties the cache
+	void flush(){
+		time += size + 1;
+	}
+};
+
+// Number of vertices, counting the ones that the indices use even if vertexCount is too small
+template <typename IndexType>
+static size_t countVertices(const std::vector<IndexType> & indices, size_t vertexCount){
+	for (size_t i=0; i<indices.size(); i++){
+		if (indices[i] >= vertexCount)
+			vertexCount = (size_t)indices[i] + 1;
+	}
+	return vertexCount;
+}
+
+template <typename IndexType>
+VertexCacheStatistics analyzeVertexCache(
+	const std::vector<IndexType> & indices,
+	size_t vertexCount,
+	unsigned int cacheSize
+){
+	vertexCount = countVertices(indices, vertexCount);
+	VertexCacheSimulation cache(vertexCount, cacheSize);
+
+	VertexCacheStatistics result;
+	result.transformedVertices = 0;
+	for (size_t i=0; i<indices.size(); i++)
+		result.transformedVertices += cache.access(indices[i]);
+
+	size_t triangleCount = indices.size() / 3;
+	result.acmr = triangleCount == 0 ? 0.0f : (float)result.transformedVertices / triangleCount;
+	result.atvr = vertexCount   == 0 ? 0.0f : (float)result.transformedVertices / vertexCount;
+	return result;
+}
+
+template <typename IndexType>
+void optimizeVertexCache(
+	std::vector<IndexType> & indices,
+	size_t vertexCount,
+	unsigned int cacheSize
+){
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+	vertexCount = countVertices(indices, vertexCount);
+
+	// Triangles that use each vertex : adjacency[offsets[v] .. offsets[v+1]-1]
+	std::vector<unsigned int> liveTriangles(vertexCount, 0);
+	for (size_t i=0; i<triangleCount*3; i++)
+		liveTriangles[indices[i]]++;
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v=0; v<vertexCount; v++)
+		offsets[v+1] = offsets[v] + liveTriangles[v];
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	{
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i=0; i<triangleCount*3; i++)
+			adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	std::vector<unsigned int> cacheTime(vertexCount, 0);
+	std::vector<unsigned char> emitted(triangleCount, 0);
+	std::vector<unsigned int> deadEnd; // Recently used vertices, to restart from when a fan ends
+	deadEnd.reserve(triangleCount * 3);
+	std::vector<IndexType> result;
+	result.reserve(indices.size());
+
+	unsigned int time = cacheSize + 1;
+	size_t cursor = 0; // Next vertex to try, in order, when the dead-end stack is empty
+	size_t fanning = indices[0];
+
+	while (fanning != unusedVertex){
+
+		// Draw all the remaining triangles around "fanning"
+		size_t candidatesBegin = deadEnd.size();
+		for (unsigned int k=offsets[fanning]; k<offsets[fanning+1]; k++){
+			unsigned int triangle = adjacency[k];
+			if (emitted[triangle])
+				continue;
+			emitted[triangle] = 1;
+			for (int c=0; c<3; c++){
+				IndexType v = indices[3*triangle + c];
+				result.push_back(v);
+				deadEnd.push_back(v);
+				liveTriangles[v]--;
+				if (time - cacheTime[v] > cacheSize)
+					cacheTime[v] = time++;
+			}
+		}
+
+		// Next fanning vertex : among the vertices that were just used, the oldest one in
+		// the cache that will still be in the cache after all its triangles are drawn
+		size_t next = unusedVertex;
+		int bestPriority = -1;
+		for (size_t k=candidatesBegin; k<deadEnd.size(); k++){
+			unsigned int v = deadEnd[k];
+			if (liveTriangles[v] == 0)
+				continue;
+			int priority = 0;
+			if (time - cacheTime[v] + 2*liveTriangles[v] <= cacheSize)
+				priority = (int)(time - cacheTime[v]);
+			if (priority > bestPriority){
+				bestPriority = priority;
+				next = v;
+			}
+		}
+
+		// Dead end : go back to a recently used vertex, or to the next one in order
+		while (next == unusedVertex && !deadEnd.empty()){
+			unsigned int v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTriangles[v] > 0)
+				next = v;
+		}
+		while (next == unusedVertex && cursor < vertexCount){
+			if (liveTriangles[cursor] > 0)
+				next = cursor;
+			cursor++;
+		}
+		fanning = next;
+	}
+
+	// A last incomplete triangle, if any, stays at the end
+	for (size_t i=triangleCount*3; i<indices.size(); i++)
+		result.push_back(indices[i]);
+	indices.swap(result);
+}
+
+template <typename IndexType>
+void optimizeOverdraw(
+	std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	float threshold,
+	unsigned int cacheSize
+){
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+	VertexCacheSimulation cache(countVertices(indices, vertices.size()), cacheSize);
+
+	// Hard boundaries : where a triangle misses its 3 vertices, optimizeVertexCache
+	// started a new, unrelated part of the mesh
+	std::vector<size_t> hardBoundaries;
+	for (size_t t=0; t<triangleCount; t++){
+		unsigned int misses = cache.access(indices[3*t]) + cache.access(indices[3*t+1]) + cache.access(indices[3*t+2]);
+		if (t == 0 || misses == 3)
+			hardBoundaries.push_back(t);
+	}
+	hardBoundaries.push_back(triangleCount);
+
+	// Soft boundaries : split each part as soon as its beginning has an ACMR that is
+	// not worse than "threshold" times the ACMR of the whole part
+	std::vector<size_t> clusters;
+	for (size_t h=0; h+1<hardBoundaries.size(); h++){
+		size_t begin = hardBoundaries[h], end = hardBoundaries[h+1];
+
+		cache.flush();
+		unsigned int misses = 0;
+		for (size_t i=3*begin; i<3*end; i++)
+			misses += cache.access(indices[i]);
+		float targetAcmr = threshold * (float)misses / (float)(end - begin);
+
+		cache.flush();
+		clusters.push_back(begin);
+		unsigned int runningMisses = 0, runningTriangles = 0;
+		for (size_t t=begin; t<end; t++){
+			runningMisses += cache.access(indices[3*t]) + cache.access(indices[3*t+1]) + cache.access(indices[3*t+2]);
+			runningTriangles++;
+			if (t + 1 < end && (float)runningMisses <= targetAcmr * (float)runningTriangles){
+				clusters.push_back(t + 1);
+				cache.flush();
+				runningMisses = 0;
+				runningTriangles = 0;
+			}
+		}
+	}
+	size_t clusterCount = clusters.size();
+	clusters.push_back(triangleCount);
+
+	// Sort key : how much the cluster faces away from the center of the mesh.
+	// Clusters on the outside of the mesh can hide the others, so they go first.
+	std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+	std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+	glm::vec3 meshCentroid(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c=0; c<clusterCount; c++){
+		float clusterArea = 0.0f;
+		for (size_t t=clusters[c]; t<clusters[c+1]; t++){
+			const glm::vec3 & p0 = vertices[indices[3*t]];
+			const glm::vec3 & p1 = vertices[indices[3*t+1]];
+			const glm::vec3 & p2 = vertices[indices[3*t+2]];
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0); // length = 2 * area
+			float area = glm::length(normal);
+			glm::vec3 centroid = (p0 + p1 + p2) / 3.0f;
+			clusterCentroids[c] += centroid * area;
+			clusterNormals[c] += normal;
+			clusterArea += area;
+		}
+		meshCentroid += clusterCentroids[c];
+		meshArea += clusterArea;
+		if (clusterArea > 0.0f)
+			clusterCentroids[c] /= clusterArea;
+	}
+	if (meshArea > 0.0f)
+		meshCentroid /= meshArea;
+
+	std::vector<std::pair<float, size_t> > order(clusterCount);
+	for (size_t c=0; c<clusterCount; c++){
+		float length = glm::length(clusterNormals[c]);
+		glm::vec3 normal = length > 0.0f ? clusterNormals[c] / length : glm::vec3(0.0f);
+		// Negated, so that sorting in increasing order puts the outside first
+		order[c] = std::make_pair(-glm::dot(clusterCentroids[c] - meshCentroid, normal), c);
+	}
+	std::stable_sort(order.begin(), order.end());
+
+	std::vector<IndexType> result;
+	result.reserve(indices.size());
+	for (size_t k=0; k<clusterCount; k++){
+		size_t c = order[k].second;
+		result.insert(result.end(), indices.begin() + 3*clusters[c], indices.begin() + 3*clusters[c+1]);
+	}
+	for (size_t i=triangleCount*3; i<indices.size(); i++)
+		result.push_back(indices[i]);
+	indices.swap(result);
+}
+
+template <typename IndexType>
+size_t optimizeVertexFetchRemap(
+	std::vector<IndexType> & indices,
+	size_t vertexCount,
+	std::vector<unsigned int> & remap
+){
+	remap.assign(countVertices(indices, vertexCount), unusedVertex);
+	unsigned int next = 0;
+	for (size_t i=0; i<indices.size(); i++){
+		unsigned int & newIndex = remap[indices[i]];
+		if (newIndex == unusedVertex)
+			newIndex = next++;
+		indices[i] = (IndexType)newIndex;
+	}
+	return next;
+}
+
+template <typename IndexType>
+void optimizeMesh(
+	std::vector<IndexType> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	float overdrawThreshold
+){
+	VertexCacheStatistics before = analyzeVertexCache(indices, vertices.size());
+
+	optimizeVertexCache(indices, vertices.size());
+	if (overdrawThreshold > 0.0f)
+		optimizeOverdraw(indices, vertices, overdrawThreshold);
+
+	std::vector<unsigned int> remap;
+	size_t usedVertexCount = optimizeVertexFetchRemap(indices, vertices.size(), remap);
+	remapVertices(vertices, remap, usedVertexCount);
+	remapVertices(uvs,      remap, usedVertexCount);
+	remapVertices(normals,  remap, usedVertexCount);
+
+	VertexCacheStatistics after = analyzeVertexCache(indices, vertices.size());
+	printf("Mesh optimization : ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+template VertexCacheStatistics analyzeVertexCache<unsigned short>(const std::vector<unsigned short> & indices, size_t vertexCount, unsigned int cacheSize);
+template VertexCacheStatistics analyzeVertexCache<unsigned int>  (const std::vector<unsigned int>   & indices, size_t vertexCount, unsigned int cacheSize);
+
+template void optimizeVertexCache<unsigned short>(std::vector<unsigned short> & indices, size_t vertexCount, unsigned int cacheSize);
+template void optimizeVertexCache<unsigned int>  (std::vector<unsigned int>   & indices, size_t vertexCount, unsigned int cacheSize);
+
+template void optimizeOverdraw<unsigned short>(std::vector<unsigned short> & indices, const std::vector<glm::vec3> & vertices, float threshold, unsigned int cacheSize);
+template void optimizeOverdraw<unsigned int>  (std::vector<unsigned int>   & indices, const std::vector<glm::vec3> & vertices, float threshold, unsigned int cacheSize);
+
+template size_t optimizeVertexFetchRemap<unsigned short>(std::vector<unsigned short> & indices, size_t vertexCount, std::vector<unsigned int> & remap);
+template size_t optimizeVertexFetchRemap<unsigned int>  (std::vector<unsigned int>   & indices, size_t vertexCount, std::vector<unsigned int> & remap);
+
+template void optimizeMesh<unsigned short>(
+	std::vector<unsigned short> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	float overdrawThreshold
+);
+
+template void optimizeMesh<unsigned int>(
+	std::vector<unsigned int> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	float overdrawThreshold
+);
@@ -0,0 +1,88 @@
+#ifndef MESHOPTIMIZER_HPP
+#define MESHOPTIMIZER_HPP
+
+// Reorders indexed meshes (the output of indexVBO) so that the GPU does less work
+// for the very same triangles :
+// - optimizeVertexCache : triangles that share vertices are drawn close to each
+//   other, so the vertex shader runs less often (post-transform cache).
+// - optimizeOverdraw : then groups of triangles facing outwards are drawn first,
+//   so that less fragments are shaded and then hidden.
+// - optimizeVertexFetch : finally vertices are stored in the order in which they
+//   are used, so that vertex fetching reads memory sequentially.
+//
+// IndexType is unsigned short or unsigned int, like for indexVBO.
+
+// Default size of the simulated FIFO post-transform cache. Real GPUs are
+// somewhere between 16 and 32 entries, and don't exactly work like a FIFO,
+// but an order that is good for 16 is good for the others too.
+#define VERTEX_CACHE_SIZE 16
+
+struct VertexCacheStatistics{
+	unsigned int transformedVertices; // Cache misses : vertex shader invocations
+	float acmr; // Average Cache Miss Ratio : transformed vertices / triangles. 0.5 is the best possible, 3 the worst.
+	float atvr; // Average Transformed Vertex Ratio : transformed vertices / vertices. 1 is the best possible.
+};
+
+// Simulates a FIFO cache of "cacheSize" vertices over the index buffer.
+template <typename IndexType>
+VertexCacheStatistics analyzeVertexCache(
+	const std::vector<IndexType> & indices,
+	size_t vertexCount,
+	unsigned int cacheSize = VERTEX_CACHE_SIZE
+);
+
+// Reorders triangles for the post-transform cache, with Tipsify
+// (Sander, Nehab, Barczak - "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+// Linear time.
+template <typename IndexType>
+void optimizeVertexCache(
+	std::vector<IndexType> & indices,
+	size_t vertexCount,
+	unsigned int cacheSize = VERTEX_CACHE_SIZE
+);
+
+// Reorders groups of triangles of an optimizeVertexCache() output so that the
+// ones facing away from the center of the mesh are drawn first.
+// "threshold" is how much worse the ACMR is allowed to get : 1.05 = 5% worse.
+// Bigger values make smaller groups, which can be sorted better.
+template <typename IndexType>
+void optimizeOverdraw(
+	std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	float threshold = 1.05f,
+	unsigned int cacheSize = VERTEX_CACHE_SIZE
+);
+
+// Computes the new place of each vertex, in the order in which "indices" first uses them,
+// and updates "indices". remap[old vertex] = new vertex, or 0xFFFFFFFF if the vertex is unused.
+// Returns the number of vertices that are used. Give "remap" to remapVertices() for each vertex attribute.
+template <typename IndexType>
+size_t optimizeVertexFetchRemap(
+	std::vector<IndexType> & indices,
+	size_t vertexCount,
+	std::vector<unsigned int> & remap
+);
+
+// Moves attributes to their new places. Unused vertices are removed.
+template <typename T>
+void remapVertices(std::vector<T> & attribute, const std::vector<unsigned int> & remap, size_t usedVertexCount){
+	std::vector<T> result(usedVertexCount);
+	for (size_t i=0; i<remap.size() && i<attribute.size(); i++){
+		if (remap[i] != 0xFFFFFFFFu)
+			result[remap[i]] = attribute[i];
+	}
+	attribute.swap(result);
+}
+
+// Runs the 3 passes on a mesh with positions, UVs and normals, and prints the ACMR/ATVR before and after.
+// overdrawThreshold = 0 skips optimizeOverdraw.
+template <typename IndexType>
+void optimizeMesh(
+	std::vector<IndexType> & indices,
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	float overdrawThreshold = 1.05f
+);
+
+#endif
@@ -2,9 +2,14 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <stdlib.h>
+#include <thread>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 
+#include "file_utils.hpp"
+#include "parallel.hpp"
 #include "objloader.hpp"
 
 // Very, VERY simple OBJ loader.
@@ -16,6 +21,388 @@
 // - More stable. Change a line in the OBJ file and it crashes.
 // - More secure. Change another line and you can inject code.
 // - Loading from memory, stream, etc
+//
+// loadOBJ() maps the file in memory and parses it in place, which is much
+// faster than fscanf() on big models. It also accepts faces without UVs or
+// normals (v, v/vt, v//vn), negative (relative) indices and polygons.
+// loadOBJ_parallel() does the same with several threads, for very big files.
+// loadOBJ_streaming() reads the file with fread() a piece at a time instead, and gives
+// the triangles in batches, so that the whole mesh never has to be in memory.
+// loadOBJ_submeshes() also reads the groups and the .mtl materials, and sorts the
+// triangles by material so that each one can be drawn with a single call.
+// loadOBJ_slow() is the original fscanf() version, kept for reference.
+
+
+// Powers of ten that are exactly representable in a double
+static const double exactPowersOfTen[] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool isDigit(char c){
+	return c >= '0' && c <= '9';
+}
+
+static inline const char * skipBlanks(const char * p, const char * end){
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+		p++;
+	return p;
+}
+
+static inline const char * skipLine(const char * p, const char * end){
+	const char * eol = (const char *)memchr(p, '\n', end - p);
+	return eol ? eol + 1 : end;
+}
+
+// Slow path for the numbers the fast path can't round exactly (long mantissas, 
+// huge exponents, inf, nan...). The mapping isn't null-terminated, so copy the token first.
+static bool parseFloatFallback(const char * start, const char * end, const char *& next, float & value){
+	char token[64];
+	size_t length = 0;
+	while (start + length < end && length < sizeof(token) - 1 && start[length] > ' ' && start[length] != '/')
+		length++;
+	memcpy(token, start, length);
+	token[length] = '\0';
+
+	char * tokenEnd;
+	value = strtof(token, &tokenEnd);
+	if (tokenEnd == token)
+		return false;
+	next = start + (tokenEnd - token);
+	return true;
+}
+
+// Parses a float, rounded exactly like strtof() (and thus like fscanf("%f")).
+static bool parseFloat(const char *& p, const char * end, float & value){
+
+	const char * start = p;
+	const char * s = p;
+
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')){
+		negative = (*s == '-');
+		s++;
+	}
+
+	unsigned long long mantissa = 0;
+	int significantDigits = 0;
+	int exponent = 0;
+	bool truncated = false;
+	bool anyDigit = false;
+
+	// Integer part
+	while (s < end && isDigit(*s)){
+		anyDigit = true;
+		if (significantDigits < 19){
+			mantissa = mantissa * 10 + (*s - '0');
+			if (mantissa != 0) significantDigits++;
+		}else{
+			exponent++;
+			if (*s != '0') truncated = true;
+		}
+		s++;
+	}
+	// Fractional part
+	if (s < end && *s == '.'){
+		s++;
+		while (s < end && isDigit(*s)){
+			anyDigit = true;
+			if (significantDigits < 19){
+				mantissa = mantissa * 10 + (*s - '0');
+				if (mantissa != 0) significantDigits++;
+				exponent--;
+			}else if (*s != '0'){
+				truncated = true;
+			}
+			s++;
+		}
+	}
+	if (!anyDigit)
+		return parseFloatFallback(start, end, p, value); // inf, nan, or garbage
+
+	// Exponent
+	if (s < end && (*s == 'e' || *s == 'E')){
+		const char * e = s + 1;
+		bool negativeExponent = false;
+		if (e < end && (*e == '-' || *e == '+')){
+			negativeExponent = (*e == '-');
+			e++;
+		}
+		if (e < end && isDigit(*e)){
+			int explicitExponent = 0;
+			while (e < end && isDigit(*e)){
+				if (explicitExponent < 10000)
+					explicitExponent = explicitExponent * 10 + (*e - '0');
+				e++;
+			}
+			exponent += negativeExponent ? -explicitExponent : explicitExponent;
+			s = e;
+		}
+	}
+
+	// Fast path : the mantissa and the power of ten are both exact doubles,
+	// so a single multiplication or division gives the correctly rounded double.
+	if (!truncated && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22){
+		double d = (double)mantissa;
+		if (exponent < 0) d /= exactPowersOfTen[-exponent];
+		else              d *= exactPowersOfTen[ exponent];
+
+		// Rounding this double to a float is only wrong if it sits exactly halfway 
+		// between two floats (or in the denormal/overflow range). Let strtof deal with that.
+		unsigned long long bits;
+		memcpy(&bits, &d, sizeof(bits));
+		bool halfway = (bits & 0x1FFFFFFFull) == 0x10000000ull;
+		if (!halfway && (d == 0.0 || (d >= 1.17549435e-38 && d <= 3.40282346e+38))){
+			value = negative ? -(float)d : (float)d;
+			p = s;
+			return true;
+		}
+	}
+	return parseFloatFallback(start, end, p, value);
+}
+
+// Parses a face index. More than 9 digits can't be a valid index anyway.
+static bool parseInt(const char *& p, const char * end, int & value){
+	const char * s = p;
+	bool negative = false;
+	if (s < end && (*s == '-' || *s == '+')){
+		negative = (*s == '-');
+		s++;
+	}
+	const char * digits = s;
+	unsigned int v = 0;
+	while (s < end && isDigit(*s)){
+		v = v * 10 + (unsigned int)(*s - '0');
+		s++;
+	}
+	if (s == digits || s - digits > 9)
+		return false;
+	value = negative ? -(int)v : (int)v;
+	p = s;
+	return true;
+}
+
+// Rest of the line, without the blanks around it : the name in "usemtl Wood"
+static std::string restOfLine(const char * p, const char * end){
+	p = skipBlanks(p, end);
+	const char * last = p;
+	while (last < end && *last != '\n')
+		last++;
+	while (last > p && (last[-1] == ' ' || last[-1] == '\t' || last[-1] == '\r'))
+		last--;
+	return std::string(p, last);
+}
+
+// Is the line at p "keyword", followed by a blank ?
+static inline bool isKeyword(const char * p, const char * end, const char * keyword){
+	size_t length = strlen(keyword);
+	return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0 && (p[length] == ' ' || p[length] == '\t');
+}
+
+// The triangles from firstCorner on belong to the object or group "name", with "material".
+struct OBJGroup{
+	size_t firstCorner;
+	std::string name;
+	std::string material;
+};
+
+// Everything read from (a part of) an OBJ file, before de-indexing.
+struct OBJData{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	// One entry per triangle corner. 1-based like in the file, 0 means "not specified".
+	std::vector<int> vertexIndices, uvIndices, normalIndices;
+	// Where the negative (relative) indices went in the arrays above. They were resolved
+	// against what this OBJData has seen so far, so when a file is parsed in several
+	// chunks, they must be offset by what the previous chunks contain.
+	std::vector<size_t> relativeVertexIndices, relativeUVIndices, relativeNormalIndices;
+	// A new group starts at each "o", "g" and "usemtl" line
+	std::vector<OBJGroup> groups;
+	// Called with each file name of the "mtllib" lines, if not NULL
+	const std::function<void (const std::string & name)> * materialLibraryCallback;
+
+	OBJData() : materialLibraryCallback(NULL){}
+};
+
+// The group the next triangles go to : like the current one, until the caller changes it.
+static OBJGroup & startOBJGroup(OBJData & obj){
+	size_t corner = obj.vertexIndices.size();
+	if (obj.groups.empty() || obj.groups.back().firstCorner != corner){
+		OBJGroup group;
+		if (!obj.groups.empty())
+			group = obj.groups.back();
+		group.firstCorner = corner;
+		obj.groups.push_back(group);
+	}
+	return obj.groups.back();
+}
+
+// One "v/vt/vn" of a face, with its indices already made 1-based.
+struct OBJCorner{
+	int index[3];
+	bool relative[3];
+};
+
+static inline void pushOBJCorner(OBJData & obj, const OBJCorner & corner){
+	if (corner.relative[0]) obj.relativeVertexIndices.push_back(obj.vertexIndices.size());
+	if (corner.relative[1]) obj.relativeUVIndices    .push_back(obj.uvIndices.size());
+	if (corner.relative[2]) obj.relativeNormalIndices.push_back(obj.normalIndices.size());
+	obj.vertexIndices.push_back(corner.index[0]);
+	obj.uvIndices    .push_back(corner.index[1]);
+	obj.normalIndices.push_back(corner.index[2]);
+}
+
+// Parses one "f" line, starting right after the "f".
+// Polygons are split in a triangle fan : (0,1,2), (0,2,3), ...
+static bool parseOBJFace(const char * p, const char * end, OBJData & obj){
+
+	const size_t counts[3] = { obj.vertices.size(), obj.uvs.size(), obj.normals.size() };
+
+	OBJCorner firstCorner, previousCorner;
+	int cornerCount = 0;
+
+	while (true){
+		p = skipBlanks(p, end);
+		if (p == end || *p == '\n' || *p == '#')
+			break;
+
+		OBJCorner corner = {{0, 0, 0}, {false, false, false}};
+		if (!parseInt(p, end, corner.index[0]))
+			return false;
+		if (p < end && *p == '/'){
+			p++;
+			if (p < end && *p != '/'){ // v/vt or v/vt/vn
+				if (!parseInt(p, end, corner.index[1]))
+					return false;
+			}
+			if (p < end && *p == '/'){ // v//vn or v/vt/vn
+				p++;
+				if (!parseInt(p, end, corner.index[2]))
+					return false;
+			}
+		}
+		if (corner.index[0] == 0)
+			return false; // OBJ indices start at 1
+
+		// Negative indices count backwards from the last element read
+		for (int k=0; k<3; k++){
+			if (corner.index[k] < 0){
+				corner.index[k] += (int)counts[k] + 1;
+				corner.relative[k] = true;
+			}
+		}
+
+		if (cornerCount == 0){
+			firstCorner = corner;
+		}else if (cornerCount >= 2){
+			pushOBJCorner(obj, firstCorner);
+			pushOBJCorner(obj, previousCorner);
+			pushOBJCorner(obj, corner);
+		}
+		previousCorner = corner;
+		cornerCount++;
+	}
+	return cornerCount >= 3;
+}
+
+// Parses all the lines in [p, end). Returns false and prints the line on error.
+static bool parseOBJ(const char * p, const char * end, OBJData & obj){
+
+	while (p < end){
+		const char * line = p;
+		p = skipBlanks(p, end);
+
+		bool ok = true;
+		if (end - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')){
+			const char * s = p + 2;
+			glm::vec3 vertex;
+			ok = parseFloat(s = skipBlanks(s, end), end, vertex.x) &&
+			     parseFloat(s = skipBlanks(s, end), end, vertex.y) &&
+			     parseFloat(s = skipBlanks(s, end), end, vertex.z);
+			obj.vertices.push_back(vertex);
+		}else if (end - p >= 3 && p[0] == 'v' && p[1] == 't' && (p[2] == ' ' || p[2] == '\t')){
+			const char * s = p + 3;
+			glm::vec2 uv;
+			ok = parseFloat(s = skipBlanks(s, end), end, uv.x) &&
+			     parseFloat(s = skipBlanks(s, end), end, uv.y);
+			uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+			obj.uvs.push_back(uv);
+		}else if (end - p >= 3 && p[0] == 'v' && p[1] == 'n' && (p[2] == ' ' || p[2] == '\t')){
+			const char * s = p + 3;
+			glm::vec3 normal;
+			ok = parseFloat(s = skipBlanks(s, end), end, normal.x) &&
+			     parseFloat(s = skipBlanks(s, end), end, normal.y) &&
+			     parseFloat(s = skipBlanks(s, end), end, normal.z);
+			obj.normals.push_back(normal);
+		}else if (end - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')){
+			const char * eol = (const char *)memchr(p, '\n', end - p);
+			ok = parseOBJFace(p + 1, eol ? eol : end, obj);
+		}else if (isKeyword(p, end, "o") || isKeyword(p, end, "g")){
+			startOBJGroup(obj).name = restOfLine(p + 1, end);
+		}else if (isKeyword(p, end, "usemtl")){
+			startOBJGroup(obj).material = restOfLine(p + 6, end);
+		}else if (isKeyword(p, end, "mtllib") && obj.materialLibraryCallback){
+			// Several files can be given on the same line
+			std::string names = restOfLine(p + 6, end);
+			size_t start = 0;
+			while (start < names.size()){
+				size_t space = names.find_first_of(" \t", start);
+				if (space == std::string::npos)
+					space = names.size();
+				if (space > start)
+					(*obj.materialLibraryCallback)(names.substr(start, space - start));
+				start = space + 1;
+			}
+		}
+		// else : probably a comment, or something we don't support (s, l, p, ...)
+
+		p = skipLine(p, end);
+
+		if (!ok){
+			int length = (int)(p - line);
+			while (length > 0 && (line[length-1] == '\n' || line[length-1] == '\r'))
+				length--;
+			printf("File can't be read by our simple parser :-( Invalid line : \"%.*s\"\n", length, line);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Writes one vertex per triangle corner of "faces", like glDrawArrays() wants it :
+// "count" corners, starting at corner "begin".
+// The attributes come from "attributes", which is the same OBJData unless the file was split.
+static bool deindexOBJ(
+	const OBJData & attributes,
+	const OBJData & faces,
+	size_t begin,
+	size_t count,
+	size_t firstTriangle, // Only for error messages
+	glm::vec3 * out_vertices, 
+	glm::vec2 * out_uvs,
+	glm::vec3 * out_normals
+){
+	const int vertexCount = (int)attributes.vertices.size();
+	const int uvCount     = (int)attributes.uvs.size();
+	const int normalCount = (int)attributes.normals.size();
+
+	for (size_t i=0; i<count; i++){
+		int vertexIndex = faces.vertexIndices[begin + i];
+		int uvIndex     = faces.uvIndices    [begin + i];
+		int normalIndex = faces.normalIndices[begin + i];
+
+		if (vertexIndex < 1 || vertexIndex > vertexCount || uvIndex < 0 || uvIndex > uvCount || normalIndex < 0 || normalIndex > normalCount){
+			printf("Invalid face index in triangle %u\n", (unsigned int)(firstTriangle + i/3));
+			return false;
+		}
+
+		out_vertices[i] = attributes.vertices[vertexIndex-1];
+		out_uvs     [i] = uvIndex     ? attributes.uvs    [uvIndex-1]     : glm::vec2(0.0f);
+		out_normals [i] = normalIndex ? attributes.normals[normalIndex-1] : glm::vec3(0.0f);
+	}
+	return true;
+}
 
 bool loadOBJ(
 	const char * path, 
@@ -25,6 +412,518 @@ bool loadOBJ(
 ){
 	printf("Loading OBJ file %s...\n", path);
 
+	MappedFile file;
+	if (!mapFile(path, file)){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		getchar();
+		return false;
+	}
+
+	OBJData obj;
+	bool res = parseOBJ(file.data, file.data + file.size, obj);
+	unmapFile(file);
+	if (!res)
+		return false;
+
+	size_t first = out_vertices.size();
+	size_t count = obj.vertexIndices.size();
+	out_vertices.resize(first + count);
+	out_uvs     .resize(first + count);
+	out_normals .resize(first + count);
+	if (count > 0 && !deindexOBJ(obj, obj, 0, count, 0, &out_vertices[first], &out_uvs[first], &out_normals[first])){
+		out_vertices.resize(first);
+		out_uvs     .resize(first);
+		out_normals .resize(first);
+		return false;
+	}
+	return true;
+}
+
+template <typename T>
+static void appendAt(std::vector<T> & destination, size_t offset, std::vector<T> & source){
+	if (!source.empty())
+		memcpy(&destination[offset], &source[0], source.size() * sizeof(T));
+	std::vector<T>().swap(source); // Free it now, we may be short on memory
+}
+
+static void offsetRelativeIndices(std::vector<int> & indices, const std::vector<size_t> & relative, size_t offset){
+	for (size_t i=0; i<relative.size(); i++)
+		indices[relative[i]] += (int)offset;
+}
+
+bool loadOBJ_parallel(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	unsigned int threadCount
+){
+	printf("Loading OBJ file %s...\n", path);
+
+	MappedFile file;
+	if (!mapFile(path, file)){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		getchar();
+		return false;
+	}
+
+	if (threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+
+	// Below a few MB per thread, starting the threads costs more than it saves
+	const size_t minChunkSize = 4 << 20;
+	size_t chunkCount = file.size / minChunkSize;
+	if (chunkCount > threadCount) chunkCount = threadCount;
+	if (chunkCount < 1) chunkCount = 1;
+
+	// Cut the file in chunks of about the same size, at line boundaries
+	const char * end = file.data + file.size;
+	std::vector<const char *> chunkStart(chunkCount + 1);
+	chunkStart[0] = file.data;
+	chunkStart[chunkCount] = end;
+	for (size_t i=1; i<chunkCount; i++){
+		const char * p = file.data + file.size / chunkCount * i;
+		if (p < chunkStart[i-1]) p = chunkStart[i-1];
+		chunkStart[i] = skipLine(p, end);
+	}
+
+	// 1) Each thread parses its own chunk
+	std::vector<OBJData> chunks(chunkCount);
+	std::vector<char> chunkOK(chunkCount);
+	runInParallel(chunkCount, [&](size_t i){
+		chunkOK[i] = parseOBJ(chunkStart[i], chunkStart[i+1], chunks[i]);
+	});
+	unmapFile(file);
+	for (size_t i=0; i<chunkCount; i++)
+		if (!chunkOK[i])
+			return false;
+
+	// 2) Prefix sums : where each chunk's data goes in the whole file
+	std::vector<size_t> vertexOffset(chunkCount+1, 0), uvOffset(chunkCount+1, 0), normalOffset(chunkCount+1, 0), cornerOffset(chunkCount+1, 0);
+	for (size_t i=0; i<chunkCount; i++){
+		vertexOffset[i+1] = vertexOffset[i] + chunks[i].vertices.size();
+		uvOffset    [i+1] = uvOffset    [i] + chunks[i].uvs.size();
+		normalOffset[i+1] = normalOffset[i] + chunks[i].normals.size();
+		cornerOffset[i+1] = cornerOffset[i] + chunks[i].vertexIndices.size();
+	}
+
+	// 3) Gather all the attributes, and fix the relative indices now that we know the offsets
+	OBJData attributes;
+	attributes.vertices.resize(vertexOffset[chunkCount]);
+	attributes.uvs     .resize(uvOffset    [chunkCount]);
+	attributes.normals .resize(normalOffset[chunkCount]);
+	runInParallel(chunkCount, [&](size_t i){
+		appendAt(attributes.vertices, vertexOffset[i], chunks[i].vertices);
+		appendAt(attributes.uvs,      uvOffset    [i], chunks[i].uvs);
+		appendAt(attributes.normals,  normalOffset[i], chunks[i].normals);
+		offsetRelativeIndices(chunks[i].vertexIndices, chunks[i].relativeVertexIndices, vertexOffset[i]);
+		offsetRelativeIndices(chunks[i].uvIndices,     chunks[i].relativeUVIndices,     uvOffset    [i]);
+		offsetRelativeIndices(chunks[i].normalIndices, chunks[i].relativeNormalIndices, normalOffset[i]);
+	});
+
+	// 4) De-index each chunk's faces straight into its part of the output
+	size_t first = out_vertices.size();
+	out_vertices.resize(first + cornerOffset[chunkCount]);
+	out_uvs     .resize(first + cornerOffset[chunkCount]);
+	out_normals .resize(first + cornerOffset[chunkCount]);
+	runInParallel(chunkCount, [&](size_t i){
+		size_t offset = first + cornerOffset[i];
+		chunkOK[i] = chunks[i].vertexIndices.empty() || 
+			deindexOBJ(attributes, chunks[i], 0, chunks[i].vertexIndices.size(), cornerOffset[i]/3, &out_vertices[offset], &out_uvs[offset], &out_normals[offset]);
+	});
+	for (size_t i=0; i<chunkCount; i++){
+		if (!chunkOK[i]){
+			out_vertices.resize(first);
+			out_uvs     .resize(first);
+			out_normals .resize(first);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Triangles waiting to be given to the callback of loadOBJ_streaming(), and the
+// memory for a batch : it is allocated once, for the biggest possible batch.
+struct OBJBatchBuilder{
+	size_t trianglesPerBatch;
+	bool indexed;
+	size_t trianglesGiven;
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	std::vector<unsigned int> indices;
+	// indexed = true : local vertex of each (v, vt, vn), in an open-addressing table
+	std::vector<unsigned int> slots;
+	std::vector<size_t> vertexCorners; // A corner that uses each local vertex, to compare with
+
+	static const unsigned int emptySlot = 0xFFFFFFFFu;
+
+	OBJBatchBuilder(size_t trianglesPerBatch, bool indexed) : trianglesPerBatch(trianglesPerBatch), indexed(indexed), trianglesGiven(0){
+		vertices.resize(3 * trianglesPerBatch);
+		uvs     .resize(3 * trianglesPerBatch);
+		normals .resize(3 * trianglesPerBatch);
+		if (indexed){
+			indices.resize(3 * trianglesPerBatch);
+			vertexCorners.resize(3 * trianglesPerBatch);
+			size_t capacity = 64;
+			while (capacity < 6 * trianglesPerBatch) // At most half full
+				capacity *= 2;
+			slots.resize(capacity);
+		}
+	}
+
+	static unsigned int hashCorner(int v, int vt, int vn){
+		unsigned long long h = (unsigned int)v * 0x9E3779B97F4A7C15ull;
+		h = (h ^ (unsigned int)vt) * 0xC2B2AE3D27D4EB4Full;
+		h = (h ^ (unsigned int)vn) * 0x165667B19E3779F9ull;
+		return (unsigned int)(h >> 32);
+	}
+
+	// Corners [begin, begin + count) of "faces" : one vertex per different v/vt/vn
+	bool index(const OBJData & faces, size_t begin, size_t count, size_t & vertexCount){
+		const int positionCount = (int)faces.vertices.size();
+		const int uvCount       = (int)faces.uvs.size();
+		const int normalCount   = (int)faces.normals.size();
+		const size_t mask = slots.size() - 1;
+		std::fill(slots.begin(), slots.end(), emptySlot);
+		vertexCount = 0;
+
+		for (size_t i=0; i<count; i++){
+			size_t corner = begin + i;
+			int v  = faces.vertexIndices[corner];
+			int vt = faces.uvIndices    [corner];
+			int vn = faces.normalIndices[corner];
+			if (v < 1 || v > positionCount || vt < 0 || vt > uvCount || vn < 0 || vn > normalCount){
+				printf("Invalid face index in triangle %u\n", (unsigned int)(trianglesGiven + i/3));
+				return false;
+			}
+
+			size_t s = hashCorner(v, vt, vn) & mask;
+			while (slots[s] != emptySlot){
+				size_t other = vertexCorners[slots[s]];
+				if (faces.vertexIndices[other] == v && faces.uvIndices[other] == vt && faces.normalIndices[other] == vn)
+					break;
+				s = (s + 1) & mask;
+			}
+			if (slots[s] == emptySlot){
+				slots[s] = (unsigned int)vertexCount;
+				vertexCorners[vertexCount] = corner;
+				vertices[vertexCount] = faces.vertices[v-1];
+				uvs     [vertexCount] = vt ? faces.uvs    [vt-1] : glm::vec2(0.0f);
+				normals [vertexCount] = vn ? faces.normals[vn-1] : glm::vec3(0.0f);
+				vertexCount++;
+			}
+			indices[i] = slots[s];
+		}
+		return true;
+	}
+
+	// Gives the complete batches to the callback, and the last incomplete one if "all".
+	// The corners that were given are removed from "faces".
+	bool flush(OBJData & faces, bool all, const OBJBatchCallback & callback, bool & stopped){
+		size_t corners = faces.vertexIndices.size();
+		size_t begin = 0;
+		while (corners - begin >= 3 * trianglesPerBatch || (all && begin < corners)){
+			size_t count = std::min(corners - begin, 3 * trianglesPerBatch);
+			size_t vertexCount = count;
+			bool ok = indexed ?
+				index(faces, begin, count, vertexCount) :
+				deindexOBJ(faces, faces, begin, count, trianglesGiven, &vertices[0], &uvs[0], &normals[0]);
+			if (!ok)
+				return false;
+
+			OBJBatch batch = { trianglesGiven, count / 3, vertexCount, &vertices[0], &uvs[0], &normals[0], indexed ? &indices[0] : NULL };
+			if (!callback(batch)){
+				stopped = true;
+				return false;
+			}
+			trianglesGiven += count / 3;
+			begin += count;
+		}
+
+		faces.vertexIndices.erase(faces.vertexIndices.begin(), faces.vertexIndices.begin() + begin);
+		faces.uvIndices    .erase(faces.uvIndices    .begin(), faces.uvIndices    .begin() + begin);
+		faces.normalIndices.erase(faces.normalIndices.begin(), faces.normalIndices.begin() + begin);
+		// Only loadOBJ_parallel needs to know which indices were relative
+		faces.relativeVertexIndices.clear();
+		faces.relativeUVIndices    .clear();
+		faces.relativeNormalIndices.clear();
+		faces.groups.clear();
+		return true;
+	}
+};
+
+// Size of the fread() calls. Lines that are longer than this make the buffer grow.
+static const size_t objReadSize = 1 << 20;
+
+bool loadOBJ_streaming(
+	const char * path,
+	size_t trianglesPerBatch,
+	bool indexed,
+	const OBJBatchCallback & callback
+){
+	printf("Loading OBJ file %s...\n", path);
+
+	FILE * file = fopen(path, "rb");
+	if (file == NULL){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		getchar();
+		return false;
+	}
+	if (trianglesPerBatch == 0)
+		trianglesPerBatch = 1;
+
+	OBJData obj; // All the v/vt/vn so far, and the faces that weren't given yet
+	OBJBatchBuilder builder(trianglesPerBatch, indexed);
+	std::vector<char> buffer(objReadSize);
+	size_t used = 0; // Bytes in the buffer : the start of a line that was cut, then what was just read
+	bool ok = true;
+	bool stopped = false;
+
+	while (ok){
+		if (buffer.size() - used < objReadSize)
+			buffer.resize(used + objReadSize);
+		size_t read = fread(&buffer[used], 1, objReadSize, file);
+		used += read;
+		bool last = read < objReadSize;
+
+		// Parse up to the last complete line, and keep the rest for the next time
+		const char * start = &buffer[0];
+		const char * end = start + used;
+		if (!last){
+			const char * p = end;
+			while (p > start && p[-1] != '\n')
+				p--;
+			end = p;
+		}
+		ok = parseOBJ(start, end, obj) && builder.flush(obj, last, callback, stopped);
+
+		size_t rest = used - (end - start);
+		memmove(&buffer[0], end, rest);
+		used = rest;
+		if (last)
+			break;
+	}
+	if (ferror(file)){
+		printf("Error while reading %s\n", path);
+		ok = false;
+	}
+	fclose(file);
+	return ok && !stopped;
+}
+
+// Directory part of a path, with its final slash : "models/room.obj" gives "models/"
+static std::string directoryOf(const char * path){
+	std::string p(path);
+	size_t slash = p.find_last_of("/\\");
+	return slash == std::string::npos ? std::string() : p.substr(0, slash + 1);
+}
+
+// Texture maps can have options before the file name ("map_Bump -bm 0.5 normal.png") :
+// the file name is the last word.
+static std::string parseTextureName(const char * p, const char * end){
+	std::string line = restOfLine(p, end);
+	size_t space = line.find_last_of(" \t");
+	return space == std::string::npos ? line : line.substr(space + 1);
+}
+
+static bool parseColor(const char * p, const char * end, glm::vec3 & color){
+	return parseFloat(p = skipBlanks(p, end), end, color.r) &&
+	       parseFloat(p = skipBlanks(p, end), end, color.g) &&
+	       parseFloat(p = skipBlanks(p, end), end, color.b);
+}
+
+bool loadMTL(const char * path, std::vector<OBJMaterial> & out_materials){
+	printf("Loading MTL file %s...\n", path);
+
+	MappedFile file;
+	if (!mapFile(path, file)){
+		printf("Impossible to open %s, its materials will be missing\n", path);
+		return false;
+	}
+	std::string directory = directoryOf(path);
+
+	const char * p = file.data;
+	const char * end = file.data + file.size;
+	OBJMaterial * material = NULL;
+	bool ok = true;
+	while (p < end && ok){
+		const char * line = p;
+		p = skipBlanks(p, end);
+		const char * s = p;
+
+		if (isKeyword(s, end, "newmtl")){
+			OBJMaterial m;
+			m.name = restOfLine(s + 6, end);
+			m.ambient = glm::vec3(0.0f);
+			m.diffuse = glm::vec3(1.0f);
+			m.specular = glm::vec3(0.0f);
+			m.shininess = 0.0f;
+			m.opacity = 1.0f;
+			m.firstIndex = m.indexCount = 0;
+			out_materials.push_back(m);
+			material = &out_materials.back();
+		}else if (material == NULL){
+			// Comments before the first material
+		}else if (isKeyword(s, end, "Ka")){
+			ok = parseColor(s + 2, end, material->ambient);
+		}else if (isKeyword(s, end, "Kd")){
+			ok = parseColor(s + 2, end, material->diffuse);
+		}else if (isKeyword(s, end, "Ks")){
+			ok = parseColor(s + 2, end, material->specular);
+		}else if (isKeyword(s, end, "Ns")){
+			ok = parseFloat(s = skipBlanks(s + 2, end), end, material->shininess);
+		}else if (isKeyword(s, end, "d")){
+			ok = parseFloat(s = skipBlanks(s + 1, end), end, material->opacity);
+		}else if (isKeyword(s, end, "Tr")){
+			float transparency = 0.0f;
+			ok = parseFloat(s = skipBlanks(s + 2, end), end, transparency);
+			material->opacity = 1.0f - transparency;
+		}else if (isKeyword(s, end, "map_Kd")){
+			material->diffuseTexture = directory + parseTextureName(s + 6, end);
+		}else if (isKeyword(s, end, "map_Ks")){
+			material->specularTexture = directory + parseTextureName(s + 6, end);
+		}else if (isKeyword(s, end, "map_Bump") || isKeyword(s, end, "map_bump")){
+			material->normalTexture = directory + parseTextureName(s + 8, end);
+		}else if (isKeyword(s, end, "bump") || isKeyword(s, end, "norm")){
+			material->normalTexture = directory + parseTextureName(s + 4, end);
+		}
+		// else : a comment, or something we don't use (Ni, illum, Ke, ...)
+
+		p = skipLine(p, end);
+		if (!ok){
+			printf("Invalid line in %s : \"%s\"\n", path, restOfLine(line, end).c_str());
+		}
+	}
+	unmapFile(file);
+	return ok;
+}
+
+bool loadOBJ_submeshes(
+	const char * path,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	std::vector<OBJSubmesh> & out_submeshes,
+	std::vector<OBJMaterial> & out_materials,
+	const OBJTextureCallback & textureCallback
+){
+	printf("Loading OBJ file %s...\n", path);
+
+	MappedFile file;
+	if (!mapFile(path, file)){
+		printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
+		getchar();
+		return false;
+	}
+
+	// The .mtl files are read as soon as their mtllib line is parsed, and their
+	// textures are given to textureCallback right away.
+	std::string directory = directoryOf(path);
+	size_t firstMaterial = out_materials.size();
+	std::vector<std::string> texturesGiven;
+	std::function<void (const std::string &)> onMaterialLibrary = [&](const std::string & name){
+		size_t before = out_materials.size();
+		loadMTL((directory + name).c_str(), out_materials);
+		for (size_t i=before; i<out_materials.size() && textureCallback; i++){
+			const std::string * textures[3] = { &out_materials[i].diffuseTexture, &out_materials[i].specularTexture, &out_materials[i].normalTexture };
+			for (int t=0; t<3; t++){
+				if (textures[t]->empty() || std::find(texturesGiven.begin(), texturesGiven.end(), *textures[t]) != texturesGiven.end())
+					continue;
+				texturesGiven.push_back(*textures[t]);
+				textureCallback(*textures[t]);
+			}
+		}
+	};
+
+	OBJData obj;
+	obj.materialLibraryCallback = &onMaterialLibrary;
+	bool res = parseOBJ(file.data, file.data + file.size, obj);
+	unmapFile(file);
+	if (!res)
+		return false;
+
+	// One submesh per group that has triangles
+	std::vector<OBJGroup> & groups = obj.groups;
+	if (groups.empty() || groups[0].firstCorner > 0){
+		OBJGroup none;
+		none.firstCorner = 0;
+		groups.insert(groups.begin(), none);
+	}
+	struct Range{
+		size_t begin, count; // Corners in "obj"
+		OBJSubmesh submesh;
+	};
+	std::vector<Range> ranges;
+	size_t cornerCount = obj.vertexIndices.size();
+	for (size_t g=0; g<groups.size(); g++){
+		size_t begin = groups[g].firstCorner;
+		size_t last = g + 1 < groups.size() ? groups[g+1].firstCorner : cornerCount;
+		if (last == begin)
+			continue;
+		Range range;
+		range.begin = begin;
+		range.count = last - begin;
+		range.submesh.name = groups[g].name;
+		range.submesh.material = -1;
+		for (size_t m=firstMaterial; m<out_materials.size() && !groups[g].material.empty(); m++){
+			if (out_materials[m].name == groups[g].material){
+				range.submesh.material = (int)m;
+				break;
+			}
+		}
+		if (range.submesh.material < 0 && !groups[g].material.empty())
+			printf("Material %s not found\n", groups[g].material.c_str());
+		ranges.push_back(range);
+	}
+
+	// Sort by material, keeping the order of the file for each material
+	struct ByMaterial{
+		bool operator()(const Range & a, const Range & b) const {
+			unsigned int ma = (unsigned int)a.submesh.material; // -1 goes last
+			unsigned int mb = (unsigned int)b.submesh.material;
+			return ma < mb;
+		}
+	};
+	std::stable_sort(ranges.begin(), ranges.end(), ByMaterial());
+
+	size_t first = out_vertices.size();
+	out_vertices.resize(first + cornerCount);
+	out_uvs     .resize(first + cornerCount);
+	out_normals .resize(first + cornerCount);
+	size_t offset = first;
+	size_t firstSubmesh = out_submeshes.size();
+	for (size_t r=0; r<ranges.size(); r++){
+		if (!deindexOBJ(obj, obj, ranges[r].begin, ranges[r].count, ranges[r].begin / 3, &out_vertices[offset], &out_uvs[offset], &out_normals[offset])){
+			out_vertices.resize(first);
+			out_uvs     .resize(first);
+			out_normals .resize(first);
+			out_submeshes.resize(firstSubmesh);
+			return false;
+		}
+		OBJSubmesh & submesh = ranges[r].submesh;
+		submesh.firstIndex = (unsigned int)offset;
+		submesh.indexCount = (unsigned int)ranges[r].count;
+		out_submeshes.push_back(submesh);
+		if (submesh.material >= 0){
+			OBJMaterial & material = out_materials[submesh.material];
+			if (material.indexCount == 0)
+				material.firstIndex = submesh.firstIndex;
+			material.indexCount += submesh.indexCount;
+		}
+		offset += ranges[r].count;
+	}
+	return true;
+}
+
+bool loadOBJ_slow(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	printf("Loading OBJ file %s...\n", path);
+
 	std::vector<unsigned int> vertexIndices, uvIndices, normalIndices;
 	std::vector<glm::vec3> temp_vertices; 
 	std::vector<glm::vec2> temp_uvs;
@@ -171,4 +1070,4 @@ bool loadAssImp(
 	return true;
 }
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -1,6 +1,9 @@
 #ifndef OBJLOADER_H
 #define OBJLOADER_H
 
+#include <functional>
+#include <string>
+
 bool loadOBJ(
 	const char * path, 
 	std::vector<glm::vec3> & out_vertices, 
@@ -8,6 +11,105 @@ bool loadOBJ(
 	std::vector<glm::vec3> & out_normals
 );
 
+// Same as loadOBJ, but big files are cut in chunks that are parsed by several threads.
+// The result is exactly the same. threadCount = 0 uses one thread per core.
+bool loadOBJ_parallel(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs, 
+	std::vector<glm::vec3> & out_normals,
+	unsigned int threadCount = 0
+);
+
+// A material of a .mtl file : newmtl, and the lines of it that the tutorials' shaders can use.
+struct OBJMaterial{
+	std::string name;
+	glm::vec3 ambient;  // Ka
+	glm::vec3 diffuse;  // Kd
+	glm::vec3 specular; // Ks
+	float shininess;    // Ns
+	float opacity;      // d, or 1 - Tr
+	// Paths of the textures, relative to the working directory like the OBJ path. Empty if none.
+	std::string diffuseTexture;  // map_Kd
+	std::string specularTexture; // map_Ks
+	std::string normalTexture;   // map_Bump, bump or norm
+	// Triangles of all the submeshes that use this material, which are next to each other
+	// (see loadOBJ_submeshes). indexCount = 0 if none.
+	unsigned int firstIndex;
+	unsigned int indexCount;
+};
+
+// Triangles of the OBJ between two "o", "g" or "usemtl" lines
+struct OBJSubmesh{
+	std::string name;        // Of the last "o" or "g" line, "" if none
+	int material;            // In out_materials, -1 if there was no usemtl or the material wasn't found
+	unsigned int firstIndex; // First triangle corner in the output, 3 per triangle
+	unsigned int indexCount;
+};
+
+// Called once for each texture of the .mtl files, as soon as the mtllib line is read,
+// so that textures can start loading while the rest of the OBJ is parsed.
+typedef std::function<void (const std::string & path)> OBJTextureCallback;
+
+// Same as loadOBJ, plus the submeshes and the materials of their usemtl lines.
+// Triangles are sorted by material : out_materials[i].firstIndex and indexCount give
+// all the triangles of material i with one range, and so do the submeshes, so each
+// one can be drawn with a single glDrawArrays(). indexVBO keeps the order of the triangles,
+// so the same ranges work with glDrawElements() on its indices.
+// Triangles without a material come last.
+bool loadOBJ_submeshes(
+	const char * path,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	std::vector<OBJSubmesh> & out_submeshes,
+	std::vector<OBJMaterial> & out_materials,
+	const OBJTextureCallback & textureCallback = OBJTextureCallback()
+);
+
+// Reads the materials of a .mtl file, and adds them to out_materials.
+// The texture names of the file get the directory of the .mtl in front, so that they
+// can be opened like "path" itself.
+bool loadMTL(const char * path, std::vector<OBJMaterial> & out_materials);
+
+// A group of consecutive triangles of the file, given by loadOBJ_streaming().
+// The arrays are only valid during the callback.
+struct OBJBatch{
+	size_t firstTriangle; // Triangles given by the previous batches
+	size_t triangleCount;
+	size_t vertexCount;   // Size of the 3 arrays below : 3 * triangleCount, or less if indexed
+	const glm::vec3 * vertices;
+	const glm::vec2 * uvs;
+	const glm::vec3 * normals;
+	const unsigned int * indices; // 3 * triangleCount indices in the arrays above, or NULL if not indexed
+};
+
+// Return false to stop reading
+typedef std::function<bool (const OBJBatch & batch)> OBJBatchCallback;
+
+// Reads the file a piece at a time, and gives its triangles to "callback" in batches
+// of at most trianglesPerBatch triangles, without ever keeping the whole mesh :
+// memory is the v/vt/vn lines of the file (faces can use any of them) plus one batch.
+// - indexed = false : one vertex per triangle corner, like loadOBJ.
+// - indexed = true  : corners that use the same v/vt/vn are only given once per batch,
+//   with 32-bit indices.
+// Faces can only use the v/vt/vn lines that are before them, which is what all exporters do.
+// Returns false if the file can't be read, or if the callback returned false.
+bool loadOBJ_streaming(
+	const char * path,
+	size_t trianglesPerBatch,
+	bool indexed,
+	const OBJBatchCallback & callback
+);
+
+// Same as loadOBJ, with the original fscanf() parser. Much slower, only kept for reference.
+bool loadOBJ_slow(
+	const char * path, 
+	std::vector<glm::vec3> & out_vertices, 
+	std::vector<glm::vec2> & out_uvs, 
+	std::vector<glm::vec3> & out_normals
+);
+
 
 
 bool loadAssImp(
@@ -0,0 +1,21 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <stddef.h>
+#include <vector>
+#include <thread>
+
+// Runs task(0), task(1), ... task(count-1), each in its own thread.
+// The calling thread takes task(0).
+template <typename Task>
+void runInParallel(size_t count, const Task & task){
+	std::vector<std::thread> threads;
+	for (size_t i=1; i<count; i++)
+		threads.push_back(std::thread(task, i));
+	if (count > 0)
+		task(0);
+	for (size_t i=0; i<threads.size(); i++)
+		threads[i].join();
+}
+
+#endif
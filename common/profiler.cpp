@@ -0,0 +1,375 @@
+#include <vector>
+#include <string>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "profiler.hpp"
+
+#define PROFILER_MAX_DEPTH 32 // Deeper scopes are ignored
+
+// A scope that ended
+struct ProfilerEvent{
+	const char * name;
+	long long start, end; // Nanoseconds since initProfiler()
+	unsigned int thread;  // 0 for the GPU
+};
+
+// The ring buffer of a thread. Only the thread writes the events and "written" ;
+// only newProfilerFrame() reads them and changes "read".
+struct ProfilerThread{
+	ProfilerEvent events[PROFILER_THREAD_EVENTS];
+	std::atomic<unsigned int> written; // Events ever written, the next one goes to written % PROFILER_THREAD_EVENTS
+	unsigned int read;
+	unsigned int id;
+	const char * openNames[PROFILER_MAX_DEPTH];
+	long long openStarts[PROFILER_MAX_DEPTH];
+	int depth;
+};
+
+// The timestamp queries of a frame
+struct ProfilerGpuFrame{
+	GLuint queries[PROFILER_GPU_SCOPES * 2]; // Begin and end of each scope
+	const char * names[PROFILER_GPU_SCOPES];
+	bool ended[PROFILER_GPU_SCOPES];
+	unsigned int count;
+	GLuint lastQuery; // The last one issued, 0 if no scope ended
+	long long offset; // CPU time - GPU time when it was recorded
+};
+
+struct ProfilerHistory{
+	float durations[PROFILER_HISTORY]; // Milliseconds
+	unsigned int count;
+	unsigned int next;
+};
+
+unsigned int ProfilerSession;      // 0 when there is no profiler
+unsigned int ProfilerSessionCount;
+std::chrono::steady_clock::time_point ProfilerOrigin;
+std::mutex ProfilerThreadsMutex;   // Only taken when a thread records its first scope, and by newProfilerFrame()
+std::vector<ProfilerThread *> ProfilerThreads;
+unsigned long long ProfilerDroppedEvents;
+
+static thread_local ProfilerThread * ProfilerLocalThread = NULL;
+static thread_local unsigned int ProfilerLocalSession = 0;
+
+bool ProfilerHasGpu;
+ProfilerGpuFrame ProfilerGpuFrames[PROFILER_GPU_LATENCY];
+unsigned int ProfilerGpuFrameIndex;
+int ProfilerGpuStack[PROFILER_MAX_DEPTH];
+int ProfilerGpuDepth;
+long long ProfilerGpuOffset;
+unsigned long long ProfilerDroppedGpuFrames;
+
+unsigned int ProfilerFrameCount;
+long long ProfilerFrameStart;
+std::map< std::pair<std::string, bool>, ProfilerHistory > ProfilerHistories;
+std::vector<ProfilerEvent> ProfilerTrace;
+
+static long long getProfilerTime(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ProfilerOrigin).count();
+}
+
+// Where GPU timestamps are on the CPU timeline. GL_TIMESTAMP doesn't wait for the GPU.
+static void calibrateGpuClock(){
+	GLint64 gpuTime = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+	ProfilerGpuOffset = getProfilerTime() - (long long)gpuTime;
+}
+
+void initProfiler(){
+	ProfilerOrigin = std::chrono::steady_clock::now();
+	ProfilerSession = ++ProfilerSessionCount;
+	ProfilerDroppedEvents = 0;
+
+	ProfilerHasGpu = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	for (unsigned int i=0; i<PROFILER_GPU_LATENCY; i++){
+		if (ProfilerHasGpu)
+			glGenQueries(PROFILER_GPU_SCOPES * 2, ProfilerGpuFrames[i].queries);
+		ProfilerGpuFrames[i].count = 0;
+		ProfilerGpuFrames[i].lastQuery = 0;
+	}
+	ProfilerGpuFrameIndex = 0;
+	ProfilerGpuDepth = 0;
+	ProfilerDroppedGpuFrames = 0;
+	if (ProfilerHasGpu)
+		calibrateGpuClock();
+	else
+		printf("Profiler : no timer queries, GPU scopes are ignored\n");
+
+	ProfilerFrameCount = 0;
+	ProfilerFrameStart = getProfilerTime();
+}
+
+static ProfilerThread * getProfilerThread(){
+	if (ProfilerLocalSession != ProfilerSession){
+		// The first scope of this thread
+		ProfilerThread * thread = new ProfilerThread;
+		thread->written.store(0);
+		thread->read = 0;
+		thread->depth = 0;
+		std::lock_guard<std::mutex> lock(ProfilerThreadsMutex);
+		ProfilerThreads.push_back(thread);
+		thread->id = (unsigned int)ProfilerThreads.size();
+		ProfilerLocalThread = thread;
+		ProfilerLocalSession = ProfilerSession;
+	}
+	return ProfilerLocalThread;
+}
+
+void beginCpuScope(const char * name){
+	if (ProfilerSession == 0)
+		return;
+	ProfilerThread * thread = getProfilerThread();
+	if (thread->depth < PROFILER_MAX_DEPTH){
+		thread->openNames[thread->depth] = name;
+		thread->openStarts[thread->depth] = getProfilerTime();
+	}
+	thread->depth++;
+}
+
+void endCpuScope(){
+	if (ProfilerSession == 0)
+		return;
+	ProfilerThread * thread = getProfilerThread();
+	if (thread->depth == 0)
+		return;
+	thread->depth--;
+	if (thread->depth >= PROFILER_MAX_DEPTH)
+		return;
+
+	unsigned int written = thread->written.load(std::memory_order_relaxed);
+	ProfilerEvent & event = thread->events[written % PROFILER_THREAD_EVENTS];
+	event.name = thread->openNames[thread->depth];
+	event.start = thread->openStarts[thread->depth];
+	event.end = getProfilerTime();
+	event.thread = thread->id;
+	// The event is complete before the reader can see it
+	thread->written.store(written + 1, std::memory_order_release);
+}
+
+void beginGpuScope(const char * name){
+	if (ProfilerSession == 0 || !ProfilerHasGpu)
+		return;
+	ProfilerGpuFrame & frame = ProfilerGpuFrames[ProfilerGpuFrameIndex];
+	int scope = -1;
+	if (frame.count < PROFILER_GPU_SCOPES){
+		scope = (int)frame.count++;
+		frame.names[scope] = name;
+		frame.ended[scope] = false;
+		glQueryCounter(frame.queries[scope * 2], GL_TIMESTAMP);
+	}
+	if (ProfilerGpuDepth < PROFILER_MAX_DEPTH)
+		ProfilerGpuStack[ProfilerGpuDepth] = scope;
+	ProfilerGpuDepth++;
+}
+
+void endGpuScope(){
+	if (ProfilerSession == 0 || !ProfilerHasGpu || ProfilerGpuDepth == 0)
+		return;
+	ProfilerGpuDepth--;
+	if (ProfilerGpuDepth >= PROFILER_MAX_DEPTH || ProfilerGpuStack[ProfilerGpuDepth] < 0)
+		return;
+	ProfilerGpuFrame & frame = ProfilerGpuFrames[ProfilerGpuFrameIndex];
+	int scope = ProfilerGpuStack[ProfilerGpuDepth];
+	glQueryCounter(frame.queries[scope * 2 + 1], GL_TIMESTAMP);
+	frame.ended[scope] = true;
+	frame.lastQuery = frame.queries[scope * 2 + 1];
+}
+
+static void recordEvent(const ProfilerEvent & event){
+	ProfilerHistory & history = ProfilerHistories[std::make_pair(std::string(event.name), event.thread == 0)];
+	history.durations[history.next] = (float)((event.end - event.start) / 1e6);
+	history.next = (history.next + 1) % PROFILER_HISTORY;
+	if (history.count < PROFILER_HISTORY)
+		history.count++;
+
+	if (ProfilerTrace.size() < PROFILER_TRACE_EVENTS){
+		ProfilerTrace.push_back(event);
+		if (ProfilerTrace.size() == PROFILER_TRACE_EVENTS)
+			printf("Profiler : the trace is full, the next scopes are only in the stats\n");
+	}
+}
+
+// The events the threads ended since the last call
+static void collectCpuEvents(){
+	std::vector<ProfilerEvent> events;
+	std::lock_guard<std::mutex> lock(ProfilerThreadsMutex);
+	for (size_t t=0; t<ProfilerThreads.size(); t++){
+		ProfilerThread & thread = *ProfilerThreads[t];
+		unsigned int written = thread.written.load(std::memory_order_acquire);
+		if (written - thread.read > PROFILER_THREAD_EVENTS){
+			ProfilerDroppedEvents += written - thread.read - PROFILER_THREAD_EVENTS;
+			thread.read = written - PROFILER_THREAD_EVENTS;
+		}
+		size_t first = events.size();
+		for (unsigned int i=thread.read; i!=written; i++)
+			events.push_back(thread.events[i % PROFILER_THREAD_EVENTS]);
+
+		// The thread may have written over the oldest ones while they were copied
+		unsigned int after = thread.written.load(std::memory_order_acquire);
+		if (after - thread.read > PROFILER_THREAD_EVENTS){
+			size_t overwritten = std::min((size_t)(after - thread.read - PROFILER_THREAD_EVENTS), events.size() - first);
+			events.erase(events.begin() + first, events.begin() + first + overwritten);
+			ProfilerDroppedEvents += overwritten;
+		}
+		thread.read = written;
+	}
+	for (size_t i=0; i<events.size(); i++)
+		recordEvent(events[i]);
+}
+
+// The queries of a frame PROFILER_GPU_LATENCY - 1 frames old : usually done by now
+static void collectGpuEvents(ProfilerGpuFrame & frame){
+	if (frame.count == 0)
+		return;
+
+	// The queries end in the order they were issued : when the last one is there, all are
+	GLuint available = GL_FALSE;
+	if (frame.lastQuery != 0)
+		glGetQueryObjectuiv(frame.lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available){
+		if (frame.lastQuery != 0)
+			ProfilerDroppedGpuFrames++; // Not waited for
+		frame.count = 0;
+		frame.lastQuery = 0;
+		return;
+	}
+
+	for (unsigned int i=0; i<frame.count; i++){
+		if (!frame.ended[i])
+			continue;
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(frame.queries[i * 2], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame.queries[i * 2 + 1], GL_QUERY_RESULT, &end);
+		ProfilerEvent event = { frame.names[i], (long long)begin + frame.offset, (long long)end + frame.offset, 0 };
+		recordEvent(event);
+	}
+	frame.count = 0;
+	frame.lastQuery = 0;
+}
+
+void newProfilerFrame(){
+	if (ProfilerSession == 0)
+		return;
+
+	long long now = getProfilerTime();
+	ProfilerEvent frameEvent = { "Frame", ProfilerFrameStart, now, getProfilerThread()->id };
+	recordEvent(frameEvent);
+	ProfilerFrameStart = now;
+	ProfilerFrameCount++;
+
+	collectCpuEvents();
+
+	if (ProfilerHasGpu){
+		ProfilerGpuFrames[ProfilerGpuFrameIndex].offset = ProfilerGpuOffset;
+		ProfilerGpuFrameIndex = (ProfilerGpuFrameIndex + 1) % PROFILER_GPU_LATENCY;
+		collectGpuEvents(ProfilerGpuFrames[ProfilerGpuFrameIndex]);
+		ProfilerGpuDepth = 0;
+		// The clocks drift a little
+		if (ProfilerFrameCount % PROFILER_HISTORY == 0)
+			calibrateGpuClock();
+	}
+}
+
+bool getProfilerStats(const char * name, bool gpu, ProfilerStats & out_stats){
+	std::map< std::pair<std::string, bool>, ProfilerHistory >::const_iterator it = ProfilerHistories.find(std::make_pair(std::string(name), gpu));
+	if (it == ProfilerHistories.end() || it->second.count == 0)
+		return false;
+
+	const ProfilerHistory & history = it->second;
+	std::vector<float> durations(history.durations, history.durations + history.count);
+	std::sort(durations.begin(), durations.end());
+	double sum = 0.0;
+	for (size_t i=0; i<durations.size(); i++)
+		sum += durations[i];
+
+	// Nearest rank
+	size_t n = durations.size();
+	out_stats.count = (unsigned int)n;
+	out_stats.average = sum / n;
+	out_stats.median = durations[(n - 1) / 2];
+	out_stats.percentile95 = durations[std::min(n - 1, (n * 95 + 99) / 100 - 1)];
+	out_stats.percentile99 = durations[std::min(n - 1, (n * 99 + 99) / 100 - 1)];
+	out_stats.maximum = durations[n - 1];
+	return true;
+}
+
+void printProfilerReport(){
+	printf("%-28s %6s %9s %9s %9s %9s %9s\n", "Scope (ms)", "Count", "Average", "Median", "95%", "99%", "Maximum");
+	for (std::map< std::pair<std::string, bool>, ProfilerHistory >::const_iterator it = ProfilerHistories.begin(); it != ProfilerHistories.end(); ++it){
+		ProfilerStats stats;
+		if (!getProfilerStats(it->first.first.c_str(), it->first.second, stats))
+			continue;
+		std::string name = it->first.first + (it->first.second ? " (GPU)" : "");
+		printf("%-28s %6u %9.3f %9.3f %9.3f %9.3f %9.3f\n", name.c_str(), stats.count,
+			stats.average, stats.median, stats.percentile95, stats.percentile99, stats.maximum);
+	}
+	if (ProfilerDroppedEvents != 0 || ProfilerDroppedGpuFrames != 0)
+		printf("Dropped : %llu CPU scopes, %llu frames of GPU scopes\n", ProfilerDroppedEvents, ProfilerDroppedGpuFrames);
+}
+
+static void writeJSONString(FILE * file, const char * text){
+	fputc('"', file);
+	for (const unsigned char * c = (const unsigned char *)text; *c; c++){
+		if (*c == '"' || *c == '\\')
+			fprintf(file, "\\%c", *c);
+		else if (*c < 0x20)
+			fprintf(file, "\\u%04x", *c);
+		else
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
+
+bool writeProfilerTrace(const char * path){
+	FILE * file = fopen(path, "wb");
+	if (file == NULL){
+		printf("Impossible to open %s\n", path);
+		return false;
+	}
+
+	// Timestamps are in microseconds. The GPU is shown as thread 0.
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}");
+	{
+		std::lock_guard<std::mutex> lock(ProfilerThreadsMutex);
+		for (size_t t=0; t<ProfilerThreads.size(); t++)
+			fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"CPU thread %u\"}}", ProfilerThreads[t]->id, ProfilerThreads[t]->id);
+	}
+	for (size_t i=0; i<ProfilerTrace.size(); i++){
+		const ProfilerEvent & event = ProfilerTrace[i];
+		fprintf(file, ",\n{\"name\":");
+		writeJSONString(file, event.name);
+		fprintf(file, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+			event.thread == 0 ? "gpu" : "cpu", event.thread, event.start / 1e3, (event.end - event.start) / 1e3);
+	}
+	fprintf(file, "\n]}\n");
+
+	bool written = !ferror(file);
+	fclose(file);
+	if (!written)
+		printf("Impossible to write %s\n", path);
+	return written;
+}
+
+void cleanupProfiler(){
+	if (ProfilerHasGpu){
+		for (unsigned int i=0; i<PROFILER_GPU_LATENCY; i++)
+			glDeleteQueries(PROFILER_GPU_SCOPES * 2, ProfilerGpuFrames[i].queries);
+	}
+	ProfilerSession = 0;
+	{
+		std::lock_guard<std::mutex> lock(ProfilerThreadsMutex);
+		for (size_t t=0; t<ProfilerThreads.size(); t++)
+			delete ProfilerThreads[t];
+		ProfilerThreads.clear();
+	}
+	ProfilerHistories.clear();
+	ProfilerTrace.clear();
+}
@@ -0,0 +1,60 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+// Where the time of a frame goes, on the CPU and on the GPU.
+//
+// CPU scopes can be recorded by any thread : each one writes in its own ring buffer,
+// without locks, and newProfilerFrame() collects them. GPU scopes are GL_TIMESTAMP
+// queries around the commands, so they can be nested. Their results are read
+// PROFILER_GPU_LATENCY frames later, when the GPU is done with them, so reading them
+// never waits for the GPU.
+//
+// Everything recorded can be written as a Chrome trace (chrome://tracing, or
+// ui.perfetto.dev), and each scope keeps its last PROFILER_HISTORY durations for
+// the percentiles.
+//
+// Scope names must stay valid until cleanupProfiler() : use string literals.
+
+#define PROFILER_GPU_LATENCY    4       // Frames of GPU queries in flight
+#define PROFILER_GPU_SCOPES     64      // GPU scopes per frame, the others are ignored
+#define PROFILER_THREAD_EVENTS  16384   // CPU scopes a thread can end between two frames
+#define PROFILER_HISTORY        256     // Durations kept per scope
+#define PROFILER_TRACE_EVENTS   1000000 // Scopes kept for the trace, then it stops
+
+struct ProfilerStats{
+	unsigned int count;  // Durations kept, up to PROFILER_HISTORY
+	double average;      // Milliseconds
+	double median;
+	double percentile95;
+	double percentile99;
+	double maximum;
+};
+
+// Call it with the OpenGL context current : GPU scopes are recorded on this context only.
+void initProfiler();
+
+// Any thread
+void beginCpuScope(const char * name);
+void endCpuScope();
+
+// The thread of the OpenGL context only
+void beginGpuScope(const char * name);
+void endGpuScope();
+
+// Once per frame, after swapping the buffers. Collects what the threads and the GPU
+// have finished, and records the whole frame as the "Frame" scope.
+void newProfilerFrame();
+
+// gpu chooses between the CPU and the GPU scopes of that name
+bool getProfilerStats(const char * name, bool gpu, ProfilerStats & out_stats);
+
+// A table of the stats of every scope
+void printProfilerReport();
+
+// Chrome trace event format (JSON)
+bool writeProfilerTrace(const char * path);
+
+// The other threads must not record scopes anymore
+void cleanupProfiler();
+
+#endif
@@ -5,106 +5,476 @@
 #include <fstream>
 #include <algorithm>
 #include <sstream>
+#include <map>
+#include <thread>
 using namespace std;
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <GL/glew.h>
 
+#include "file_utils.hpp"
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+#define PROGRAM_CACHE_MAGIC   0x504C474F // "OGLP" in ASCII
+#define PROGRAM_CACHE_VERSION 1
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+// Start of a .programcache file. The glGetProgramBinary() blob follows.
+struct ProgramCacheHeader{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash; // hashMemory() of both shaders : if one of them changes, the program is compiled again
+	uint64_t driverHash; // hashMemory() of the vendor, renderer and version : a binary only works with the driver that made it
+	uint32_t binaryFormat;
+	uint32_t binarySize;
+};
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
+static bool readShaderFile(const char * path, std::string & out_code){
+	MappedFile file;
+	if (!mapFile(path, file))
+		return false;
+	out_code.assign(file.data, file.size);
+	unmapFile(file);
+	return true;
+}
+
+static void appendString(std::string & out, const GLubyte * value){
+	if (value != NULL)
+		out += (const char *)value;
+	out += '\n';
+}
+
+static uint64_t getDriverHash(){
+	std::string driver;
+	appendString(driver, glGetString(GL_VENDOR));
+	appendString(driver, glGetString(GL_RENDERER));
+	appendString(driver, glGetString(GL_VERSION));
+	appendString(driver, glGetString(GL_SHADING_LANGUAGE_VERSION));
+	return hashMemory(driver.data(), driver.size());
+}
+
+// Program binaries are core in OpenGL 4.1, but our 3.3 contexts have them through
+// GL_ARB_get_program_binary on most drivers. Some drivers have no binary format at all.
+static bool hasProgramBinaries(){
+	if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary)
+		return false;
+	GLint formatCount = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+	return formatCount > 0;
+}
+
+// Next to the vertex shader, one file for each pair of shaders and each set of defines :
+// "A.vertexshader" and "dir/B.fragmentshader" give "A.vertexshader.B.fragmentshader.programcache",
+// and "A.vertexshader.B.fragmentshader.<hash of the defines>.programcache" with defines.
+static std::string getProgramCachePath(const char * vertex_file_path, const char * fragment_file_path, const char * defines){
+	const char * fragmentName = fragment_file_path;
+	for (const char * c = fragment_file_path; *c != 0; c++){
+		if (*c == '/' || *c == '\\')
+			fragmentName = c + 1;
+	}
+	std::string path = std::string(vertex_file_path) + "." + fragmentName;
+	if (defines != NULL && defines[0] != 0){
+		char hash[17];
+		snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)hashMemory(defines, strlen(defines)));
+		path += std::string(".") + hash;
+	}
+	return path + ".programcache";
+}
+
+// Returns 0 if there is no valid binary for these sources and this driver
+static GLuint loadProgramCache(const std::string & path, uint64_t sourceHash, uint64_t driverHash){
+	MappedFile file;
+	if (!mapFile(path.c_str(), file))
 		return 0;
+
+	GLuint ProgramID = 0;
+	ProgramCacheHeader header;
+	if (file.size >= sizeof(header)){
+		memcpy(&header, file.data, sizeof(header));
+		if (header.magic == PROGRAM_CACHE_MAGIC && header.version == PROGRAM_CACHE_VERSION &&
+		    header.sourceHash == sourceHash && header.driverHash == driverHash &&
+		    header.binarySize == file.size - sizeof(header)){
+			ProgramID = glCreateProgram();
+			glProgramBinary(ProgramID, header.binaryFormat, file.data + sizeof(header), header.binarySize);
+			// The driver can still refuse it, after an update that didn't change its version string
+			GLint Result = GL_FALSE;
+			glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+			if (Result != GL_TRUE){
+				glDeleteProgram(ProgramID);
+				ProgramID = 0;
+			}
+		}
 	}
+	unmapFile(file);
+	return ProgramID;
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+// Writes in a temporary file first, so that a crash never leaves a half-written cache behind
+static bool saveProgramCache(const std::string & path, GLuint ProgramID, uint64_t sourceHash, uint64_t driverHash){
+	GLint binarySize = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+	if (binarySize <= 0)
+		return false;
+
+	std::vector<char> data(sizeof(ProgramCacheHeader) + binarySize);
+	GLenum binaryFormat = 0;
+	GLsizei written = 0;
+	glGetProgramBinary(ProgramID, binarySize, &written, &binaryFormat, &data[sizeof(ProgramCacheHeader)]);
+	if (written != binarySize)
+		return false;
+
+	ProgramCacheHeader header;
+	header.magic        = PROGRAM_CACHE_MAGIC;
+	header.version      = PROGRAM_CACHE_VERSION;
+	header.sourceHash   = sourceHash;
+	header.driverHash   = driverHash;
+	header.binaryFormat = binaryFormat;
+	header.binarySize   = (uint32_t)binarySize;
+	memcpy(&data[0], &header, sizeof(header));
+
+	std::string temporaryPath = path + ".tmp";
+	FILE * file = fopen(temporaryPath.c_str(), "wb");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+	ok = (fclose(file) == 0) && ok;
+
+	if (ok){
+		remove(path.c_str()); // rename() doesn't replace existing files on Windows
+		ok = rename(temporaryPath.c_str(), path.c_str()) == 0;
 	}
+	if (!ok)
+		remove(temporaryPath.c_str());
+	return ok;
+}
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
 
 
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
-	glCompileShader(VertexShaderID);
+// Source of a shader after #include and the defines, and the files it came from :
+// in the compile log, "1(12)" is line 12 of files[1].
+struct ExpandedShader{
+	std::string source;
+	std::vector<std::string> files;
+	bool hasVersion; // The first #version has been written, with the defines after it
+};
 
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
+static std::string trimLine(const std::string & line){
+	size_t begin = line.find_first_not_of(" \t");
+	size_t end = line.find_last_not_of(" \t\r");
+	if (begin == std::string::npos)
+		return std::string();
+	return line.substr(begin, end - begin + 1);
+}
+
+// "A B=2" gives "#define A" and "#define B 2"
+static void appendDefines(std::string & out, const char * defines){
+	if (defines == NULL)
+		return;
+	std::istringstream stream(defines);
+	std::string define;
+	while (stream >> define){
+		size_t equal = define.find('=');
+		if (equal != std::string::npos)
+			define[equal] = ' ';
+		out += "#define " + define + "\n";
 	}
+}
+
+static std::string getDirectory(const std::string & path){
+	size_t slash = path.find_last_of("/\\");
+	return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+}
 
+// Copies a file in "shader", replacing each #include "file" by that file, relative to this one.
+// Only the first #version is kept : the defines go right after it, and the
+// #line directives keep the line numbers of the compile log right.
+static bool expandShaderFile(const std::string & path, const char * defines, std::vector<std::string> & includeStack, ExpandedShader & shader){
 
+	if (std::find(includeStack.begin(), includeStack.end(), path) != includeStack.end()){
+		printf("%s includes itself\n", path.c_str());
+		return false;
+	}
+	std::string code;
+	if (!readShaderFile(path.c_str(), code)){
+		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", path.c_str());
+		return false;
+	}
+	unsigned int fileIndex = (unsigned int)shader.files.size();
+	shader.files.push_back(path);
+	includeStack.push_back(path);
 
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
-	glCompileShader(FragmentShaderID);
+	// An included file starts with a #line, but nothing can come before #version :
+	// if it has the first one, the #line goes after it.
+	bool resync = fileIndex != 0;
+	size_t lineStart = 0;
+	unsigned int lineNumber = 1;
+	while (lineStart < code.size()){
+		size_t lineEnd = code.find('\n', lineStart);
+		if (lineEnd == std::string::npos)
+			lineEnd = code.size();
+		std::string line = code.substr(lineStart, lineEnd - lineStart);
+		std::string directive = trimLine(line);
+		lineStart = lineEnd + 1;
 
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if ( InfoLogLength > 0 ){
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength+1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
+		bool isFirstVersion = !shader.hasVersion && directive.compare(0, 8, "#version") == 0;
+		if (resync && !isFirstVersion){
+			char directiveLine[32];
+			snprintf(directiveLine, sizeof(directiveLine), "#line %u %u\n", lineNumber, fileIndex);
+			shader.source += directiveLine;
+			resync = false;
+		}
+		lineNumber++; // Of the next line
+
+		if (directive.compare(0, 8, "#include") == 0){
+			size_t open = directive.find('"');
+			size_t close = open == std::string::npos ? open : directive.find('"', open + 1);
+			if (close == std::string::npos){
+				printf("%s : bad #include : %s\n", path.c_str(), directive.c_str());
+				includeStack.pop_back();
+				return false;
+			}
+			std::string includePath = getDirectory(path) + directive.substr(open + 1, close - open - 1);
+			if (!expandShaderFile(includePath, defines, includeStack, shader)){
+				includeStack.pop_back();
+				return false;
+			}
+			resync = true;
+		}else if (directive.compare(0, 8, "#version") == 0){
+			if (!shader.hasVersion){
+				shader.source += line + "\n";
+				shader.hasVersion = true;
+				appendDefines(shader.source, defines);
+				resync = fileIndex != 0 || (defines != NULL && defines[0] != 0);
+			}else{
+				shader.source += "\n"; // Only one #version is allowed
+			}
+		}else{
+			shader.source += line + "\n";
+		}
 	}
+	includeStack.pop_back();
+	return true;
+}
 
+static bool expandShader(const char * path, const char * defines, ExpandedShader & shader){
+	shader.source.clear();
+	shader.files.clear();
+	shader.hasVersion = false;
+	std::vector<std::string> includeStack;
+	if (!expandShaderFile(path, defines, includeStack, shader))
+		return false;
+	// Without #version, the defines go first
+	if (!shader.hasVersion && defines != NULL && defines[0] != 0){
+		std::string source;
+		appendDefines(source, defines);
+		shader.source = source + "#line 1 0\n" + shader.source;
+	}
+	return true;
+}
 
+// With it, the driver tells when a program is ready without waiting for it
+static bool hasParallelShaderCompile(){
+	if (GLEW_ARB_parallel_shader_compile)
+		return true;
+	// GLEW 1.13 doesn't know the KHR version yet ; it has the same enums
+	GLint extensionCount = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+	for (GLint i=0; i<extensionCount; i++){
+		const char * extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+		if (extension != NULL && strcmp(extension, "GL_KHR_parallel_shader_compile") == 0)
+			return true;
+	}
+	return false;
+}
+
+struct CompiledShader{
+	GLuint id;
+	const ExpandedShader * expanded;
+	bool logPrinted;
+};
 
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
+struct PendingProgram{
+	GLuint id;
+	unsigned int vertexShader, fragmentShader; // In "shaders"
+	std::string cachePath;
+	uint64_t sourceHash;
+	bool done;
+};
 
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+static void printShaderLog(CompiledShader & shader){
+	if (shader.logPrinted)
+		return;
+	shader.logPrinted = true;
+	GLint InfoLogLength = 0;
+	glGetShaderiv(shader.id, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 0 ){
+		std::vector<char> ShaderErrorMessage(InfoLogLength+1);
+		glGetShaderInfoLog(shader.id, InfoLogLength, NULL, &ShaderErrorMessage[0]);
+		printf("%s :\n", shader.expanded->files[0].c_str());
+		for (size_t i=1; i<shader.expanded->files.size(); i++)
+			printf("  (file %u is %s)\n", (unsigned int)i, shader.expanded->files[i].c_str());
+		printf("%s\n", &ShaderErrorMessage[0]);
+	}
+}
+
+// Checks a linked program, prints what the driver has to say, and keeps it for the next launch
+static bool finishProgram(PendingProgram & program, std::vector<CompiledShader> & shaders, bool useCache, uint64_t driverHash){
+	printShaderLog(shaders[program.vertexShader]);
+	printShaderLog(shaders[program.fragmentShader]);
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+	glGetProgramiv(program.id, GL_LINK_STATUS, &Result);
+	glGetProgramiv(program.id, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	if ( InfoLogLength > 0 ){
 		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
-		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		glGetProgramInfoLog(program.id, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
 
-	
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-	
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
+	// Only programs that work are worth keeping
+	if (useCache && Result == GL_TRUE)
+		saveProgramCache(program.cachePath, program.id, program.sourceHash, driverHash);
+
+	glDetachShader(program.id, shaders[program.vertexShader].id);
+	glDetachShader(program.id, shaders[program.fragmentShader].id);
+	program.done = true;
+	return Result == GL_TRUE;
+}
+
+bool LoadShaderPrograms(const ShaderProgramDesc * programs, unsigned int count, GLuint * out_programs){
 
+	bool useCache = hasProgramBinaries();
+	uint64_t DriverHash = useCache ? getDriverHash() : 0;
+	bool parallel = hasParallelShaderCompile();
+	if (parallel && GLEW_ARB_parallel_shader_compile)
+		glMaxShaderCompilerThreadsARB(0xFFFFFFFF); // As many threads as the driver wants
+	bool ok = true;
+
+	// Read and expand everything first
+	std::vector<ExpandedShader> expanded(2 * count);
+	std::vector<bool> readable(count);
+	for (unsigned int i=0; i<count; i++){
+		out_programs[i] = 0;
+		readable[i] = expandShader(programs[i].vertex_file_path,   programs[i].defines, expanded[2*i]) &&
+		              expandShader(programs[i].fragment_file_path, programs[i].defines, expanded[2*i+1]);
+		ok = ok && readable[i];
+	}
+
+	// Identical sources give the same shader, and the same program
+	std::vector<CompiledShader> shaders;
+	std::vector<PendingProgram> pending;
+	std::map<std::string, unsigned int> shaderBySource;
+	std::map<std::string, GLuint> programBySources;
+	for (unsigned int i=0; i<count; i++){
+		if (!readable[i])
+			continue;
+		const ExpandedShader & vertex = expanded[2*i];
+		const ExpandedShader & fragment = expanded[2*i+1];
+
+		// The 0 in between keeps "ab"+"c" and "a"+"bc" apart
+		std::string Sources = vertex.source + '\0' + fragment.source;
+		std::map<std::string, GLuint>::iterator same = programBySources.find(Sources);
+		if (same != programBySources.end()){
+			out_programs[i] = same->second;
+			continue;
+		}
+
+		// Use the program linked by a previous launch, if the sources and the driver are the same
+		uint64_t SourceHash = hashMemory(Sources.data(), Sources.size());
+		std::string CachePath = getProgramCachePath(programs[i].vertex_file_path, programs[i].fragment_file_path, programs[i].defines);
+		if (useCache){
+			out_programs[i] = loadProgramCache(CachePath, SourceHash, DriverHash);
+			if (out_programs[i] != 0){
+				programBySources[Sources] = out_programs[i];
+				continue;
+			}
+		}
+
+		// Start compiling the shaders, but don't wait for them
+		unsigned int shaderIndices[2];
+		for (unsigned int s=0; s<2; s++){
+			const ExpandedShader & shader = expanded[2*i+s];
+			std::string key = std::string(s == 0 ? "v" : "f") + shader.source;
+			std::map<std::string, unsigned int>::iterator found = shaderBySource.find(key);
+			if (found != shaderBySource.end()){
+				shaderIndices[s] = found->second;
+				continue;
+			}
+			printf("Compiling shader : %s\n", shader.files[0].c_str());
+			CompiledShader compiled;
+			compiled.id = glCreateShader(s == 0 ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER);
+			compiled.expanded = &shader;
+			compiled.logPrinted = false;
+			char const * SourcePointer = shader.source.c_str();
+			glShaderSource(compiled.id, 1, &SourcePointer , NULL);
+			glCompileShader(compiled.id);
+			shaderIndices[s] = (unsigned int)shaders.size();
+			shaderBySource[key] = shaderIndices[s];
+			shaders.push_back(compiled);
+		}
+
+		// Link right away too : the link waits for the compiles in the driver, not here
+		PendingProgram program;
+		program.id = glCreateProgram();
+		program.vertexShader = shaderIndices[0];
+		program.fragmentShader = shaderIndices[1];
+		program.cachePath = CachePath;
+		program.sourceHash = SourceHash;
+		program.done = false;
+		glAttachShader(program.id, shaders[program.vertexShader].id);
+		glAttachShader(program.id, shaders[program.fragmentShader].id);
+		if (useCache)
+			glProgramParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glLinkProgram(program.id);
+		out_programs[i] = program.id;
+		programBySources[Sources] = program.id;
+		pending.push_back(program);
+	}
+
+	// Only now ask for the results. With GL_KHR_parallel_shader_compile, the programs
+	// that are ready are checked first, while the driver's threads work on the others.
+	// Without it, the first query waits for its program, but all of them have been
+	// submitted already.
+	if (!pending.empty())
+		printf("Linking %u program%s\n", (unsigned int)pending.size(), pending.size() > 1 ? "s" : "");
+	size_t remaining = pending.size();
+	if (parallel){
+		while (remaining > 0){
+			bool progress = false;
+			for (size_t p=0; p<pending.size(); p++){
+				if (pending[p].done)
+					continue;
+				GLint completed = GL_FALSE;
+				glGetProgramiv(pending[p].id, GL_COMPLETION_STATUS_ARB, &completed);
+				if (completed == GL_TRUE){
+					ok = finishProgram(pending[p], shaders, useCache, DriverHash) && ok;
+					remaining--;
+					progress = true;
+				}
+			}
+			if (!progress)
+				std::this_thread::yield();
+		}
+	}else{
+		for (size_t p=0; p<pending.size(); p++)
+			ok = finishProgram(pending[p], shaders, useCache, DriverHash) && ok;
+	}
+
+	for (size_t s=0; s<shaders.size(); s++)
+		glDeleteShader(shaders[s].id);
+	return ok;
+}
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines){
+
+	ShaderProgramDesc program = { vertex_file_path, fragment_file_path, defines };
+	GLuint ProgramID = 0;
+	LoadShaderPrograms(&program, 1, &ProgramID);
+	if (ProgramID == 0)
+		getchar();
 	return ProgramID;
 }
 
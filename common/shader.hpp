@@ -1,6 +1,27 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
+// One program for LoadShaderPrograms()
+struct ShaderProgramDesc{
+	const char * vertex_file_path;
+	const char * fragment_file_path;
+	const char * defines; // "A B=2" adds "#define A" and "#define B 2" after #version. NULL for none.
+};
+
+// Both shader files can use #include "file", relative to the file that includes it.
+// The first #version is kept, the ones in the included files are ignored.
+//
+// The linked program is kept in "<vertex file>.<fragment file>.programcache", next to the
+// vertex shader : later launches load it instead of compiling, as long as both sources
+// and the driver are the same. Otherwise, or if the driver refuses it, the shaders are compiled again.
+//
+// Builds all the programs at once : every shader is compiled and every program linked
+// before any result is asked for, so that the driver can work on them in parallel
+// (GL_KHR_parallel_shader_compile). Shaders with the same expanded source are compiled once,
+// and programs with the same sources are the same GLuint : delete it only once.
+// out_programs[i] is 0 if a file couldn't be read. Returns false if anything failed.
+bool LoadShaderPrograms(const ShaderProgramDesc * programs, unsigned int count, GLuint * out_programs);
+
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, const char * defines = NULL);
 
 #endif
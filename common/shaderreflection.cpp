@@ -0,0 +1,111 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "shaderreflection.hpp"
+
+GLuint FrameUniformBufferID;
+GLuint ViewUniformBufferID;
+
+struct ByUniformName{
+	bool operator()(const ProgramUniform & a, const ProgramUniform & b) const {
+		return a.name < b.name;
+	}
+	bool operator()(const ProgramUniform & a, const char * name) const {
+		return strcmp(a.name.c_str(), name) < 0;
+	}
+};
+
+void reflectProgram(GLuint program, ProgramReflection & out_reflection){
+	out_reflection.program = program;
+	out_reflection.uniforms.clear();
+	out_reflection.blocks.clear();
+
+	GLint blockCount = 0, nameLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &nameLength);
+	std::vector<char> name(std::max(nameLength, 1) + 1);
+	for (GLint i=0; i<blockCount; i++){
+		ProgramUniformBlock block;
+		glGetActiveUniformBlockName(program, i, (GLsizei)name.size(), NULL, &name[0]);
+		block.name = &name[0];
+		block.index = (GLuint)i;
+		glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+
+		// GLSL 3.30 has no layout(binding = ...) : the shared blocks are bound here
+		GLint binding = 0;
+		if (block.name == "FrameUniforms")
+			glUniformBlockBinding(program, i, FRAME_UNIFORMS_BINDING);
+		else if (block.name == "ViewUniforms")
+			glUniformBlockBinding(program, i, VIEW_UNIFORMS_BINDING);
+		glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_BINDING, &binding);
+		block.binding = (GLuint)binding;
+		out_reflection.blocks.push_back(block);
+	}
+
+	GLint uniformCount = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniformCount);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &nameLength);
+	name.resize(std::max(nameLength, 1) + 1);
+	for (GLint i=0; i<uniformCount; i++){
+		ProgramUniform uniform;
+		GLuint index = (GLuint)i;
+		glGetActiveUniform(program, index, (GLsizei)name.size(), NULL, &uniform.arraySize, &uniform.type, &name[0]);
+		glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &uniform.blockIndex);
+		uniform.location = uniform.blockIndex < 0 ? glGetUniformLocation(program, &name[0]) : -1;
+		uniform.name = &name[0];
+		size_t bracket = uniform.name.find('[');
+		if (bracket != std::string::npos)
+			uniform.name.resize(bracket);
+		out_reflection.uniforms.push_back(uniform);
+	}
+	std::sort(out_reflection.uniforms.begin(), out_reflection.uniforms.end(), ByUniformName());
+}
+
+GLint getUniformLocation(const ProgramReflection & reflection, const char * name){
+	std::vector<ProgramUniform>::const_iterator it =
+		std::lower_bound(reflection.uniforms.begin(), reflection.uniforms.end(), name, ByUniformName());
+	if (it == reflection.uniforms.end() || it->name != name)
+		return -1;
+	return it->location;
+}
+
+void initSharedUniforms(){
+	glGenBuffers(1, &FrameUniformBufferID);
+	glBindBuffer(GL_UNIFORM_BUFFER, FrameUniformBufferID);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, FrameUniformBufferID);
+
+	glGenBuffers(1, &ViewUniformBufferID);
+	glBindBuffer(GL_UNIFORM_BUFFER, ViewUniformBufferID);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewUniforms), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, VIEW_UNIFORMS_BINDING, ViewUniformBufferID);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// The whole buffer changes : orphaning it lets the driver give a new one while
+// the draws of the previous frame (or view) still read the old one.
+static void replaceBufferData(GLuint buffer, const void * data, GLsizeiptr size){
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void updateFrameUniforms(const FrameUniforms & uniforms){
+	replaceBufferData(FrameUniformBufferID, &uniforms, sizeof(uniforms));
+}
+
+void updateViewUniforms(const ViewUniforms & uniforms){
+	replaceBufferData(ViewUniformBufferID, &uniforms, sizeof(uniforms));
+}
+
+void cleanupSharedUniforms(){
+	glDeleteBuffers(1, &FrameUniformBufferID);
+	glDeleteBuffers(1, &ViewUniformBufferID);
+}
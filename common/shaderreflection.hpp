@@ -0,0 +1,65 @@
+#ifndef SHADERREFLECTION_HPP
+#define SHADERREFLECTION_HPP
+
+#include <vector>
+#include <string>
+
+// Everything a program needs from the outside, asked to the driver once after linking
+// instead of calling glGetUniformLocation() with a string every time.
+struct ProgramUniform{
+	std::string name;   // "lights" for "lights[0]"
+	GLint location;     // -1 for the uniforms in a block
+	GLenum type;        // GL_FLOAT_MAT4, GL_SAMPLER_2D...
+	GLint arraySize;    // 1 if it isn't an array
+	GLint blockIndex;   // In "blocks", or -1
+};
+
+struct ProgramUniformBlock{
+	std::string name;
+	GLuint index;
+	GLint dataSize;     // Bytes
+	GLuint binding;     // The buffer binding point it reads from
+};
+
+struct ProgramReflection{
+	GLuint program;
+	std::vector<ProgramUniform> uniforms;     // Sorted by name
+	std::vector<ProgramUniformBlock> blocks;
+};
+
+// Lists the active uniforms and uniform blocks of a linked program. The blocks named
+// "FrameUniforms" and "ViewUniforms" are bound to the shared buffers below.
+void reflectProgram(GLuint program, ProgramReflection & out_reflection);
+
+// -1 if the program doesn't use this uniform, like glGetUniformLocation()
+GLint getUniformLocation(const ProgramReflection & reflection, const char * name);
+
+
+// Uniforms that are the same for every program, uploaded once and shared through
+// uniform buffers. The layouts follow std140 and must match common/SharedUniforms.glsl.
+#define FRAME_UNIFORMS_BINDING 0
+#define VIEW_UNIFORMS_BINDING  1
+
+// Changes once per frame
+struct FrameUniforms{
+	glm::vec4 LightPosition_worldspace; // w is unused
+	float Time;                         // Seconds, from glfwGetTime()
+	float padding[3];
+};
+
+// Changes once per camera : several times per frame when rendering a shadow map
+// or a reflection first.
+struct ViewUniforms{
+	glm::mat4 V;
+	glm::mat4 P;
+	glm::mat4 VP;                        // P * V : the shaders only need P * V * M
+	glm::vec4 CameraPosition_worldspace; // w is unused
+};
+
+// Creates both buffers and binds them to their binding points
+void initSharedUniforms();
+void updateFrameUniforms(const FrameUniforms & uniforms);
+void updateViewUniforms(const ViewUniforms & uniforms);
+void cleanupSharedUniforms();
+
+#endif
@@ -1,6 +1,15 @@
 #include <vector>
+#include <thread>
+#include <stdio.h>
+#include <math.h>
 #include <glm/glm.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TANGENTSPACE_SSE2 1
+#endif
+
+#include "parallel.hpp"
 #include "tangentspace.hpp"
 
 void computeTangentBasis(
@@ -12,6 +21,8 @@ void computeTangentBasis(
 	std::vector<glm::vec3> & tangents,
 	std::vector<glm::vec3> & bitangents
 ){
+	tangents.reserve(tangents.size() + vertices.size());
+	bitangents.reserve(bitangents.size() + vertices.size());
 
 	for (unsigned int i=0; i<vertices.size(); i+=3 ){
 
@@ -71,3 +82,239 @@ void computeTangentBasis(
 }
 
 
+
+// Indexed version.
+// The sums of the tangents are kept as one array per component (x, y, z), so that
+// the per-vertex pass can work on 4 vertices at once.
+struct TangentSums{
+	std::vector<float> tx, ty, tz; // Sum of the tangents of the triangles around each vertex
+	std::vector<float> bx, by, bz; // Same for the bitangents
+};
+
+// Triangles are done in blocks : positions and UVs are gathered in per-component
+// arrays that stay in the L1 cache, then the tangents are computed 4 triangles at a time.
+static const size_t tangentBlockSize = 256;
+
+// Tangent and bitangent of triangles, from the position and UV deltas :
+// in[0..5] = deltaPos1, deltaPos2, in[6..9] = deltaUV1, deltaUV2, each one "count" floats long.
+// out[0..5] = tangent, bitangent. Triangles with a degenerate UV mapping get zero vectors.
+static void triangleTangents(const float * const in[10], float * const out[6], size_t count){
+	size_t i = 0;
+#ifdef TANGENTSPACE_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (; i + 4 <= count; i += 4){
+		__m128 p1x = _mm_loadu_ps(in[0] + i), p1y = _mm_loadu_ps(in[1] + i), p1z = _mm_loadu_ps(in[2] + i);
+		__m128 p2x = _mm_loadu_ps(in[3] + i), p2y = _mm_loadu_ps(in[4] + i), p2z = _mm_loadu_ps(in[5] + i);
+		__m128 uv1x = _mm_loadu_ps(in[6] + i), uv1y = _mm_loadu_ps(in[7] + i);
+		__m128 uv2x = _mm_loadu_ps(in[8] + i), uv2y = _mm_loadu_ps(in[9] + i);
+		__m128 det = _mm_sub_ps(_mm_mul_ps(uv1x, uv2y), _mm_mul_ps(uv1y, uv2x));
+		__m128 r = _mm_and_ps(_mm_cmpneq_ps(det, zero), _mm_div_ps(one, det));
+		_mm_storeu_ps(out[0] + i, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(p1x, uv2y), _mm_mul_ps(p2x, uv1y)), r));
+		_mm_storeu_ps(out[1] + i, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(p1y, uv2y), _mm_mul_ps(p2y, uv1y)), r));
+		_mm_storeu_ps(out[2] + i, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(p1z, uv2y), _mm_mul_ps(p2z, uv1y)), r));
+		_mm_storeu_ps(out[3] + i, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(p2x, uv1x), _mm_mul_ps(p1x, uv2x)), r));
+		_mm_storeu_ps(out[4] + i, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(p2y, uv1x), _mm_mul_ps(p1y, uv2x)), r));
+		_mm_storeu_ps(out[5] + i, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(p2z, uv1x), _mm_mul_ps(p1z, uv2x)), r));
+	}
+#endif
+	for (; i < count; i++){
+		float det = in[6][i] * in[9][i] - in[7][i] * in[8][i];
+		float r = det != 0.0f ? 1.0f / det : 0.0f;
+		for (int c=0; c<3; c++){
+			out[c]  [i] = (in[c][i] * in[9][i] - in[3+c][i] * in[7][i]) * r;
+			out[3+c][i] = (in[3+c][i] * in[6][i] - in[c][i] * in[8][i]) * r;
+		}
+	}
+}
+
+template <typename IndexType>
+static void accumulateTangents(
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	TangentSums & sums
+){
+	size_t vertexCount = vertices.size();
+	size_t triangleCount = indices.size() / 3;
+	float block[16][tangentBlockSize];
+	const float * const in[10] = { block[0], block[1], block[2], block[3], block[4], block[5], block[6], block[7], block[8], block[9] };
+	float * const out[6] = { block[10], block[11], block[12], block[13], block[14], block[15] };
+	unsigned int corners[tangentBlockSize][3];
+	float * sum[6] = { &sums.tx[0], &sums.ty[0], &sums.tz[0], &sums.bx[0], &sums.by[0], &sums.bz[0] };
+
+	for (size_t first=0; first<triangleCount; first+=tangentBlockSize){
+		size_t count = triangleCount - first < tangentBlockSize ? triangleCount - first : tangentBlockSize;
+		size_t valid = 0;
+		for (size_t t=first; t<first+count; t++){
+			unsigned int i0 = indices[3*t+0], i1 = indices[3*t+1], i2 = indices[3*t+2];
+			if (i0 >= vertexCount || i1 >= vertexCount || i2 >= vertexCount)
+				continue;
+			glm::vec3 deltaPos1 = vertices[i1] - vertices[i0];
+			glm::vec3 deltaPos2 = vertices[i2] - vertices[i0];
+			glm::vec2 deltaUV1 = uvs[i1] - uvs[i0];
+			glm::vec2 deltaUV2 = uvs[i2] - uvs[i0];
+			block[0][valid] = deltaPos1.x; block[1][valid] = deltaPos1.y; block[2][valid] = deltaPos1.z;
+			block[3][valid] = deltaPos2.x; block[4][valid] = deltaPos2.y; block[5][valid] = deltaPos2.z;
+			block[6][valid] = deltaUV1.x;  block[7][valid] = deltaUV1.y;
+			block[8][valid] = deltaUV2.x;  block[9][valid] = deltaUV2.y;
+			corners[valid][0] = i0; corners[valid][1] = i1; corners[valid][2] = i2;
+			valid++;
+		}
+
+		triangleTangents(in, out, valid);
+
+		// Same tangent for the 3 corners of the triangle
+		for (int c=0; c<6; c++){
+			float * s = sum[c];
+			const float * o = out[c];
+			for (size_t t=0; t<valid; t++){
+				s[corners[t][0]] += o[t];
+				s[corners[t][1]] += o[t];
+				s[corners[t][2]] += o[t];
+			}
+		}
+	}
+}
+
+// Any unit vector orthogonal to n, for vertices where the UVs give no direction
+static glm::vec3 anyTangent(const glm::vec3 & n){
+	glm::vec3 t = fabsf(n.x) < 0.9f ? glm::cross(n, glm::vec3(1.0f, 0.0f, 0.0f)) : glm::cross(n, glm::vec3(0.0f, 1.0f, 0.0f));
+	float length = glm::length(t);
+	return length > 0.0f ? t / length : glm::vec3(1.0f, 0.0f, 0.0f);
+}
+
+// Gram-Schmidt orthogonalization and handedness, like computeTangentBasis above
+static void orthogonalizeTangent(const glm::vec3 & n, const glm::vec3 & tangentSum, const glm::vec3 & bitangentSum, glm::vec3 & t, glm::vec3 & b){
+	t = tangentSum - n * glm::dot(n, tangentSum);
+	float length = glm::length(t);
+	t = length > 0.0f ? t / length : anyTangent(n);
+	if (glm::dot(glm::cross(n, t), bitangentSum) < 0.0f)
+		t = t * -1.0f;
+	length = glm::length(bitangentSum);
+	b = length > 0.0f ? bitangentSum / length : glm::cross(n, t);
+}
+
+// Vertices [first, last)
+static void orthogonalizeTangents(
+	const std::vector<glm::vec3> & normals,
+	const TangentSums & sums,
+	size_t first, size_t last,
+	std::vector<glm::vec3> & tangents,
+	std::vector<glm::vec3> & bitangents
+){
+	size_t i = first;
+#ifdef TANGENTSPACE_SSE2
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	for (; i + 4 <= last; i += 4){
+		const glm::vec3 * n = &normals[i];
+		__m128 nx = _mm_setr_ps(n[0].x, n[1].x, n[2].x, n[3].x);
+		__m128 ny = _mm_setr_ps(n[0].y, n[1].y, n[2].y, n[3].y);
+		__m128 nz = _mm_setr_ps(n[0].z, n[1].z, n[2].z, n[3].z);
+		__m128 Tx = _mm_loadu_ps(&sums.tx[i]), Ty = _mm_loadu_ps(&sums.ty[i]), Tz = _mm_loadu_ps(&sums.tz[i]);
+		__m128 Bx = _mm_loadu_ps(&sums.bx[i]), By = _mm_loadu_ps(&sums.by[i]), Bz = _mm_loadu_ps(&sums.bz[i]);
+
+		// t = normalize(T - n * dot(n, T))
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, Tx), _mm_mul_ps(ny, Ty)), _mm_mul_ps(nz, Tz));
+		__m128 tx = _mm_sub_ps(Tx, _mm_mul_ps(nx, d));
+		__m128 ty = _mm_sub_ps(Ty, _mm_mul_ps(ny, d));
+		__m128 tz = _mm_sub_ps(Tz, _mm_mul_ps(nz, d));
+		__m128 tLength = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+		__m128 bLength = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(Bx, Bx), _mm_mul_ps(By, By)), _mm_mul_ps(Bz, Bz)));
+
+		// Vertices without a direction (or with NaNs) are done one by one below
+		int usable = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(tLength, zero), _mm_cmpgt_ps(bLength, zero)));
+
+		// Handedness : flip t if dot(cross(n, t), B) < 0
+		__m128 cx = _mm_sub_ps(_mm_mul_ps(ny, tz), _mm_mul_ps(nz, ty));
+		__m128 cy = _mm_sub_ps(_mm_mul_ps(nz, tx), _mm_mul_ps(nx, tz));
+		__m128 cz = _mm_sub_ps(_mm_mul_ps(nx, ty), _mm_mul_ps(ny, tx));
+		__m128 h = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, Bx), _mm_mul_ps(cy, By)), _mm_mul_ps(cz, Bz));
+		__m128 flip = _mm_and_ps(_mm_cmplt_ps(h, zero), signBit);
+		__m128 tScale = _mm_xor_ps(_mm_div_ps(one, tLength), flip);
+		__m128 bScale = _mm_div_ps(one, bLength);
+
+		float t[3][4], b[3][4];
+		_mm_storeu_ps(t[0], _mm_mul_ps(tx, tScale)); _mm_storeu_ps(t[1], _mm_mul_ps(ty, tScale)); _mm_storeu_ps(t[2], _mm_mul_ps(tz, tScale));
+		_mm_storeu_ps(b[0], _mm_mul_ps(Bx, bScale)); _mm_storeu_ps(b[1], _mm_mul_ps(By, bScale)); _mm_storeu_ps(b[2], _mm_mul_ps(Bz, bScale));
+		for (int k=0; k<4; k++){
+			if (usable & (1 << k)){
+				tangents[i+k] = glm::vec3(t[0][k], t[1][k], t[2][k]);
+				bitangents[i+k] = glm::vec3(b[0][k], b[1][k], b[2][k]);
+			} else {
+				orthogonalizeTangent(normals[i+k],
+					glm::vec3(sums.tx[i+k], sums.ty[i+k], sums.tz[i+k]), glm::vec3(sums.bx[i+k], sums.by[i+k], sums.bz[i+k]),
+					tangents[i+k], bitangents[i+k]);
+			}
+		}
+	}
+#endif
+	for (; i < last; i++){
+		orthogonalizeTangent(normals[i],
+			glm::vec3(sums.tx[i], sums.ty[i], sums.tz[i]), glm::vec3(sums.bx[i], sums.by[i], sums.bz[i]),
+			tangents[i], bitangents[i]);
+	}
+}
+
+template <typename IndexType>
+void computeTangentBasis(
+	// inputs
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	// outputs
+	std::vector<glm::vec3> & tangents,
+	std::vector<glm::vec3> & bitangents
+){
+	size_t vertexCount = vertices.size();
+	if (uvs.size() < vertexCount || normals.size() < vertexCount){
+		printf("computeTangentBasis : %u vertices but %u UVs and %u normals\n", (unsigned int)vertexCount, (unsigned int)uvs.size(), (unsigned int)normals.size());
+		tangents.clear();
+		bitangents.clear();
+		return;
+	}
+	tangents.resize(vertexCount);
+	bitangents.resize(vertexCount);
+	if (vertexCount == 0)
+		return;
+
+	TangentSums sums;
+	sums.tx.assign(vertexCount, 0.0f); sums.ty.assign(vertexCount, 0.0f); sums.tz.assign(vertexCount, 0.0f);
+	sums.bx.assign(vertexCount, 0.0f); sums.by.assign(vertexCount, 0.0f); sums.bz.assign(vertexCount, 0.0f);
+	accumulateTangents(indices, vertices, uvs, sums);
+
+	// Each vertex is independent now. Below about 64k vertices per thread,
+	// starting the threads costs more than it saves.
+	const size_t minVerticesPerThread = 1 << 16;
+	size_t threadCount = std::thread::hardware_concurrency();
+	if (threadCount > vertexCount / minVerticesPerThread) threadCount = vertexCount / minVerticesPerThread;
+	if (threadCount < 1) threadCount = 1;
+	size_t verticesPerThread = ((vertexCount + threadCount - 1) / threadCount + 3) & ~(size_t)3; // Whole groups of 4, covering every vertex
+	runInParallel(threadCount, [&](size_t thread){
+		size_t first = thread * verticesPerThread;
+		size_t last = first + verticesPerThread < vertexCount ? first + verticesPerThread : vertexCount;
+		if (first < last)
+			orthogonalizeTangents(normals, sums, first, last, tangents, bitangents);
+	});
+}
+
+template void computeTangentBasis<unsigned short>(
+	const std::vector<unsigned short> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	std::vector<glm::vec3> & tangents,
+	std::vector<glm::vec3> & bitangents
+);
+
+template void computeTangentBasis<unsigned int>(
+	const std::vector<unsigned int> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	std::vector<glm::vec3> & tangents,
+	std::vector<glm::vec3> & bitangents
+);
@@ -11,5 +11,22 @@ void computeTangentBasis(
 	std::vector<glm::vec3> & bitangents
 );
 
+// Same thing for an indexed mesh (the output of indexVBO), without going back to
+// one vertex per triangle corner : the tangents of the triangles are summed on the
+// vertices they share, then orthogonalized once per vertex.
+// Tangents are normalized and orthogonal to the normals, bitangents are normalized.
+// IndexType is unsigned short or unsigned int, like for indexVBO.
+template <typename IndexType>
+void computeTangentBasis(
+	// inputs
+	const std::vector<IndexType> & indices,
+	const std::vector<glm::vec3> & vertices,
+	const std::vector<glm::vec2> & uvs,
+	const std::vector<glm::vec3> & normals,
+	// outputs
+	std::vector<glm::vec3> & tangents,
+	std::vector<glm::vec3> & bitangents
+);
+
 
 #endif
\ No newline at end of file
@@ -1,5 +1,9 @@
 #include <vector>
+#include <string>
+#include <unordered_map>
 #include <cstring>
+#include <cmath>
+#include <cstdio>
 
 #include <GL/glew.h>
 
@@ -8,24 +12,92 @@
 using namespace glm;
 
 #include "shader.hpp"
-#include "texture.hpp"
+#include "glyphcache.hpp"
 
 #include "text2D.hpp"
 
-unsigned int Text2DTextureID;
+// What the vertex shader reads, 4 per character
+struct TextVertex{
+	glm::vec2 position;
+	glm::vec2 uv;
+};
+
+// A character laid out, drawn with the texture of a page of the glyph cache
+struct TextQuad{
+	unsigned int page;
+	TextVertex vertices[4];
+};
+
+// A string already laid out, kept while it is printed every frame
+struct TextLayout{
+	std::vector<TextQuad> quads;
+	unsigned int glyphCacheGeneration; // The UVs are wrong once a page has been reused
+	unsigned int lastFlush;
+};
+
+unsigned int Text2DVertexArrayID;
 unsigned int Text2DVertexBufferID;
-unsigned int Text2DUVBufferID;
+unsigned int Text2DIndexBufferID;
 unsigned int Text2DShaderID;
 unsigned int Text2DUniformID;
 
+// The vertex buffer is split in TEXT2D_REGION_COUNT regions : each flush writes in the
+// next one, while the GPU may still read the previous ones. A fence tells when a region is free again.
+TextVertex * Text2DMappedBuffer; // Mapped once for good, when persistent mappings are supported
+GLsync Text2DRegionFences[TEXT2D_REGION_COUNT];
+unsigned int Text2DRegion;
+
+std::vector< std::vector<TextVertex> > Text2DQueues; // One per page of the glyph cache
+std::unordered_map<std::string, TextLayout> Text2DLayouts;
+unsigned int Text2DFlushCount;
+
 void initText2D(const char * texturePath){
 
-	// Initialize texture
-	Text2DTextureID = loadDDS(texturePath);
+	// Initialize glyphs : 4 pages of 512x512 hold a few sizes of Latin-1
+	initGlyphCache(texturePath, 512, 4);
+
+	// Initialize VBO, in its own VAO so that the VAO of the caller isn't changed
+	GLint previousVertexArray = 0;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+	glGenVertexArrays(1, &Text2DVertexArrayID);
+	glBindVertexArray(Text2DVertexArrayID);
 
-	// Initialize VBO
+	GLsizeiptr bufferSize = (GLsizeiptr)TEXT2D_REGION_COUNT * TEXT2D_MAX_CHARACTERS * 4 * sizeof(TextVertex);
 	glGenBuffers(1, &Text2DVertexBufferID);
-	glGenBuffers(1, &Text2DUVBufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
+	Text2DMappedBuffer = NULL;
+	if (GLEW_ARB_buffer_storage){
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, bufferSize, NULL, flags);
+		Text2DMappedBuffer = (TextVertex *)glMapBufferRange(GL_ARRAY_BUFFER, 0, bufferSize, flags);
+	}else{
+		glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STREAM_DRAW);
+	}
+
+	// 1rst attribute buffer : vertices
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)0 );
+
+	// 2nd attribute buffer : UVs
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex), (void*)sizeof(glm::vec2) );
+
+	// The quads never change : two triangles each, like the 6 vertices before
+	std::vector<unsigned short> indices(TEXT2D_MAX_CHARACTERS * 6);
+	for (unsigned int i=0; i<TEXT2D_MAX_CHARACTERS; i++){
+		unsigned short first = (unsigned short)(i * 4);
+		unsigned short quad[6] = { first, (unsigned short)(first+1), (unsigned short)(first+2), (unsigned short)(first+3), (unsigned short)(first+2), (unsigned short)(first+1) };
+		memcpy(&indices[i * 6], quad, sizeof(quad));
+	}
+	glGenBuffers(1, &Text2DIndexBufferID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Text2DIndexBufferID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+	glBindVertexArray(previousVertexArray);
+
+	for (unsigned int i=0; i<TEXT2D_REGION_COUNT; i++)
+		Text2DRegionFences[i] = 0;
+	Text2DRegion = 0;
+	Text2DFlushCount = 0;
 
 	// Initialize Shader
 	Text2DShaderID = LoadShaders( "TextVertexShader.vertexshader", "TextVertexShader.fragmentshader" );
@@ -35,89 +107,193 @@ void initText2D(const char * texturePath){
 
 }
 
-void printText2D(const char * text, int x, int y, int size){
-
-	unsigned int length = strlen(text);
-
-	// Fill buffers
-	std::vector<glm::vec2> vertices;
-	std::vector<glm::vec2> UVs;
-	for ( unsigned int i=0 ; i<length ; i++ ){
-		
-		glm::vec2 vertex_up_left    = glm::vec2( x+i*size     , y+size );
-		glm::vec2 vertex_up_right   = glm::vec2( x+i*size+size, y+size );
-		glm::vec2 vertex_down_right = glm::vec2( x+i*size+size, y      );
-		glm::vec2 vertex_down_left  = glm::vec2( x+i*size     , y      );
-
-		vertices.push_back(vertex_up_left   );
-		vertices.push_back(vertex_down_left );
-		vertices.push_back(vertex_up_right  );
-
-		vertices.push_back(vertex_down_right);
-		vertices.push_back(vertex_up_right);
-		vertices.push_back(vertex_down_left);
-
-		char character = text[i];
-		float uv_x = (character%16)/16.0f;
-		float uv_y = (character/16)/16.0f;
-
-		glm::vec2 uv_up_left    = glm::vec2( uv_x           , uv_y );
-		glm::vec2 uv_up_right   = glm::vec2( uv_x+1.0f/16.0f, uv_y );
-		glm::vec2 uv_down_right = glm::vec2( uv_x+1.0f/16.0f, (uv_y + 1.0f/16.0f) );
-		glm::vec2 uv_down_left  = glm::vec2( uv_x           , (uv_y + 1.0f/16.0f) );
-		UVs.push_back(uv_up_left   );
-		UVs.push_back(uv_down_left );
-		UVs.push_back(uv_up_right  );
-
-		UVs.push_back(uv_down_right);
-		UVs.push_back(uv_up_right);
-		UVs.push_back(uv_down_left);
+static void layoutText2D(const char * text, int x, int y, int size, std::vector<TextQuad> & out){
+
+	// Pen positions are rounded to pixels, so that the glyphs stay sharp
+	float penX = (float)x;
+	unsigned int previous = 0;
+	while (*text != '\0'){
+
+		unsigned int codepoint = decodeUTF8(text);
+		if (codepoint == '\n'){
+			penX = (float)x;
+			y -= size;
+			previous = 0;
+			continue;
+		}
+
+		if (previous != 0)
+			penX += getGlyphKerning(previous, codepoint, size);
+		previous = codepoint;
+
+		const CachedGlyph * glyph = getGlyph(codepoint, size);
+		if (glyph->width > 0){
+			float left   = floorf(penX + 0.5f) + glyph->offsetX;
+			float top    = (float)(y + glyph->offsetY);
+			float right  = left + glyph->width;
+			float bottom = top - glyph->height;
+
+			TextQuad quad;
+			quad.page = glyph->page;
+			TextVertex up_left    = { glm::vec2( left , top    ), glm::vec2( glyph->uv[0], glyph->uv[1] ) };
+			TextVertex down_left  = { glm::vec2( left , bottom ), glm::vec2( glyph->uv[0], glyph->uv[3] ) };
+			TextVertex up_right   = { glm::vec2( right, top    ), glm::vec2( glyph->uv[2], glyph->uv[1] ) };
+			TextVertex down_right = { glm::vec2( right, bottom ), glm::vec2( glyph->uv[2], glyph->uv[3] ) };
+			quad.vertices[0] = up_left;
+			quad.vertices[1] = down_left;
+			quad.vertices[2] = up_right;
+			quad.vertices[3] = down_right;
+			out.push_back(quad);
+		}
+		penX += glyph->advance;
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), &vertices[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DUVBufferID);
-	glBufferData(GL_ARRAY_BUFFER, UVs.size() * sizeof(glm::vec2), &UVs[0], GL_STATIC_DRAW);
-
-	// Bind shader
-	glUseProgram(Text2DShaderID);
+}
 
-	// Bind texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, Text2DTextureID);
-	// Set our "myTextureSampler" sampler to use Texture Unit 0
-	glUniform1i(Text2DUniformID, 0);
+void printText2D(const char * text, int x, int y, int size){
 
-	// 1rst attribute buffer : vertices
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0 );
+	// The same text at the same place as in a previous frame doesn't need to be laid out again
+	std::string key(text);
+	key.push_back('\0');
+	int position[3] = { x, y, size };
+	key.append((const char *)position, sizeof(position));
+
+	TextLayout & layout = Text2DLayouts[key];
+	if (layout.lastFlush == 0 || layout.glyphCacheGeneration != getGlyphCacheGeneration()){
+		layout.quads.clear();
+		layoutText2D(text, x, y, size, layout.quads);
+		// Laying out may reuse a page, but never one holding glyphs of this frame
+		layout.glyphCacheGeneration = getGlyphCacheGeneration();
+	}
+	layout.lastFlush = Text2DFlushCount + 1;
+
+	for (size_t i=0; i<layout.quads.size(); i++){
+		const TextQuad & quad = layout.quads[i];
+		markGlyphPageUsed(quad.page);
+		if (quad.page >= Text2DQueues.size())
+			Text2DQueues.resize(quad.page + 1);
+		Text2DQueues[quad.page].insert(Text2DQueues[quad.page].end(), quad.vertices, quad.vertices + 4);
+	}
+}
 
-	// 2nd attribute buffer : UVs
-	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DUVBufferID);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0 );
+// Copies up to TEXT2D_MAX_CHARACTERS characters in the next region, and draws them
+static void drawText2DRegion(const TextVertex * vertices, unsigned int characterCount){
+
+	// Wait until the GPU has drawn what was in this region last time. It was
+	// TEXT2D_REGION_COUNT flushes ago, so this usually doesn't wait at all.
+	GLsync & fence = Text2DRegionFences[Text2DRegion];
+	if (fence != 0){
+		GLenum status;
+		do{
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		}while (status == GL_TIMEOUT_EXPIRED); // The region can't be written before the GPU is done with it
+		if (status == GL_WAIT_FAILED)
+			glFinish();
+		glDeleteSync(fence);
+		fence = 0;
+	}
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	unsigned int firstVertex = Text2DRegion * TEXT2D_MAX_CHARACTERS * 4;
+	size_t size = characterCount * 4 * sizeof(TextVertex);
+	if (Text2DMappedBuffer != NULL){
+		memcpy(Text2DMappedBuffer + firstVertex, vertices, size);
+	}else{
+		// The fence already waited : nothing needs to be synchronized
+		void * mapped = glMapBufferRange(GL_ARRAY_BUFFER, firstVertex * sizeof(TextVertex), size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (mapped == NULL){
+			// These characters aren't drawn this time. The region is still free for the next flush.
+			printf("Impossible to map the text vertex buffer\n");
+			return;
+		}
+		memcpy(mapped, vertices, size);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	}
 
 	// Draw call
-	glDrawArrays(GL_TRIANGLES, 0, vertices.size() );
+	glDrawElementsBaseVertex(GL_TRIANGLES, characterCount * 6, GL_UNSIGNED_SHORT, (void*)0, firstVertex);
 
-	glDisable(GL_BLEND);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	Text2DRegion = (Text2DRegion + 1) % TEXT2D_REGION_COUNT;
+}
 
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
+void flushText2D(){
+
+	// The glyphs made for this frame go to their pages first
+	flushGlyphCache();
+	Text2DFlushCount++;
+
+	bool queued = false;
+	for (size_t page=0; page<Text2DQueues.size(); page++)
+		queued = queued || !Text2DQueues[page].empty();
+	if (queued){
+
+		GLint previousVertexArray = 0;
+		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+		glBindVertexArray(Text2DVertexArrayID);
+		glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
+
+		// Bind shader
+		glUseProgram(Text2DShaderID);
+
+		// Set our "myTextureSampler" sampler to use Texture Unit 0
+		glActiveTexture(GL_TEXTURE0);
+		glUniform1i(Text2DUniformID, 0);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		// Usually one draw per page used, and one page for all the text of the frame
+		for (size_t page=0; page<Text2DQueues.size(); page++){
+			std::vector<TextVertex> & queue = Text2DQueues[page];
+			if (queue.empty())
+				continue;
+			glBindTexture(GL_TEXTURE_2D, getGlyphCachePageTexture((unsigned int)page));
+			unsigned int characterCount = (unsigned int)(queue.size() / 4);
+			for (unsigned int first=0; first<characterCount; first+=TEXT2D_MAX_CHARACTERS){
+				unsigned int count = characterCount - first;
+				if (count > TEXT2D_MAX_CHARACTERS)
+					count = TEXT2D_MAX_CHARACTERS;
+				drawText2DRegion(&queue[first * 4], count);
+			}
+			queue.clear();
+		}
+
+		glDisable(GL_BLEND);
+		glBindVertexArray(previousVertexArray);
+	}
 
+	// Forget the texts that haven't been printed for a while
+	if (Text2DFlushCount % TEXT2D_LAYOUT_LIFETIME == 0){
+		for (std::unordered_map<std::string, TextLayout>::iterator it = Text2DLayouts.begin(); it != Text2DLayouts.end(); ){
+			if (Text2DFlushCount - it->second.lastFlush > TEXT2D_LAYOUT_LIFETIME)
+				it = Text2DLayouts.erase(it);
+			else
+				++it;
+		}
+	}
 }
 
 void cleanupText2D(){
 
 	// Delete buffers
+	for (unsigned int i=0; i<TEXT2D_REGION_COUNT; i++){
+		if (Text2DRegionFences[i] != 0)
+			glDeleteSync(Text2DRegionFences[i]);
+		Text2DRegionFences[i] = 0;
+	}
+	if (Text2DMappedBuffer != NULL){
+		glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		Text2DMappedBuffer = NULL;
+	}
 	glDeleteBuffers(1, &Text2DVertexBufferID);
-	glDeleteBuffers(1, &Text2DUVBufferID);
+	glDeleteBuffers(1, &Text2DIndexBufferID);
+	glDeleteVertexArrays(1, &Text2DVertexArrayID);
+	Text2DQueues.clear();
+	Text2DLayouts.clear();
 
-	// Delete texture
-	glDeleteTextures(1, &Text2DTextureID);
+	// Delete glyphs
+	cleanupGlyphCache();
 
 	// Delete shader
 	glDeleteProgram(Text2DShaderID);
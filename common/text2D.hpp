@@ -1,8 +1,21 @@
 #ifndef TEXT2D_HPP
 #define TEXT2D_HPP
 
+#define TEXT2D_MAX_CHARACTERS  4096 // Per draw ; more text takes more draws
+#define TEXT2D_REGION_COUNT    3    // Flushes the GPU can be behind before the CPU waits
+#define TEXT2D_LAYOUT_LIFETIME 60   // Flushes a text is laid out for without being printed
+
 void initText2D(const char * texturePath);
+
+// Queues a UTF-8 text, with proportional glyphs and '\n' for new lines : nothing is drawn
+// until flushText2D(). A text printed again at the same place and size isn't laid out again.
+// size is the height of a line, in pixels.
 void printText2D(const char * text, int x, int y, int size);
+
+// Draws all the queued texts, usually in a single draw per page of glyphs, on top of what is already there.
+// Call it once per frame, before swapping the buffers.
+void flushText2D();
+
 void cleanupText2D();
 
-#endif
\ No newline at end of file
+#endif
@@ -1,98 +1,464 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <vector>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_SSE2 1
+#endif
 
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
 
+#include "file_utils.hpp"
+#include "parallel.hpp"
+#include "texture.hpp"
 
-GLuint loadBMP_custom(const char * imagepath){
 
-	printf("Reading image %s\n", imagepath);
+// The compression field of the BMP header
+#define BMP_RGB            0
+#define BMP_RLE8           1
+#define BMP_RLE4           2
+#define BMP_BITFIELDS      3
+#define BMP_ALPHABITFIELDS 6
 
-	// Data read from the header of the BMP file
-	unsigned char header[54];
-	unsigned int dataPos;
-	unsigned int imageSize;
-	unsigned int width, height;
-	// Actual RGB data
-	unsigned char * data;
+static inline unsigned int readUint16(const unsigned char * p){
+	return (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+}
 
-	// Open the file
-	FILE * file = fopen(imagepath,"rb");
-	if (!file){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
-		getchar();
-		return 0;
+static inline unsigned int readUint32(const unsigned char * p){
+	return (unsigned int)p[0] | ((unsigned int)p[1] << 8) | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+// BGR to RGB, from the file to "dst". The middle of the row is done 16 bytes at a time :
+// each output byte comes from the same place, 2 bytes before, or 2 bytes after, in
+// the source, depending on its place in its pixel.
+static void swizzleBGR(const unsigned char * src, unsigned char * dst, unsigned int count){
+	size_t size = (size_t)count * 3;
+	size_t end = 0;
+#ifdef TEXTURE_SSE2
+	if (size >= 16 + 2 + 16){
+		// masks[phase][k] : bytes that come from src - 2, src and src + 2, when the
+		// first byte of the 16 is byte "phase" of a pixel
+		__m128i masks[3][3];
+		for (int phase=0; phase<3; phase++){
+			for (int k=0; k<3; k++){
+				unsigned char bytes[16];
+				for (int i=0; i<16; i++)
+					bytes[i] = (phase + i) % 3 == 2 - k ? 0xFF : 0x00;
+				masks[phase][k] = _mm_loadu_si128((const __m128i *)bytes);
+			}
+		}
+		int phase = 16 % 3;
+		for (end=16; end + 16 + 2 <= size; end += 16){
+			__m128i before = _mm_loadu_si128((const __m128i *)(src + end - 2));
+			__m128i same   = _mm_loadu_si128((const __m128i *)(src + end));
+			__m128i after  = _mm_loadu_si128((const __m128i *)(src + end + 2));
+			__m128i rgb = _mm_or_si128(_mm_or_si128(
+				_mm_and_si128(before, masks[phase][0]),
+				_mm_and_si128(same,   masks[phase][1])),
+				_mm_and_si128(after,  masks[phase][2]));
+			_mm_storeu_si128((__m128i *)(dst + end), rgb);
+			phase = (phase + 1) % 3;
+		}
+	}
+#endif
+	// The pixels that the loop above didn't fully write
+	unsigned int firstPixels = end > 0 ? 6 : 0;
+	for (unsigned int i=0; i<firstPixels && i<count; i++){
+		dst[3*i+0] = src[3*i+2];
+		dst[3*i+1] = src[3*i+1];
+		dst[3*i+2] = src[3*i+0];
+	}
+	for (unsigned int i=(unsigned int)(end / 3); i<count; i++){
+		dst[3*i+0] = src[3*i+2];
+		dst[3*i+1] = src[3*i+1];
+		dst[3*i+2] = src[3*i+0];
+	}
+}
+
+// BGRA to RGBA. Without alpha in the file, alpha is 255.
+static void swizzleBGRA(const unsigned char * src, unsigned char * dst, unsigned int count, bool hasAlpha){
+	unsigned int i = 0;
+#ifdef TEXTURE_SSE2
+	const __m128i redBlue = _mm_set1_epi32(0x00FF00FF);
+	const __m128i greenAlpha = _mm_set1_epi32((int)0xFF00FF00);
+	const __m128i opaque = _mm_set1_epi32(hasAlpha ? 0 : (int)0xFF000000);
+	for (; i + 4 <= count; i += 4){
+		__m128i bgra = _mm_loadu_si128((const __m128i *)(src + 4*i));
+		__m128i rb = _mm_and_si128(bgra, redBlue);
+		__m128i rgba = _mm_or_si128(_mm_and_si128(bgra, greenAlpha), _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+		_mm_storeu_si128((__m128i *)(dst + 4*i), _mm_or_si128(rgba, opaque));
 	}
+#endif
+	for (; i<count; i++){
+		dst[4*i+0] = src[4*i+2];
+		dst[4*i+1] = src[4*i+1];
+		dst[4*i+2] = src[4*i+0];
+		dst[4*i+3] = hasAlpha ? src[4*i+3] : 255;
+	}
+}
+
+// Byte of a 32 bits pixel that a mask selects. -1 if it isn't a whole byte.
+static int getMaskByte(unsigned int mask){
+	for (int k=0; k<4; k++){
+		if (mask == 0xFFu << (8*k))
+			return k;
+	}
+	return -1;
+}
+
+// Unpacks RLE8 or RLE4 data in one palette index per pixel, bottom row first.
+// Skipped pixels keep index 0.
+static bool decodeRLE(const unsigned char * p, const unsigned char * end, bool rle4, unsigned int width, unsigned int height, std::vector<unsigned char> & indices){
+	indices.assign((size_t)width * height, 0);
+	unsigned int x = 0, y = 0;
+	while (p + 2 <= end){
+		unsigned int count = p[0];
+		unsigned int value = p[1];
+		p += 2;
+		if (count > 0){
+			// A run : "count" pixels, alternating between the 2 nibbles in RLE4
+			for (unsigned int i=0; i<count && x<width && y<height; i++, x++)
+				indices[(size_t)y * width + x] = (unsigned char)(rle4 ? ((i & 1) ? value & 15 : value >> 4) : value);
+		}else if (value == 0){ // End of line
+			x = 0;
+			y++;
+		}else if (value == 1){ // End of bitmap
+			return true;
+		}else if (value == 2){ // Move right and up
+			if (p + 2 > end)
+				return false;
+			x += p[0];
+			y += p[1];
+			p += 2;
+		}else{
+			// "value" pixels stored as they are, padded to 2 bytes
+			size_t bytes = rle4 ? (value + 1) / 2 : value;
+			if (p + bytes > end)
+				return false;
+			for (unsigned int i=0; i<value && x<width && y<height; i++, x++)
+				indices[(size_t)y * width + x] = rle4 ? ((i & 1) ? p[i/2] & 15 : p[i/2] >> 4) : p[i];
+			p += (bytes + 1) & ~(size_t)1;
+		}
+	}
+	return true; // Some files don't end with "end of bitmap"
+}
 
-	// Read the header, i.e. the 54 first bytes
+bool decodeBMP(const unsigned char * bytes, size_t fileSize, unsigned int & width, unsigned int & height, unsigned int & channels, std::vector<unsigned char> & data){
+	const unsigned char * fileEnd = bytes + fileSize;
 
-	// If less than 54 bytes are read, problem
-	if ( fread(header, 1, 54, file)!=54 ){ 
+	// A BMP files always begins with "BM", then the size of the information header
+	if (fileSize < 14 + 12 || bytes[0] != 'B' || bytes[1] != 'M' || fileSize < 14 + (size_t)readUint32(bytes + 0x0E)){
 		printf("Not a correct BMP file\n");
-		fclose(file);
-		return 0;
+		return false;
 	}
-	// A BMP files always begins with "BM"
-	if ( header[0]!='B' || header[1]!='M' ){
+	unsigned int dataPos    = readUint32(bytes + 0x0A);
+	unsigned int headerSize = readUint32(bytes + 0x0E);
+	int fileWidth, fileHeight;
+	unsigned int bitsPerPixel, compression = BMP_RGB, paletteSize = 0, paletteEntrySize = 4;
+	if (headerSize == 12){
+		// The old OS/2 header : 16 bits sizes, 3 bytes per palette entry
+		fileWidth    = (int)readUint16(bytes + 0x12);
+		fileHeight   = (int)readUint16(bytes + 0x14);
+		bitsPerPixel = readUint16(bytes + 0x18);
+		paletteEntrySize = 3;
+	}else if (headerSize >= 40){
+		fileWidth    = (int)readUint32(bytes + 0x12);
+		fileHeight   = (int)readUint32(bytes + 0x16);
+		bitsPerPixel = readUint16(bytes + 0x1C);
+		compression  = readUint32(bytes + 0x1E);
+		paletteSize  = readUint32(bytes + 0x2E);
+	}else{
 		printf("Not a correct BMP file\n");
-		fclose(file);
-		return 0;
+		return false;
+	}
+	if (bitsPerPixel <= 8 && paletteSize == 0)
+		paletteSize = 1u << bitsPerPixel;
+
+	// A negative height means the top row is first
+	bool topDown = fileHeight < 0;
+	width  = (unsigned int)fileWidth;
+	height = (unsigned int)(topDown ? -fileHeight : fileHeight);
+	channels = bitsPerPixel == 32 ? 4 : 3;
+
+	// Masks of the color channels of 32 bits pixels. The usual ones are BGRA.
+	unsigned int masks[4] = { 0x00FF0000, 0x0000FF00, 0x000000FF, 0 };
+	if (compression == BMP_BITFIELDS || compression == BMP_ALPHABITFIELDS){
+		bool alphaMask = compression == BMP_ALPHABITFIELDS || headerSize >= 56;
+		if (fileSize >= 0x36 + (alphaMask ? 16 : 12)){
+			for (int c=0; c<(alphaMask ? 4 : 3); c++)
+				masks[c] = readUint32(bytes + 0x36 + 4*c);
+		}
+	}
+	int maskBytes[4] = { getMaskByte(masks[0]), getMaskByte(masks[1]), getMaskByte(masks[2]), masks[3] ? getMaskByte(masks[3]) : 3 };
+
+	bool supported =
+		(compression == BMP_RGB && (bitsPerPixel == 1 || bitsPerPixel == 4 || bitsPerPixel == 8 || bitsPerPixel == 24 || bitsPerPixel == 32)) ||
+		(compression == BMP_RLE8 && bitsPerPixel == 8 && !topDown) ||
+		(compression == BMP_RLE4 && bitsPerPixel == 4 && !topDown) ||
+		((compression == BMP_BITFIELDS || compression == BMP_ALPHABITFIELDS) && bitsPerPixel == 32 &&
+			maskBytes[0] >= 0 && maskBytes[1] >= 0 && maskBytes[2] >= 0 && maskBytes[3] >= 0);
+	if (!supported){
+		printf("%u bits per pixel with compression %u isn't supported\n", bitsPerPixel, compression);
+		return false;
+	}
+	if (width == 0 || height == 0 || width > 65536 || height > 65536){
+		printf("Not a correct BMP file\n");
+		return false;
 	}
-	// Make sure this is a 24bpp file
-	if ( *(int*)&(header[0x1E])!=0  )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
-	if ( *(int*)&(header[0x1C])!=24 )         {printf("Not a correct BMP file\n");    fclose(file); return 0;}
 
-	// Read the information about the image
-	dataPos    = *(int*)&(header[0x0A]);
-	imageSize  = *(int*)&(header[0x22]);
-	width      = *(int*)&(header[0x12]);
-	height     = *(int*)&(header[0x16]);
+	// The palette follows the headers (and the masks, with the 40 bytes header)
+	const unsigned char * palette = bytes + 14 + headerSize;
+	if (headerSize == 40 && compression == BMP_BITFIELDS) palette += 12;
+	if (headerSize == 40 && compression == BMP_ALPHABITFIELDS) palette += 16;
+	if (bitsPerPixel <= 8 && (paletteSize > 256 || palette + (size_t)paletteSize * paletteEntrySize > fileEnd)){
+		printf("Not a correct BMP file\n");
+		return false;
+	}
 
 	// Some BMP files are misformatted, guess missing information
-	if (imageSize==0)    imageSize=width*height*3; // 3 : one byte for each Red, Green and Blue component
-	if (dataPos==0)      dataPos=54; // The BMP header is done that way
+	if (dataPos == 0)
+		dataPos = (unsigned int)(palette - bytes) + (bitsPerPixel <= 8 ? paletteSize * paletteEntrySize : 0);
+	size_t rowSize = (((size_t)width * bitsPerPixel + 31) / 32) * 4; // Rows are padded to 4 bytes
+	bool rle = compression == BMP_RLE8 || compression == BMP_RLE4;
+	if (dataPos > fileSize || (!rle && fileSize - dataPos < rowSize * height)){
+		printf("Not a correct BMP file\n");
+		return false;
+	}
+	const unsigned char * pixels = bytes + dataPos;
+
+	data.resize((size_t)width * height * channels);
+	std::vector<unsigned char> rleIndices;
+	if (rle && !decodeRLE(pixels, fileEnd, compression == BMP_RLE4, width, height, rleIndices)){
+		printf("Not a correct BMP file\n");
+		return false;
+	}
 
-	// Create a buffer
-	data = new unsigned char [imageSize];
+	bool usualMasks = masks[0] == 0x00FF0000 && masks[1] == 0x0000FF00 && masks[2] == 0x000000FF && (masks[3] == 0 || masks[3] == 0xFF000000);
+	for (unsigned int y=0; y<height; y++){
+		// Bottom row first, like in OpenGL
+		const unsigned char * src = pixels + rowSize * (topDown ? height - 1 - y : y);
+		unsigned char * dst = &data[(size_t)y * width * channels];
+		if (bitsPerPixel == 24){
+			swizzleBGR(src, dst, width);
+		}else if (bitsPerPixel == 32 && usualMasks){
+			swizzleBGRA(src, dst, width, masks[3] != 0);
+		}else if (bitsPerPixel == 32){
+			for (unsigned int x=0; x<width; x++){
+				for (int c=0; c<3; c++)
+					dst[4*x+c] = src[4*x+maskBytes[c]];
+				dst[4*x+3] = masks[3] ? src[4*x+maskBytes[3]] : 255;
+			}
+		}else{
+			for (unsigned int x=0; x<width; x++){
+				unsigned int index;
+				if (rle)                    index = rleIndices[(size_t)y * width + x];
+				else if (bitsPerPixel == 8) index = src[x];
+				else if (bitsPerPixel == 4) index = (x & 1) ? src[x/2] & 15 : src[x/2] >> 4;
+				else                        index = (src[x/8] >> (7 - (x & 7))) & 1;
+				if (index >= paletteSize)
+					index = 0;
+				const unsigned char * color = palette + index * paletteEntrySize;
+				dst[3*x+0] = color[2];
+				dst[3*x+1] = color[1];
+				dst[3*x+2] = color[0];
+			}
+		}
+	}
 
-	// Read the actual data from the file into the buffer
-	fread(data,1,imageSize,file);
+	return true;
+}
+
+bool readBMP(const char * imagepath, unsigned int & width, unsigned int & height, unsigned int & channels, std::vector<unsigned char> & data){
+
+	printf("Reading image %s\n", imagepath);
+
+	MappedFile file;
+	if (!mapFile(imagepath, file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		getchar();
+		return false;
+	}
+	bool ok = decodeBMP((const unsigned char *)file.data, file.size, width, height, channels, data);
 
 	// Everything is in memory now, the file can be closed.
-	fclose (file);
+	unmapFile(file);
+	return ok;
+}
+
+GLuint loadBMP_custom(const char * imagepath){
+
+	// Actual RGB data
+	unsigned int width, height, channels;
+	std::vector<unsigned char> data;
+	if (!readBMP(imagepath, width, height, channels, data))
+		return 0;
+	return uploadBMP(width, height, channels, data);
+}
+
+GLuint uploadBMP(unsigned int width, unsigned int height, unsigned int channels, std::vector<unsigned char> & data){
+	GLenum internalFormat = channels == 4 ? GL_RGBA8 : GL_RGB8;
+	GLenum format = channels == 4 ? GL_RGBA : GL_RGB;
 
 	// Create one OpenGL texture
 	GLuint textureID;
 	glGenTextures(1, &textureID);
-	
+
 	// "Bind" the newly created texture : all future texture functions will modify this texture
 	glBindTexture(GL_TEXTURE_2D, textureID);
 
 	// Give the image to OpenGL
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
-
-	// OpenGL has now copied the data. Free our own version
-	delete [] data;
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, &data[0]);
 
 	// Poor filtering, or ...
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
+	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 
 	// ... nice trilinear filtering ...
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	// ... which requires mipmaps. Generate them automatically.
-	glGenerateMipmap(GL_TEXTURE_2D);
+	// ... which requires mipmaps. We compute them ourselves rather than with glGenerateMipmap(),
+	// which is slow with some drivers and gives different results with each of them.
+	std::vector<unsigned char> smaller;
+	for (GLint level=1; width > 1 || height > 1; level++){
+		downsampleImage(&data[0], width, height, channels, true, smaller);
+		data.swap(smaller);
+		width  = width  > 1 ? width  / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, &data[0]);
+	}
 
 	// Return the ID of the texture we just created
 	return textureID;
 }
 
+// sRGB <-> linear, with 16 bits linear values : enough to give back every sRGB value exactly
+struct SRGBTables{
+	unsigned short toLinear[256];
+	unsigned char toSRGB[65536];
+
+	SRGBTables(){
+		for (int i=0; i<256; i++)
+			toLinear[i] = (unsigned short)(sRGBToLinear(i / 255.0) * 65535.0 + 0.5);
+		// Each sRGB value covers the linear values from the middle between it and the previous one
+		unsigned int first = 0;
+		for (int i=0; i<256; i++){
+			unsigned int last = i == 255 ? 65536 : (unsigned int)ceil(sRGBToLinear((i + 0.5) / 255.0) * 65535.0);
+			for (unsigned int v=first; v<last && v<65536; v++)
+				toSRGB[v] = (unsigned char)i;
+			first = last;
+		}
+	}
+
+	static double sRGBToLinear(double c){
+		return c <= 0.04045 ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+	}
+};
+
+// One output row. "Channels" is a template parameter so that the loop over the channels is unrolled.
+// "next" is the offset of the second pixel of each pair : 0 if the image is 1 pixel wide.
+template <unsigned int Channels>
+static void downsampleRow(const SRGBTables & tables, const unsigned char * row0, const unsigned char * row1, unsigned int next,
+	unsigned char * dst, unsigned int newWidth, unsigned int colorChannels){
+	for (unsigned int x=0; x<newWidth; x++, row0 += 2 * Channels, row1 += 2 * Channels, dst += Channels){
+		for (unsigned int c=0; c<Channels; c++){
+			if (c < colorChannels){
+				unsigned int sum = tables.toLinear[row0[c]] + tables.toLinear[row0[next + c]] +
+				                   tables.toLinear[row1[c]] + tables.toLinear[row1[next + c]];
+				dst[c] = tables.toSRGB[(sum + 2) / 4];
+			}else{
+				unsigned int sum = row0[c] + row0[next + c] + row1[c] + row1[next + c];
+				dst[c] = (unsigned char)((sum + 2) / 4);
+			}
+		}
+	}
+}
+
+void downsampleImage(const unsigned char * pixels, unsigned int width, unsigned int height, unsigned int channels, bool sRGB,
+	std::vector<unsigned char> & out_pixels, unsigned int threadCount){
+	static const SRGBTables tables; // Built by the first call, in a thread-safe way
+
+	unsigned int newWidth  = width  > 1 ? width  / 2 : 1;
+	unsigned int newHeight = height > 1 ? height / 2 : 1;
+	out_pixels.resize((size_t)newWidth * newHeight * channels);
+	unsigned char * out = &out_pixels[0];
+
+	// Alpha isn't a color : it is always averaged as it is
+	unsigned int colorChannels = sRGB ? (channels == 4 ? 3 : channels) : 0;
+
+	// Starting a thread costs as much as filtering a few thousand pixels
+	if (threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	size_t maxThreads = (size_t)newWidth * newHeight / 16384;
+	if (threadCount > maxThreads) threadCount = (unsigned int)maxThreads;
+	if (threadCount > newHeight)  threadCount = newHeight;
+	if (threadCount < 1)          threadCount = 1;
+
+	runInParallel(threadCount, [&](size_t thread){
+		unsigned int firstRow = (unsigned int)(newHeight * thread / threadCount);
+		unsigned int lastRow  = (unsigned int)(newHeight * (thread + 1) / threadCount);
+		unsigned int next = width > 1 ? channels : 0;
+		for (unsigned int y=firstRow; y<lastRow; y++){
+			const unsigned char * row0 = pixels + (size_t)(2 * y) * width * channels;
+			const unsigned char * row1 = height > 1 ? row0 + (size_t)width * channels : row0;
+			unsigned char * dst = out + (size_t)y * newWidth * channels;
+			switch (channels){
+			case 1:  downsampleRow<1>(tables, row0, row1, next, dst, newWidth, colorChannels); break;
+			case 2:  downsampleRow<2>(tables, row0, row1, next, dst, newWidth, colorChannels); break;
+			case 3:  downsampleRow<3>(tables, row0, row1, next, dst, newWidth, colorChannels); break;
+			default: downsampleRow<4>(tables, row0, row1, next, dst, newWidth, colorChannels); break;
+			}
+		}
+	});
+}
+
+GLuint loadBMP_compressed(const char * imagepath, BlockFormat format){
+
+	unsigned int width, height, channels;
+	std::vector<unsigned char> pixels;
+	if (!readBMP(imagepath, width, height, channels, pixels))
+		return 0;
+
+	GLenum internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	if (format == BLOCK_FORMAT_BC3) internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	if (format == BLOCK_FORMAT_BC5) internalFormat = GL_COMPRESSED_RG_RGTC2;
+
+	// Create one OpenGL texture
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+
+	// glGenerateMipmap() can't fill compressed textures : compress each level ourselves.
+	// BC5 holds normals, not colors : they are averaged as they are.
+	std::vector<unsigned char> blocks, smaller;
+	for (GLint level=0; ; level++){
+		compressImage(&pixels[0], width, height, channels, format, blocks);
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, (GLsizei)blocks.size(), &blocks[0]);
+		if (width == 1 && height == 1)
+			break;
+		downsampleImage(&pixels[0], width, height, channels, format != BLOCK_FORMAT_BC5, smaller);
+		pixels.swap(smaller);
+		width  = width  > 1 ? width  / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+
+	// Nice trilinear filtering, like loadBMP_custom
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	return textureID;
+}
+
 // Since GLFW 3, glfwLoadTexture2D() has been removed. You have to use another texture loading library, 
 // or do it yourself (just like loadBMP_custom and loadDDS)
 //GLuint loadTGA_glfw(const char * imagepath){
@@ -120,66 +486,244 @@ GLuint loadBMP_custom(const char * imagepath){
 
 
 
+// loadDDS() maps the file in memory and gives the levels to OpenGL straight from the
+// mapping : nothing is read or copied before glCompressedTexImage*, which pages the
+// file in. The size of each level, cube face and array layer is computed from the
+// header, so the whole file is used, and checked, exactly.
+
+#define MAKE_FOURCC(a, b, c, d) ((unsigned int)(a) | ((unsigned int)(b) << 8) | ((unsigned int)(c) << 16) | ((unsigned int)(d) << 24))
+
 #define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
 #define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
 #define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+#define FOURCC_ATI1 MAKE_FOURCC('A', 'T', 'I', '1') // BC4, written by older tools
+#define FOURCC_BC4U MAKE_FOURCC('B', 'C', '4', 'U')
+#define FOURCC_BC4S MAKE_FOURCC('B', 'C', '4', 'S')
+#define FOURCC_ATI2 MAKE_FOURCC('A', 'T', 'I', '2') // BC5, written by older tools
+#define FOURCC_BC5U MAKE_FOURCC('B', 'C', '5', 'U')
+#define FOURCC_BC5S MAKE_FOURCC('B', 'C', '5', 'S')
+#define FOURCC_DX10 MAKE_FOURCC('D', 'X', '1', '0') // The format is in the DX10 header
+
+// Offsets in the 124 bytes header, and the flags we need
+#define DDS_HEADER_SIZE       124
+#define DDS_DX10_HEADER_SIZE  20
+#define DDSD_MIPMAPCOUNT      0x20000
+#define DDPF_ALPHAPIXELS      0x1
+#define DDPF_FOURCC           0x4
+#define DDPF_RGB              0x40
+#define DDSCAPS2_CUBEMAP      0x200
+#define DDSCAPS2_ALLFACES     0xFC00
+#define DDSCAPS2_VOLUME       0x200000
+#define DDS_DIMENSION_TEXTURE2D 3
+#define DDS_MISC_TEXTURECUBE  0x4
+
+// The DXGI_FORMAT values of the DX10 header that we can load
+#define DXGI_FORMAT_R8G8B8A8_UNORM      28
+#define DXGI_FORMAT_R8G8B8A8_UNORM_SRGB 29
+#define DXGI_FORMAT_BC1_UNORM           71
+#define DXGI_FORMAT_BC1_UNORM_SRGB      72
+#define DXGI_FORMAT_BC2_UNORM           74
+#define DXGI_FORMAT_BC2_UNORM_SRGB      75
+#define DXGI_FORMAT_BC3_UNORM           77
+#define DXGI_FORMAT_BC3_UNORM_SRGB      78
+#define DXGI_FORMAT_BC4_UNORM           80
+#define DXGI_FORMAT_BC4_SNORM           81
+#define DXGI_FORMAT_BC5_UNORM           83
+#define DXGI_FORMAT_BC5_SNORM           84
+#define DXGI_FORMAT_B8G8R8A8_UNORM      87
+#define DXGI_FORMAT_B8G8R8A8_UNORM_SRGB 91
+#define DXGI_FORMAT_BC6H_UF16           95
+#define DXGI_FORMAT_BC6H_SF16           96
+#define DXGI_FORMAT_BC7_UNORM           98
+#define DXGI_FORMAT_BC7_UNORM_SRGB      99
+
+static void setCompressedFormat(DDSImage & image, GLenum internalFormat, unsigned int blockSize){
+	image.internalFormat = internalFormat;
+	image.format = 0;
+	image.type = 0;
+	image.blockSize = blockSize;
+}
 
-GLuint loadDDS(const char * imagepath){
+static void setUncompressedFormat(DDSImage & image, GLenum internalFormat, GLenum format){
+	image.internalFormat = internalFormat;
+	image.format = format;
+	image.type = GL_UNSIGNED_BYTE;
+	image.blockSize = 4;
+}
 
-	unsigned char header[124];
+static bool setDXGIFormat(DDSImage & image, unsigned int dxgiFormat){
+	switch (dxgiFormat){
+	case DXGI_FORMAT_BC1_UNORM:           setCompressedFormat(image, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8); break;
+	case DXGI_FORMAT_BC1_UNORM_SRGB:      setCompressedFormat(image, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8); break;
+	case DXGI_FORMAT_BC2_UNORM:           setCompressedFormat(image, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16); break;
+	case DXGI_FORMAT_BC2_UNORM_SRGB:      setCompressedFormat(image, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 16); break;
+	case DXGI_FORMAT_BC3_UNORM:           setCompressedFormat(image, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16); break;
+	case DXGI_FORMAT_BC3_UNORM_SRGB:      setCompressedFormat(image, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16); break;
+	case DXGI_FORMAT_BC4_UNORM:           setCompressedFormat(image, GL_COMPRESSED_RED_RGTC1, 8); break;
+	case DXGI_FORMAT_BC4_SNORM:           setCompressedFormat(image, GL_COMPRESSED_SIGNED_RED_RGTC1, 8); break;
+	case DXGI_FORMAT_BC5_UNORM:           setCompressedFormat(image, GL_COMPRESSED_RG_RGTC2, 16); break;
+	case DXGI_FORMAT_BC5_SNORM:           setCompressedFormat(image, GL_COMPRESSED_SIGNED_RG_RGTC2, 16); break;
+	case DXGI_FORMAT_BC6H_UF16:           setCompressedFormat(image, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB, 16); break;
+	case DXGI_FORMAT_BC6H_SF16:           setCompressedFormat(image, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB, 16); break;
+	case DXGI_FORMAT_BC7_UNORM:           setCompressedFormat(image, GL_COMPRESSED_RGBA_BPTC_UNORM_ARB, 16); break;
+	case DXGI_FORMAT_BC7_UNORM_SRGB:      setCompressedFormat(image, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB, 16); break;
+	case DXGI_FORMAT_R8G8B8A8_UNORM:      setUncompressedFormat(image, GL_RGBA8, GL_RGBA); break;
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: setUncompressedFormat(image, GL_SRGB8_ALPHA8, GL_RGBA); break;
+	case DXGI_FORMAT_B8G8R8A8_UNORM:      setUncompressedFormat(image, GL_RGBA8, GL_BGRA); break;
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB: setUncompressedFormat(image, GL_SRGB8_ALPHA8, GL_BGRA); break;
+	default:
+		return false;
+	}
+	return true;
+}
 
-	FILE *fp; 
- 
-	/* try to open the file */ 
-	fp = fopen(imagepath, "rb"); 
-	if (fp == NULL){
-		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
+// Formats without the DX10 header : a FourCC, or 32 bits per pixel with masks
+static bool setLegacyFormat(DDSImage & image, const unsigned char * pixelFormat){
+	unsigned int flags  = readUint32(pixelFormat + 4);
+	unsigned int fourCC = readUint32(pixelFormat + 8);
+	if (flags & DDPF_FOURCC){
+		switch (fourCC){
+		case FOURCC_DXT1: setCompressedFormat(image, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8); break;
+		case FOURCC_DXT3: setCompressedFormat(image, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16); break;
+		case FOURCC_DXT5: setCompressedFormat(image, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16); break;
+		case FOURCC_ATI1:
+		case FOURCC_BC4U: setCompressedFormat(image, GL_COMPRESSED_RED_RGTC1, 8); break;
+		case FOURCC_BC4S: setCompressedFormat(image, GL_COMPRESSED_SIGNED_RED_RGTC1, 8); break;
+		case FOURCC_ATI2:
+		case FOURCC_BC5U: setCompressedFormat(image, GL_COMPRESSED_RG_RGTC2, 16); break;
+		case FOURCC_BC5S: setCompressedFormat(image, GL_COMPRESSED_SIGNED_RG_RGTC2, 16); break;
+		default:
+			return false;
+		}
+		return true;
+	}
+	unsigned int bitCount = readUint32(pixelFormat + 12);
+	unsigned int redMask  = readUint32(pixelFormat + 16);
+	unsigned int blueMask = readUint32(pixelFormat + 24);
+	if (!(flags & DDPF_RGB) || bitCount != 32)
+		return false;
+	GLenum internalFormat = (flags & DDPF_ALPHAPIXELS) ? GL_RGBA8 : GL_RGB8;
+	if (redMask == 0x000000FF && blueMask == 0x00FF0000)
+		setUncompressedFormat(image, internalFormat, GL_RGBA);
+	else if (redMask == 0x00FF0000 && blueMask == 0x000000FF)
+		setUncompressedFormat(image, internalFormat, GL_BGRA);
+	else
+		return false;
+	return true;
+}
+
+size_t getDDSLevelSize(const DDSImage & image, unsigned int level){
+	size_t width  = image.width  >> level;
+	size_t height = image.height >> level;
+	if (width  < 1) width  = 1;
+	if (height < 1) height = 1;
+	if (image.format != 0)
+		return width * height * image.blockSize;
+	return ((width + 3) / 4) * ((height + 3) / 4) * image.blockSize;
+}
+
+bool parseDDS(const unsigned char * file, size_t fileSize, DDSImage & out_image){
+
+	if (fileSize < 4 + DDS_HEADER_SIZE || memcmp(file, "DDS ", 4) != 0){
+		printf("Not a correct DDS file\n");
+		return false;
+	}
+	const unsigned char * header = file + 4;
+	unsigned int flags       = readUint32(header + 4);
+	unsigned int height      = readUint32(header + 8);
+	unsigned int width       = readUint32(header + 12);
+	unsigned int mipMapCount = readUint32(header + 24);
+	unsigned int caps2       = readUint32(header + 108);
+	const unsigned char * pixelFormat = header + 72;
+
+	DDSImage & image = out_image;
+	image.width = width;
+	image.height = height;
+	image.layerCount = 1;
+	image.faceCount = 1;
+	size_t dataOffset = 4 + DDS_HEADER_SIZE;
+	bool isArray = false;
+
+	if ((readUint32(pixelFormat + 4) & DDPF_FOURCC) && readUint32(pixelFormat + 8) == FOURCC_DX10){
+		if (fileSize < dataOffset + DDS_DX10_HEADER_SIZE){
+			printf("Not a correct DDS file\n");
+			return false;
+		}
+		const unsigned char * dx10 = file + dataOffset;
+		dataOffset += DDS_DX10_HEADER_SIZE;
+		unsigned int dxgiFormat = readUint32(dx10);
+		if (readUint32(dx10 + 4) != DDS_DIMENSION_TEXTURE2D){
+			printf("Only 2D DDS textures are supported\n");
+			return false;
+		}
+		if (!setDXGIFormat(image, dxgiFormat)){
+			printf("Unsupported DDS format (DXGI_FORMAT %u)\n", dxgiFormat);
+			return false;
+		}
+		if (readUint32(dx10 + 8) & DDS_MISC_TEXTURECUBE)
+			image.faceCount = 6;
+		image.layerCount = readUint32(dx10 + 12);
+		isArray = image.layerCount > 1;
+	}else{
+		if (caps2 & DDSCAPS2_VOLUME){
+			printf("Only 2D DDS textures are supported\n");
+			return false;
+		}
+		if (caps2 & DDSCAPS2_CUBEMAP){
+			if ((caps2 & DDSCAPS2_ALLFACES) != DDSCAPS2_ALLFACES){
+				printf("Cube maps without all 6 faces are not supported\n");
+				return false;
+			}
+			image.faceCount = 6;
+		}
+		if (!setLegacyFormat(image, pixelFormat)){
+			printf("Unsupported DDS format\n");
+			return false;
+		}
+	}
+	if (width == 0 || height == 0 || image.layerCount == 0 || width > 65536 || height > 65536 || image.layerCount > 65536){
+		printf("Not a correct DDS file\n");
+		return false;
+	}
+
+	// The full chain goes down to 1x1. Some writers leave mipMapCount at 0 when there is only one level.
+	unsigned int fullChain = 1;
+	while ((width | height) >> fullChain)
+		fullChain++;
+	image.mipCount = (flags & DDSD_MIPMAPCOUNT) && mipMapCount > 0 ? mipMapCount : 1;
+	if (image.mipCount > fullChain)
+		image.mipCount = fullChain;
+
+	if (image.faceCount == 6)
+		image.target = isArray ? GL_TEXTURE_CUBE_MAP_ARRAY : GL_TEXTURE_CUBE_MAP;
+	else
+		image.target = isArray ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+
+	// Each layer holds its faces, and each face its whole mip chain
+	unsigned long long chainSize = 0;
+	for (unsigned int level = 0; level < image.mipCount; level++)
+		chainSize += getDDSLevelSize(image, level);
+	unsigned long long size = chainSize * image.faceCount * image.layerCount;
+	if (size > fileSize - dataOffset){
+		printf("DDS file is too short : %llu bytes of texture data are missing\n", size - (fileSize - dataOffset));
+		return false;
+	}
+	image.data = file + dataOffset;
+	image.size = (size_t)size;
+	return true;
+}
+
+GLuint uploadDDS(const DDSImage & image){
+
+	if (image.target == GL_TEXTURE_CUBE_MAP_ARRAY && !(GLEW_VERSION_4_0 || GLEW_ARB_texture_cube_map_array)){
+		printf("Cube map arrays need OpenGL 4.0\n");
 		return 0;
 	}
-   
-	/* verify the type of file */ 
-	char filecode[4]; 
-	fread(filecode, 1, 4, fp); 
-	if (strncmp(filecode, "DDS ", 4) != 0) { 
-		fclose(fp); 
-		return 0; 
-	}
-	
-	/* get the surface desc */ 
-	fread(&header, 124, 1, fp); 
-
-	unsigned int height      = *(unsigned int*)&(header[8 ]);
-	unsigned int width	     = *(unsigned int*)&(header[12]);
-	unsigned int linearSize	 = *(unsigned int*)&(header[16]);
-	unsigned int mipMapCount = *(unsigned int*)&(header[24]);
-	unsigned int fourCC      = *(unsigned int*)&(header[80]);
-
- 
-	unsigned char * buffer;
-	unsigned int bufsize;
-	/* how big is it going to be including all mipmaps? */ 
-	bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize; 
-	buffer = (unsigned char*)malloc(bufsize * sizeof(unsigned char)); 
-	fread(buffer, 1, bufsize, fp); 
-	/* close the file pointer */ 
-	fclose(fp);
-
-	unsigned int components  = (fourCC == FOURCC_DXT1) ? 3 : 4; 
-	unsigned int format;
-	switch(fourCC) 
-	{ 
-	case FOURCC_DXT1: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; 
-		break; 
-	case FOURCC_DXT3: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT; 
-		break; 
-	case FOURCC_DXT5: 
-		format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; 
-		break; 
-	default: 
-		free(buffer); 
-		return 0; 
+	if ((image.internalFormat == GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT_ARB || image.internalFormat == GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT_ARB ||
+	     image.internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM_ARB || image.internalFormat == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM_ARB) &&
+	    !(GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc)){
+		printf("BC6H and BC7 textures need OpenGL 4.2 or ARB_texture_compression_bptc\n");
+		return 0;
 	}
 
 	// Create one OpenGL texture
@@ -187,32 +731,75 @@ GLuint loadDDS(const char * imagepath){
 	glGenTextures(1, &textureID);
 
 	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, textureID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT,1);	
-	
-	unsigned int blockSize = (format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16; 
-	unsigned int offset = 0;
-
-	/* load the mipmaps */ 
-	for (unsigned int level = 0; level < mipMapCount && (width || height); ++level) 
-	{ 
-		unsigned int size = ((width+3)/4)*((height+3)/4)*blockSize; 
-		glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height,  
-			0, size, buffer + offset); 
-	 
-		offset += size; 
-		width  /= 2; 
-		height /= 2; 
-
-		// Deal with Non-Power-Of-Two textures. This code is not included in the webpage to reduce clutter.
-		if(width < 1) width = 1;
-		if(height < 1) height = 1;
-
-	} 
-
-	free(buffer); 
+	glBindTexture(image.target, textureID);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+
+	const bool compressed = (image.format == 0);
+	const unsigned char * data = image.data;
+
+	if (image.target == GL_TEXTURE_2D || image.target == GL_TEXTURE_CUBE_MAP){
+		for (unsigned int face = 0; face < image.faceCount; face++){
+			GLenum faceTarget = (image.target == GL_TEXTURE_CUBE_MAP) ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : GL_TEXTURE_2D;
+			for (unsigned int level = 0; level < image.mipCount; level++){
+				GLsizei width  = image.width  >> level ? image.width  >> level : 1;
+				GLsizei height = image.height >> level ? image.height >> level : 1;
+				size_t size = getDDSLevelSize(image, level);
+				if (compressed)
+					glCompressedTexImage2D(faceTarget, level, image.internalFormat, width, height, 0, (GLsizei)size, data);
+				else
+					glTexImage2D(faceTarget, level, image.internalFormat, width, height, 0, image.format, image.type, data);
+				data += size;
+			}
+		}
+	}else{
+		// Arrays : the file is layer by layer, OpenGL wants level by level. Allocate
+		// the levels first, then give each slice from where it is in the file.
+		GLsizei depth = (GLsizei)(image.layerCount * image.faceCount);
+		for (unsigned int level = 0; level < image.mipCount; level++){
+			GLsizei width  = image.width  >> level ? image.width  >> level : 1;
+			GLsizei height = image.height >> level ? image.height >> level : 1;
+			size_t size = getDDSLevelSize(image, level);
+			if (compressed)
+				glCompressedTexImage3D(image.target, level, image.internalFormat, width, height, depth, 0, (GLsizei)(size * depth), NULL);
+			else
+				glTexImage3D(image.target, level, image.internalFormat, width, height, depth, 0, image.format, image.type, NULL);
+		}
+		for (GLsizei slice = 0; slice < depth; slice++){
+			for (unsigned int level = 0; level < image.mipCount; level++){
+				GLsizei width  = image.width  >> level ? image.width  >> level : 1;
+				GLsizei height = image.height >> level ? image.height >> level : 1;
+				size_t size = getDDSLevelSize(image, level);
+				if (compressed)
+					glCompressedTexSubImage3D(image.target, level, 0, 0, slice, width, height, 1, image.internalFormat, (GLsizei)size, data);
+				else
+					glTexSubImage3D(image.target, level, 0, 0, slice, width, height, 1, image.format, image.type, data);
+				data += size;
+			}
+		}
+	}
+
+	// Files with only a part of the mip chain are still complete textures
+	glTexParameteri(image.target, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(image.target, GL_TEXTURE_MAX_LEVEL, image.mipCount - 1);
 
 	return textureID;
+}
+
+GLuint loadDDS(const char * imagepath){
 
+	MappedFile file;
+	if (!mapFile(imagepath, file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath); getchar(); 
+		return 0;
+	}
 
-}
\ No newline at end of file
+	DDSImage image;
+	GLuint textureID = 0;
+	if (parseDDS((const unsigned char *)file.data, file.size, image))
+		textureID = uploadDDS(image);
+	else
+		printf("%s can't be loaded\n", imagepath);
+
+	unmapFile(file);
+	return textureID;
+}
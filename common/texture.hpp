@@ -1,16 +1,72 @@
 #ifndef TEXTURE_HPP
 #define TEXTURE_HPP
 
-// Load a .BMP file using our custom loader
+#include "texturecompression.hpp"
+
+// Load a .BMP file using our custom loader. The mipmaps are computed on the CPU, with downsampleImage().
 GLuint loadBMP_custom(const char * imagepath);
 
+// Reads a .BMP file without creating a texture : 24 and 32 bits, 1, 4 and 8 bits with a
+// palette, RLE4 and RLE8, bottom-up or top-down. "data" gets width*height pixels of
+// "channels" bytes : RGBA for 32 bits files (alpha is 255 if the file has none), RGB
+// for the others. There is no padding, and the bottom row is first, as in OpenGL.
+bool readBMP(const char * imagepath, unsigned int & width, unsigned int & height, unsigned int & channels, std::vector<unsigned char> & data);
+
+// Same as readBMP(), for a .BMP file that is already in memory.
+bool decodeBMP(const unsigned char * file, size_t fileSize, unsigned int & width, unsigned int & height, unsigned int & channels, std::vector<unsigned char> & data);
+
+// Creates the texture of an image read by readBMP(), as loadBMP_custom() does.
+// The mipmaps are computed in "data", which doesn't hold the image anymore afterwards.
+GLuint uploadBMP(unsigned int width, unsigned int height, unsigned int channels, std::vector<unsigned char> & data);
+
+// Next mip level of an image : the average of each 2x2 pixels. Odd sizes are rounded
+// down, as OpenGL does for the sizes of the levels : the last row or column is left out.
+// With sRGB, the colors are averaged as light intensities, not as sRGB values, so that
+// the smaller levels don't get darker. The 4th channel (alpha) is always averaged as it is.
+// The rows are shared between threadCount threads (0 : one per core).
+void downsampleImage(const unsigned char * pixels, unsigned int width, unsigned int height, unsigned int channels, bool sRGB,
+	std::vector<unsigned char> & out_pixels, unsigned int threadCount = 0);
+
+// Load a .BMP file, and compress it and its mipmaps on the CPU (see texturecompression.hpp).
+// BC1 takes 1/6 of the memory of loadBMP_custom(). BC5 keeps only red and green, for normal maps.
+GLuint loadBMP_compressed(const char * imagepath, BlockFormat format);
+
 //// Since GLFW 3, glfwLoadTexture2D() has been removed. You have to use another texture loading library, 
 //// or do it yourself (just like loadBMP_custom and loadDDS)
 //// Load a .TGA file using GLFW's own loader
 //GLuint loadTGA_glfw(const char * imagepath);
 
-// Load a .DDS file using GLFW's own loader
+// Load a .DDS file : DXT1/3/5 (BC1-3), BC4, BC5, BC6H, BC7 and 32 bits RGBA, with the
+// DX10 header or without. Cube maps and texture arrays give GL_TEXTURE_CUBE_MAP,
+// GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP_ARRAY textures instead of GL_TEXTURE_2D.
 GLuint loadDDS(const char * imagepath);
 
+// The layout of a .DDS file, found by parseDDS(). "data" points in the file, which
+// holds each array layer one after the other, each cube face of a layer one after
+// the other, and the mip levels of each face from the biggest one.
+struct DDSImage{
+	GLenum target;           // GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_2D_ARRAY or GL_TEXTURE_CUBE_MAP_ARRAY
+	GLenum internalFormat;
+	GLenum format, type;     // For glTexImage2D() ; 0 when the image is compressed
+	unsigned int blockSize;  // Bytes per 4x4 block when compressed, per pixel otherwise
+	unsigned int width, height;
+	unsigned int mipCount;
+	unsigned int layerCount; // 1 if the texture isn't an array
+	unsigned int faceCount;  // 6 for cube maps, 1 otherwise
+	const unsigned char * data;
+	size_t size;             // All the levels of all the faces and layers
+};
+
+// Reads the headers of a .DDS file that is in memory. Returns false if the format
+// isn't supported or the file is too short for what its header announces.
+bool parseDDS(const unsigned char * file, size_t fileSize, DDSImage & out_image);
+
+// Bytes of one mip level of one face of one layer
+size_t getDDSLevelSize(const DDSImage & image, unsigned int level);
+
+// Creates the texture of a .DDS file read by parseDDS(), with all its levels.
+// "image.data" is only read during the call.
+GLuint uploadDDS(const DDSImage & image);
+
 
 #endif
\ No newline at end of file
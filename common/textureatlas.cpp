@@ -0,0 +1,397 @@
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include "file_utils.hpp"
+#include "texture.hpp"
+#include "textureatlas.hpp"
+
+void initSkylinePacker(SkylinePacker & packer, unsigned int width, unsigned int height){
+	packer.width = width;
+	packer.height = height;
+	packer.nodes.clear();
+	SkylineNode node = { 0, 0, width };
+	packer.nodes.push_back(node);
+}
+
+// Height of the skyline under a rectangle that starts on node i, or false if it goes out
+static bool getSkylineTop(const SkylinePacker & packer, size_t i, unsigned int width, unsigned int & out_y){
+	if (packer.nodes[i].x + width > packer.width)
+		return false;
+	unsigned int y = 0;
+	unsigned int covered = 0;
+	for (size_t j=i; covered < width; j++){
+		y = std::max(y, packer.nodes[j].y);
+		covered += packer.nodes[j].width;
+	}
+	out_y = y;
+	return true;
+}
+
+bool addSkylineRectangle(SkylinePacker & packer, unsigned int width, unsigned int height, unsigned int & out_x, unsigned int & out_y){
+	std::vector<SkylineNode> & nodes = packer.nodes;
+	if (width == 0 || height == 0 || width > packer.width || height > packer.height)
+		return false;
+
+	// The lowest top, then the narrowest segment, to leave the wide ones to the big rectangles
+	size_t best = nodes.size();
+	unsigned int bestTop = 0, bestWidth = 0, bestY = 0;
+	for (size_t i=0; i<nodes.size(); i++){
+		unsigned int y;
+		if (!getSkylineTop(packer, i, width, y))
+			break; // The nodes after this one are further right
+		if (y + height > packer.height)
+			continue;
+		if (best == nodes.size() || y + height < bestTop || (y + height == bestTop && nodes[i].width < bestWidth)){
+			best = i;
+			bestTop = y + height;
+			bestWidth = nodes[i].width;
+			bestY = y;
+		}
+	}
+	if (best == nodes.size())
+		return false;
+	out_x = nodes[best].x;
+	out_y = bestY;
+
+	// The rectangle becomes a segment of the skyline, and hides what is under it
+	SkylineNode node = { out_x, bestTop, width };
+	nodes.insert(nodes.begin() + best, node);
+	unsigned int end = out_x + width;
+	size_t i = best + 1;
+	while (i < nodes.size() && nodes[i].x < end){
+		unsigned int nodeEnd = nodes[i].x + nodes[i].width;
+		if (nodeEnd <= end){
+			nodes.erase(nodes.begin() + i);
+		}else{
+			nodes[i].width = nodeEnd - end;
+			nodes[i].x = end;
+			break;
+		}
+	}
+	// Neighbours at the same height make one segment
+	for (size_t j=0; j + 1 < nodes.size(); ){
+		if (nodes[j].y == nodes[j+1].y){
+			nodes[j].width += nodes[j+1].width;
+			nodes.erase(nodes.begin() + j + 1);
+		}else{
+			j++;
+		}
+	}
+	return true;
+}
+
+struct AtlasSource{
+	size_t index; // In "paths"
+	MappedFile file;
+	DDSImage image;
+	unsigned int x, y; // In the atlas, padding included
+};
+
+// Start of a mip level in the .DDS data
+static const unsigned char * getLevelData(const DDSImage & image, unsigned int level){
+	const unsigned char * data = image.data;
+	for (unsigned int l=0; l<level; l++)
+		data += getDDSLevelSize(image, l);
+	return data;
+}
+
+// Pixels per block : 4 for compressed formats, 1 otherwise
+static unsigned int getBlockDimension(const DDSImage & image){
+	return image.format == 0 ? 4 : 1;
+}
+
+static void setAtlasFiltering(GLenum target, unsigned int mipCount){
+	glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, mipCount - 1);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, mipCount > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+}
+
+static void uploadLevel(GLenum target, const DDSImage & format, unsigned int level, unsigned int width, unsigned int height, unsigned int layers, const std::vector<unsigned char> & data){
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	if (target == GL_TEXTURE_2D_ARRAY){
+		if (format.format == 0)
+			glCompressedTexImage3D(target, level, format.internalFormat, width, height, layers, 0, (GLsizei)data.size(), &data[0]);
+		else
+			glTexImage3D(target, level, format.internalFormat, width, height, layers, 0, format.format, format.type, &data[0]);
+	}else{
+		if (format.format == 0)
+			glCompressedTexImage2D(target, level, format.internalFormat, width, height, 0, (GLsizei)data.size(), &data[0]);
+		else
+			glTexImage2D(target, level, format.internalFormat, width, height, 0, format.format, format.type, &data[0]);
+	}
+}
+
+// One GL_TEXTURE_2D_ARRAY from files of the same size and format
+static void buildArray(const std::vector<AtlasSource *> & layers, std::vector<TextureAtlas> & out_atlases, std::vector<AtlasPlacement> & out_placements){
+	const DDSImage & first = layers[0]->image;
+	unsigned int mipCount = first.mipCount;
+	for (size_t i=0; i<layers.size(); i++)
+		mipCount = std::min(mipCount, layers[i]->image.mipCount);
+
+	TextureAtlas atlas;
+	glGenTextures(1, &atlas.texture);
+	atlas.target = GL_TEXTURE_2D_ARRAY;
+	atlas.width = first.width;
+	atlas.height = first.height;
+	atlas.layerCount = (unsigned int)layers.size();
+	atlas.mipCount = mipCount;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, atlas.texture);
+
+	// The layers of each level one after the other
+	std::vector<unsigned char> data;
+	for (unsigned int level=0; level<mipCount; level++){
+		size_t size = getDDSLevelSize(first, level);
+		data.resize(size * layers.size());
+		for (size_t i=0; i<layers.size(); i++)
+			memcpy(&data[size * i], getLevelData(layers[i]->image, level), size);
+		unsigned int width  = std::max(first.width  >> level, 1u);
+		unsigned int height = std::max(first.height >> level, 1u);
+		uploadLevel(GL_TEXTURE_2D_ARRAY, first, level, width, height, atlas.layerCount, data);
+	}
+	setAtlasFiltering(GL_TEXTURE_2D_ARRAY, mipCount);
+
+	for (size_t i=0; i<layers.size(); i++){
+		AtlasPlacement & placement = out_placements[layers[i]->index];
+		placement.atlas = (int)out_atlases.size();
+		placement.layer = (unsigned int)i;
+	}
+	out_atlases.push_back(atlas);
+}
+
+// Copies each file in its place, for each level, with its opposite edges around it
+static void fillAtlasLevel(const std::vector<AtlasSource *> & sources, unsigned int level, unsigned int padding,
+	unsigned int atlasWidth, unsigned int atlasHeight, std::vector<unsigned char> & data){
+	const DDSImage & format = sources[0]->image;
+	unsigned int blockDimension = getBlockDimension(format);
+	unsigned int blockSize = format.blockSize;
+	size_t rowBlocks = (atlasWidth >> level) / blockDimension;
+	data.assign(rowBlocks * ((atlasHeight >> level) / blockDimension) * blockSize, 0);
+
+	int border = (int)((padding >> level) / blockDimension); // In blocks
+	for (size_t s=0; s<sources.size(); s++){
+		const AtlasSource & source = *sources[s];
+		const unsigned char * levelData = getLevelData(source.image, level);
+		int blocksX = (int)((source.image.width  >> level) / blockDimension);
+		int blocksY = (int)((source.image.height >> level) / blockDimension);
+		size_t startX = ((source.x >> level) / blockDimension);
+		size_t startY = ((source.y >> level) / blockDimension);
+		for (int y=-border; y<blocksY+border; y++){
+			int srcY = ((y % blocksY) + blocksY) % blocksY;
+			const unsigned char * srcRow = levelData + (size_t)srcY * blocksX * blockSize;
+			unsigned char * dstRow = &data[((startY + border + y) * rowBlocks + startX) * blockSize];
+			memcpy(dstRow + (size_t)border * blockSize, srcRow, (size_t)blocksX * blockSize);
+			for (int x=0; x<border; x++){
+				int left = ((x - border) % blocksX + blocksX) % blocksX;
+				int right = x % blocksX;
+				memcpy(dstRow + (size_t)x * blockSize, srcRow + (size_t)left * blockSize, blockSize);
+				memcpy(dstRow + (size_t)(border + blocksX + x) * blockSize, srcRow + (size_t)right * blockSize, blockSize);
+			}
+		}
+	}
+}
+
+struct ByHeight{
+	bool operator()(const AtlasSource * a, const AtlasSource * b) const {
+		if (a->image.height != b->image.height)
+			return a->image.height > b->image.height;
+		return a->image.width > b->image.width;
+	}
+};
+
+// Atlases from files of the same format
+static void buildAtlases(std::vector<AtlasSource *> sources, unsigned int maxSize, unsigned int padding,
+	std::vector<TextureAtlas> & out_atlases, std::vector<AtlasPlacement> & out_placements){
+	const DDSImage & format = sources[0]->image;
+	unsigned int blockDimension = getBlockDimension(format);
+
+	// The levels where every file is still made of whole blocks, and still has at least
+	// one block of padding around it
+	padding = std::max(padding, blockDimension);
+	unsigned int mipCount = 1;
+	while ((padding >> mipCount) >= blockDimension)
+		mipCount++;
+	for (size_t i=0; i<sources.size(); i++){
+		const DDSImage & image = sources[i]->image;
+		unsigned int levels = 0;
+		while (levels < image.mipCount && (image.width % (blockDimension << levels)) == 0 && (image.height % (blockDimension << levels)) == 0)
+			levels++;
+		mipCount = std::min(mipCount, std::max(levels, 1u));
+	}
+	// Positions and padding are multiples of a block of the smallest level
+	unsigned int unit = blockDimension << (mipCount - 1);
+	padding = (padding + unit - 1) / unit * unit;
+	maxSize = std::max(maxSize / unit * unit, unit);
+
+	std::sort(sources.begin(), sources.end(), ByHeight());
+	while (!sources.empty()){
+		// The smallest power of two that could hold everything, then bigger ones
+		unsigned long long area = 0;
+		unsigned int biggest = unit;
+		for (size_t i=0; i<sources.size(); i++){
+			unsigned int w = sources[i]->image.width + 2 * padding;
+			unsigned int h = sources[i]->image.height + 2 * padding;
+			area += (unsigned long long)w * h;
+			biggest = std::max(biggest, std::max(w, h));
+		}
+		unsigned int width = unit;
+		while (width < biggest || (unsigned long long)width * width < area)
+			width *= 2;
+		unsigned int height = width;
+		width = std::min(width, maxSize);
+		height = std::min(height, maxSize);
+
+		std::vector<AtlasSource *> placed, left;
+		while (true){
+			SkylinePacker packer;
+			initSkylinePacker(packer, width / unit, height / unit);
+			placed.clear();
+			left.clear();
+			for (size_t i=0; i<sources.size(); i++){
+				unsigned int x, y;
+				unsigned int w = (sources[i]->image.width  + 2 * padding) / unit;
+				unsigned int h = (sources[i]->image.height + 2 * padding) / unit;
+				if (addSkylineRectangle(packer, w, h, x, y)){
+					sources[i]->x = x * unit;
+					sources[i]->y = y * unit;
+					placed.push_back(sources[i]);
+				}else{
+					left.push_back(sources[i]);
+				}
+			}
+			if (left.empty() || (width >= maxSize && height >= maxSize))
+				break;
+			// Too small : grow, and start again. maxSize may not be a power of two.
+			if (width <= height && width < maxSize)
+				width = std::min(width * 2, maxSize);
+			else
+				height = std::min(height * 2, maxSize);
+		}
+		if (placed.empty()){
+			for (size_t i=0; i<left.size(); i++)
+				printf("Texture %u is too big for a %ux%u atlas\n", (unsigned int)left[i]->index, maxSize, maxSize);
+			break;
+		}
+
+		TextureAtlas atlas;
+		glGenTextures(1, &atlas.texture);
+		atlas.target = GL_TEXTURE_2D;
+		atlas.width = width;
+		atlas.height = height;
+		atlas.layerCount = 1;
+		atlas.mipCount = mipCount;
+		glBindTexture(GL_TEXTURE_2D, atlas.texture);
+		std::vector<unsigned char> data;
+		for (unsigned int level=0; level<mipCount; level++){
+			fillAtlasLevel(placed, level, padding, width, height, data);
+			uploadLevel(GL_TEXTURE_2D, format, level, width >> level, height >> level, 1, data);
+		}
+		setAtlasFiltering(GL_TEXTURE_2D, mipCount);
+
+		for (size_t i=0; i<placed.size(); i++){
+			AtlasPlacement & placement = out_placements[placed[i]->index];
+			placement.atlas = (int)out_atlases.size();
+			placement.layer = 0;
+			placement.uvScale[0]  = (float)placed[i]->image.width  / width;
+			placement.uvScale[1]  = (float)placed[i]->image.height / height;
+			placement.uvOffset[0] = (float)(placed[i]->x + padding) / width;
+			placement.uvOffset[1] = (float)(placed[i]->y + padding) / height;
+		}
+		out_atlases.push_back(atlas);
+		sources.swap(left);
+	}
+}
+
+struct ByFormat{
+	bool useArrays;
+	bool operator()(const AtlasSource * a, const AtlasSource * b) const {
+		if (a->image.internalFormat != b->image.internalFormat)
+			return a->image.internalFormat < b->image.internalFormat;
+		if (useArrays && a->image.width != b->image.width)
+			return a->image.width < b->image.width;
+		if (useArrays && a->image.height != b->image.height)
+			return a->image.height < b->image.height;
+		return a->index < b->index;
+	}
+};
+
+bool buildTextureAtlases(
+	const std::vector<std::string> & paths,
+	bool useArrays,
+	unsigned int maxSize,
+	unsigned int padding,
+	std::vector<TextureAtlas> & out_atlases,
+	std::vector<AtlasPlacement> & out_placements
+){
+	out_placements.resize(paths.size());
+	for (size_t i=0; i<paths.size(); i++){
+		AtlasPlacement & placement = out_placements[i];
+		placement.atlas = -1;
+		placement.layer = 0;
+		placement.uvScale[0] = placement.uvScale[1] = 1.0f;
+		placement.uvOffset[0] = placement.uvOffset[1] = 0.0f;
+	}
+
+	// The files stay mapped until everything is uploaded
+	std::vector<AtlasSource> sources(paths.size());
+	std::vector<AtlasSource *> loaded;
+	for (size_t i=0; i<paths.size(); i++){
+		AtlasSource & source = sources[i];
+		source.index = i;
+		if (!mapFile(paths[i].c_str(), source.file)){
+			printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", paths[i].c_str());
+			continue;
+		}
+		if (!parseDDS((const unsigned char *)source.file.data, source.file.size, source.image)){
+			printf("%s can't be loaded\n", paths[i].c_str());
+			continue;
+		}
+		if (source.image.target != GL_TEXTURE_2D){
+			printf("%s : only 2D textures can go in an atlas\n", paths[i].c_str());
+			continue;
+		}
+		loaded.push_back(&source);
+	}
+
+	GLint maxLayers = 256;
+	if (useArrays)
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+	// Groups of files that can share a texture
+	ByFormat byFormat = { useArrays };
+	std::sort(loaded.begin(), loaded.end(), byFormat);
+	for (size_t begin=0; begin<loaded.size(); ){
+		size_t end = begin + 1;
+		while (end < loaded.size() &&
+		       loaded[end]->image.internalFormat == loaded[begin]->image.internalFormat &&
+		       (!useArrays || (loaded[end]->image.width == loaded[begin]->image.width && loaded[end]->image.height == loaded[begin]->image.height)))
+			end++;
+		std::vector<AtlasSource *> group(loaded.begin() + begin, loaded.begin() + end);
+		if (useArrays){
+			for (size_t first=0; first<group.size(); first+=(size_t)maxLayers){
+				std::vector<AtlasSource *> layers(group.begin() + first, group.begin() + std::min(group.size(), first + (size_t)maxLayers));
+				buildArray(layers, out_atlases, out_placements);
+			}
+		}else{
+			buildAtlases(group, maxSize, padding, out_atlases, out_placements);
+		}
+		begin = end;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	bool ok = true;
+	for (size_t i=0; i<sources.size(); i++){
+		unmapFile(sources[i].file);
+		ok = ok && out_placements[i].atlas >= 0;
+	}
+	return ok;
+}
@@ -0,0 +1,64 @@
+#ifndef TEXTUREATLAS_HPP
+#define TEXTUREATLAS_HPP
+
+#include <vector>
+#include <string>
+
+// Skyline rectangle packer : the top of what is packed is kept as a list of horizontal
+// segments, and each rectangle goes where its top ends up the lowest.
+struct SkylineNode{
+	unsigned int x, y, width;
+};
+
+struct SkylinePacker{
+	unsigned int width, height;
+	std::vector<SkylineNode> nodes; // Sorted by x, covering the whole width
+};
+
+void initSkylinePacker(SkylinePacker & packer, unsigned int width, unsigned int height);
+
+// Finds room for a rectangle. Returns false if it doesn't fit anymore.
+bool addSkylineRectangle(SkylinePacker & packer, unsigned int width, unsigned int height, unsigned int & out_x, unsigned int & out_y);
+
+
+// Textures made of many .DDS files (2D only), to draw the objects that use them
+// without binding another texture in between.
+struct TextureAtlas{
+	GLuint texture;
+	GLenum target;           // GL_TEXTURE_2D (atlas) or GL_TEXTURE_2D_ARRAY
+	unsigned int width, height;
+	unsigned int layerCount; // 1 for an atlas
+	unsigned int mipCount;
+};
+
+// Where a file went. In an atlas, the UVs of the meshes that use it must become
+// uv * uvScale + uvOffset ; in an array, they stay the same and the layer is needed.
+struct AtlasPlacement{
+	int atlas;             // In out_atlases. -1 if the file couldn't be loaded or placed.
+	unsigned int layer;    // In a GL_TEXTURE_2D_ARRAY ; 0 in an atlas
+	float uvScale[2];
+	float uvOffset[2];
+};
+
+// Files are grouped by format (and by size for arrays) : each group gives one or more textures.
+//
+// useArrays = false : the files are packed side by side in atlases of at most maxSize x maxSize.
+// Each one is surrounded by "padding" pixels that repeat its opposite edges, so that
+// filtering near its edges behaves like GL_REPEAT, as long as the UVs stay in [0,1].
+// The mip levels of the files are copied, not recomputed : the atlas keeps the levels
+// where every file is still a whole number of 4x4 blocks and the padding is still at
+// least one block wide, so more padding gives more levels. The padding and positions
+// are rounded up to the size of a block at the smallest level, so that nothing bleeds.
+//
+// useArrays = true : files of the same size and format become the layers of a
+// GL_TEXTURE_2D_ARRAY. There is no padding, and the UVs don't change.
+bool buildTextureAtlases(
+	const std::vector<std::string> & paths,
+	bool useArrays,
+	unsigned int maxSize,
+	unsigned int padding,
+	std::vector<TextureAtlas> & out_atlases,
+	std::vector<AtlasPlacement> & out_placements
+);
+
+#endif
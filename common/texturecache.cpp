@@ -0,0 +1,178 @@
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "file_utils.hpp"
+#include "texture.hpp"
+#include "texturecache.hpp"
+
+struct CachedTexture{
+	unsigned long long contentHash; // hashMemory() of the file
+	unsigned long long fileSize;
+	unsigned long long bytes;       // Estimated GPU memory
+	unsigned int refCount;
+	std::vector<std::string> paths; // Every canonical path that gave this texture
+	std::list<GLuint>::iterator idlePosition; // In TextureCacheIdle, when refCount is 0
+};
+
+std::unordered_map<GLuint, CachedTexture> TextureCacheEntries;
+std::unordered_map<std::string, GLuint> TextureCacheByPath;
+std::unordered_map<unsigned long long, GLuint> TextureCacheByContent;
+std::list<GLuint> TextureCacheIdle; // Released textures, the one released the longest ago first
+TextureCacheStats TextureCacheCounters = { 0, 0, 0, 0, 0, 0, 0 };
+
+static bool hasExtension(const std::string & path, const char * extension){
+	size_t length = strlen(extension);
+	if (path.size() < length)
+		return false;
+	for (size_t i=0; i<length; i++){
+		char c = path[path.size() - length + i];
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		if (c != extension[i])
+			return false;
+	}
+	return true;
+}
+
+// Deletes released textures, the oldest first, until the budget is met
+static void evictTextures(){
+	while (TextureCacheCounters.budgetBytes != 0 &&
+	       TextureCacheCounters.residentBytes > TextureCacheCounters.budgetBytes &&
+	       !TextureCacheIdle.empty()){
+		GLuint texture = TextureCacheIdle.front();
+		TextureCacheIdle.pop_front();
+
+		CachedTexture & entry = TextureCacheEntries[texture];
+		for (size_t i=0; i<entry.paths.size(); i++)
+			TextureCacheByPath.erase(entry.paths[i]);
+		TextureCacheByContent.erase(entry.contentHash);
+		TextureCacheCounters.residentBytes -= entry.bytes;
+		TextureCacheEntries.erase(texture);
+
+		glDeleteTextures(1, &texture);
+		TextureCacheCounters.evictions++;
+	}
+}
+
+// Takes a reference on a texture that is already loaded
+static GLuint referenceTexture(GLuint texture){
+	CachedTexture & entry = TextureCacheEntries[texture];
+	if (entry.refCount == 0)
+		TextureCacheIdle.erase(entry.idlePosition);
+	entry.refCount++;
+	return texture;
+}
+
+void setTextureCacheBudget(unsigned long long bytes){
+	TextureCacheCounters.budgetBytes = bytes;
+	evictTextures();
+}
+
+GLuint acquireTexture(const char * imagepath){
+
+	std::string path;
+	if (!getCanonicalPath(imagepath, path)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return 0;
+	}
+	std::unordered_map<std::string, GLuint>::iterator byPath = TextureCacheByPath.find(path);
+	if (byPath != TextureCacheByPath.end()){
+		TextureCacheCounters.hits++;
+		return referenceTexture(byPath->second);
+	}
+
+	MappedFile file;
+	if (!mapFile(path.c_str(), file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", imagepath);
+		return 0;
+	}
+
+	// The same image under another name
+	unsigned long long fileSize = file.size;
+	unsigned long long contentHash = hashMemory(file.data, file.size);
+	std::unordered_map<unsigned long long, GLuint>::iterator byContent = TextureCacheByContent.find(contentHash);
+	if (byContent != TextureCacheByContent.end() && TextureCacheEntries[byContent->second].fileSize == fileSize){
+		unmapFile(file);
+		TextureCacheCounters.contentHits++;
+		TextureCacheEntries[byContent->second].paths.push_back(path);
+		TextureCacheByPath[path] = byContent->second;
+		return referenceTexture(byContent->second);
+	}
+
+	GLuint texture = 0;
+	unsigned long long bytes = 0;
+	if (hasExtension(path, ".dds")){
+		DDSImage image;
+		if (parseDDS((const unsigned char *)file.data, file.size, image)){
+			texture = uploadDDS(image);
+			bytes = image.size; // The levels are uploaded as they are in the file
+		}else{
+			printf("%s can't be loaded\n", imagepath);
+		}
+	}else if (hasExtension(path, ".bmp")){
+		// Decoded from the mapping that was hashed : the file isn't read twice
+		unsigned int width, height, channels;
+		std::vector<unsigned char> data;
+		if (decodeBMP((const unsigned char *)file.data, file.size, width, height, channels, data)){
+			texture = uploadBMP(width, height, channels, data);
+			// 3 bytes per pixel are usually stored in 4 on the GPU, and the mipmaps add a third
+			bytes = (unsigned long long)width * height * 4 * 4 / 3;
+		}else{
+			printf("%s can't be loaded\n", imagepath);
+		}
+	}else{
+		printf("%s : only .DDS and .BMP textures can be cached\n", imagepath);
+	}
+	unmapFile(file);
+	TextureCacheCounters.misses++;
+	if (texture == 0)
+		return 0;
+
+	CachedTexture & entry = TextureCacheEntries[texture];
+	entry.contentHash = contentHash;
+	entry.fileSize = fileSize;
+	entry.bytes = bytes;
+	entry.refCount = 1;
+	entry.paths.push_back(path);
+	TextureCacheByPath[path] = texture;
+	TextureCacheByContent[contentHash] = texture;
+	TextureCacheCounters.residentBytes += bytes;
+
+	// Makes room for it if released textures can go
+	evictTextures();
+	return texture;
+}
+
+void releaseTexture(GLuint texture){
+	std::unordered_map<GLuint, CachedTexture>::iterator it = TextureCacheEntries.find(texture);
+	if (it == TextureCacheEntries.end() || it->second.refCount == 0){
+		printf("Texture %u wasn't acquired from the cache\n", texture);
+		return;
+	}
+	if (--it->second.refCount == 0){
+		it->second.idlePosition = TextureCacheIdle.insert(TextureCacheIdle.end(), texture);
+		evictTextures();
+	}
+}
+
+TextureCacheStats getTextureCacheStats(){
+	TextureCacheStats stats = TextureCacheCounters;
+	stats.textureCount = (unsigned int)TextureCacheEntries.size();
+	return stats;
+}
+
+void cleanupTextureCache(){
+	for (std::unordered_map<GLuint, CachedTexture>::iterator it = TextureCacheEntries.begin(); it != TextureCacheEntries.end(); ++it)
+		glDeleteTextures(1, &it->first);
+	TextureCacheEntries.clear();
+	TextureCacheByPath.clear();
+	TextureCacheByContent.clear();
+	TextureCacheIdle.clear();
+	TextureCacheCounters.residentBytes = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef TEXTURECACHE_HPP
+#define TEXTURECACHE_HPP
+
+// Shared textures : each file is loaded once, however many objects ask for it.
+// A texture is found by its canonical path first, then by the hash of its content,
+// so two copies of the same file give the same texture too.
+//
+// Released textures stay loaded, in case they are asked for again, until the
+// estimated memory of all the textures goes over the budget : the ones released
+// the longest ago are then deleted. Textures in use are never deleted.
+
+struct TextureCacheStats{
+	unsigned long long hits;        // Found by path
+	unsigned long long contentHits; // Found by content, under another path
+	unsigned long long misses;      // Loaded from the file
+	unsigned long long evictions;   // Deleted to stay in the budget
+	unsigned int textureCount;
+	unsigned long long residentBytes; // Estimated GPU memory of the loaded textures
+	unsigned long long budgetBytes;
+};
+
+// 0 : no limit. Deletes released textures right away if needed.
+void setTextureCacheBudget(unsigned long long bytes);
+
+// Returns the texture of a .DDS or .BMP file (as loadDDS() and loadBMP_custom() do),
+// loading it only if it isn't already. 0 if the file can't be loaded.
+// Each acquireTexture() must be followed by one releaseTexture().
+GLuint acquireTexture(const char * imagepath);
+
+// The texture can be deleted after this, don't use it anymore.
+void releaseTexture(GLuint texture);
+
+TextureCacheStats getTextureCacheStats();
+
+// Deletes all the textures, released or not.
+void cleanupTextureCache();
+
+#endif
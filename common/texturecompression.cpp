@@ -0,0 +1,521 @@
+#include <vector>
+#include <thread>
+#include <string.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURECOMPRESSION_SSE2 1
+#endif
+
+#include "parallel.hpp"
+#include "texturecompression.hpp"
+
+// The encoder is the usual fast one : the colors of a block are fitted with a line
+// (the principal axis of their covariance), each pixel takes the closest of the
+// 4 colors along it, and the endpoints are then moved to the least squares fit of
+// these choices, as long as the error goes down. BC4 blocks (alpha of BC3, BC5)
+// start from the smallest and biggest values, with 8 levels between them, and are
+// refined the same way.
+// SSE2 computes where the 16 pixels of a block fall along the line.
+
+unsigned int getBlockSize(BlockFormat format){
+	return format == BLOCK_FORMAT_BC1 ? 8 : 16;
+}
+
+size_t getCompressedImageSize(BlockFormat format, unsigned int width, unsigned int height){
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * getBlockSize(format);
+}
+
+// Copies the 4x4 pixels of a block as RGBA. Past the right and bottom edges, the last
+// column and row are repeated, so that they don't change the endpoints.
+static void loadBlock(
+	const unsigned char * pixels, unsigned int width, unsigned int height, unsigned int channels,
+	unsigned int blockX, unsigned int blockY,
+	unsigned char * rgba
+){
+	for (unsigned int y=0; y<4; y++){
+		unsigned int py = blockY * 4 + y < height ? blockY * 4 + y : height - 1;
+		for (unsigned int x=0; x<4; x++){
+			unsigned int px = blockX * 4 + x < width ? blockX * 4 + x : width - 1;
+			const unsigned char * p = pixels + ((size_t)py * width + px) * channels;
+			unsigned char * q = rgba + (y * 4 + x) * 4;
+			q[0] = p[0];
+			q[1] = channels > 1 ? p[1] : 0;
+			q[2] = channels > 2 ? p[2] : 0;
+			q[3] = channels > 3 ? p[3] : 255;
+		}
+	}
+}
+
+static inline unsigned int packRGB565(const int rgb[3]){
+	return ((unsigned int)((rgb[0] * 31 + 127) / 255) << 11) |
+	       ((unsigned int)((rgb[1] * 63 + 127) / 255) << 5) |
+	        (unsigned int)((rgb[2] * 31 + 127) / 255);
+}
+
+static inline void unpackRGB565(unsigned int color, int rgb[3]){
+	int r = (color >> 11) & 31;
+	int g = (color >> 5) & 63;
+	int b = color & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Where each of the 16 pixels falls on the segment from c0 to c1, rounded to 0..3.
+static void projectColors(const unsigned char * rgba, const int c0[3], const int c1[3], unsigned char * out_levels){
+	int d[3] = { c1[0] - c0[0], c1[1] - c0[1], c1[2] - c0[2] };
+	int dd = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+	if (dd == 0){
+		memset(out_levels, 0, 16);
+		return;
+	}
+	float scale = 3.0f / dd;
+
+#ifdef TEXTURECOMPRESSION_SSE2
+	const __m128i zero  = _mm_setzero_si128();
+	const __m128i three = _mm_set1_epi16(3);
+	// RGBA, twice : 2 pixels per register once widened to 16 bits. Alpha is multiplied by 0.
+	const __m128i start = _mm_setr_epi16((short)c0[0], (short)c0[1], (short)c0[2], 0, (short)c0[0], (short)c0[1], (short)c0[2], 0);
+	const __m128i dir   = _mm_setr_epi16((short)d[0], (short)d[1], (short)d[2], 0, (short)d[0], (short)d[1], (short)d[2], 0);
+	const __m128 scale4 = _mm_set1_ps(scale);
+	const __m128 half   = _mm_set1_ps(0.5f);
+
+	__m128i levels[4];
+	for (int i=0; i<4; i++){
+		__m128i px = _mm_loadu_si128((const __m128i *)(rgba + 16 * i));
+		// (r*dr + g*dg, b*db + 0) for each pixel
+		__m128i lo = _mm_madd_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(px, zero), start), dir);
+		__m128i hi = _mm_madd_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(px, zero), start), dir);
+		__m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 odd  = _mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1));
+		__m128i dot = _mm_add_epi32(_mm_castps_si128(even), _mm_castps_si128(odd));
+		levels[i] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(dot), scale4), half));
+	}
+	__m128i first  = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(levels[0], levels[1]), zero), three);
+	__m128i second = _mm_min_epi16(_mm_max_epi16(_mm_packs_epi32(levels[2], levels[3]), zero), three);
+	_mm_storeu_si128((__m128i *)out_levels, _mm_packus_epi16(first, second));
+#else
+	for (int i=0; i<16; i++){
+		const unsigned char * p = rgba + 4 * i;
+		int dot = (p[0] - c0[0]) * d[0] + (p[1] - c0[1]) * d[1] + (p[2] - c0[2]) * d[2];
+		int level = (int)(dot * scale + 0.5f);
+		out_levels[i] = (unsigned char)(level < 0 ? 0 : level > 3 ? 3 : level);
+	}
+#endif
+}
+
+// Where each of the 16 values falls between minValue and maxValue, rounded to 0..7.
+// The values can be outside of [minValue, maxValue] when the endpoints are refined.
+static void projectValues(const unsigned char * values, int minValue, int maxValue, unsigned char * out_levels){
+	if (maxValue == minValue){
+		memset(out_levels, 0, 16);
+		return;
+	}
+	float scale = 7.0f / (maxValue - minValue);
+
+#ifdef TEXTURECOMPRESSION_SSE2
+	const __m128i zero  = _mm_setzero_si128();
+	const __m128i seven = _mm_set1_epi16(7);
+	const __m128i start = _mm_set1_epi16((short)minValue);
+	const __m128 scale4 = _mm_set1_ps(scale);
+	const __m128 half   = _mm_set1_ps(0.5f);
+
+	__m128i v = _mm_loadu_si128((const __m128i *)values);
+	// Only the values above minValue matter : the others go to level 0 anyway
+	__m128i lo = _mm_subs_epu16(_mm_unpacklo_epi8(v, zero), start);
+	__m128i hi = _mm_subs_epu16(_mm_unpackhi_epi8(v, zero), start);
+	__m128i l0 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale4), half));
+	__m128i l1 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale4), half));
+	__m128i l2 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale4), half));
+	__m128i l3 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale4), half));
+	__m128i first  = _mm_min_epi16(_mm_packs_epi32(l0, l1), seven);
+	__m128i second = _mm_min_epi16(_mm_packs_epi32(l2, l3), seven);
+	_mm_storeu_si128((__m128i *)out_levels, _mm_packus_epi16(first, second));
+#else
+	for (int i=0; i<16; i++){
+		int level = values[i] > minValue ? (int)((values[i] - minValue) * scale + 0.5f) : 0;
+		out_levels[i] = (unsigned char)(level > 7 ? 7 : level);
+	}
+#endif
+}
+
+// Quantizes the endpoints, chooses the color of each pixel, and returns the squared error.
+// out_color0 >= out_color1, so the block is in 4 colors mode.
+static int fitBC1Endpoints(
+	const unsigned char * rgba, const int a[3], const int b[3],
+	unsigned int & out_color0, unsigned int & out_color1, unsigned char * out_levels
+){
+	out_color0 = packRGB565(a);
+	out_color1 = packRGB565(b);
+	if (out_color0 < out_color1){
+		unsigned int swap = out_color0;
+		out_color0 = out_color1;
+		out_color1 = swap;
+	}
+	int palette[4][3];
+	unpackRGB565(out_color0, palette[0]);
+	unpackRGB565(out_color1, palette[3]);
+	for (int c=0; c<3; c++){
+		palette[1][c] = (2 * palette[0][c] + palette[3][c]) / 3;
+		palette[2][c] = (palette[0][c] + 2 * palette[3][c]) / 3;
+	}
+	projectColors(rgba, palette[0], palette[3], out_levels);
+
+	int error = 0;
+	for (int i=0; i<16; i++){
+		const int * p = palette[out_levels[i]];
+		for (int c=0; c<3; c++){
+			int d = rgba[4 * i + c] - p[c];
+			error += d * d;
+		}
+	}
+	return error;
+}
+
+static void encodeBC1Block(const unsigned char * rgba, unsigned char * out){
+
+	// Mean and covariance of the colors
+	int sum[3] = { 0, 0, 0 };
+	for (int i=0; i<16; i++)
+		for (int c=0; c<3; c++)
+			sum[c] += rgba[4 * i + c];
+	float mean[3] = { sum[0] / 16.0f, sum[1] / 16.0f, sum[2] / 16.0f };
+	float cov[6] = { 0, 0, 0, 0, 0, 0 }; // rr rg rb gg gb bb
+	for (int i=0; i<16; i++){
+		float r = rgba[4 * i + 0] - mean[0];
+		float g = rgba[4 * i + 1] - mean[1];
+		float b = rgba[4 * i + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+
+	// Principal axis, by power iteration from the row of the biggest variance
+	float axis[3];
+	if (cov[0] >= cov[3] && cov[0] >= cov[5]){
+		axis[0] = cov[0]; axis[1] = cov[1]; axis[2] = cov[2];
+	}else if (cov[3] >= cov[5]){
+		axis[0] = cov[1]; axis[1] = cov[3]; axis[2] = cov[4];
+	}else{
+		axis[0] = cov[2]; axis[1] = cov[4]; axis[2] = cov[5];
+	}
+	for (int iteration=0; iteration<4; iteration++){
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float biggest = fmaxf(fabsf(x), fmaxf(fabsf(y), fabsf(z)));
+		if (biggest == 0.0f)
+			break;
+		axis[0] = x / biggest; axis[1] = y / biggest; axis[2] = z / biggest;
+	}
+
+	// Endpoints : the two pixels that are the furthest apart along the axis
+	int minPixel = 0, maxPixel = 0;
+	float minDot = 1e30f, maxDot = -1e30f;
+	for (int i=0; i<16; i++){
+		float dot = rgba[4 * i + 0] * axis[0] + rgba[4 * i + 1] * axis[1] + rgba[4 * i + 2] * axis[2];
+		if (dot < minDot){ minDot = dot; minPixel = i; }
+		if (dot > maxDot){ maxDot = dot; maxPixel = i; }
+	}
+	int a[3] = { rgba[4 * maxPixel + 0], rgba[4 * maxPixel + 1], rgba[4 * maxPixel + 2] };
+	int b[3] = { rgba[4 * minPixel + 0], rgba[4 * minPixel + 1], rgba[4 * minPixel + 2] };
+
+	unsigned int color0, color1;
+	unsigned char levels[16];
+	int error = fitBC1Endpoints(rgba, a, b, color0, color1, levels);
+
+	// Least squares endpoints for the levels that were chosen, while it gets better
+	for (int iteration=0; iteration<2 && error > 0; iteration++){
+		float aa = 0, ab = 0, bb = 0;
+		float ax[3] = { 0, 0, 0 }, bx[3] = { 0, 0, 0 };
+		for (int i=0; i<16; i++){
+			float beta = levels[i] * (1.0f / 3.0f);
+			float alpha = 1.0f - beta;
+			aa += alpha * alpha; ab += alpha * beta; bb += beta * beta;
+			for (int c=0; c<3; c++){
+				ax[c] += alpha * rgba[4 * i + c];
+				bx[c] += beta  * rgba[4 * i + c];
+			}
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) < 1e-3f)
+			break; // All the pixels on the same level
+		for (int c=0; c<3; c++){
+			float fa = (ax[c] * bb - bx[c] * ab) / det;
+			float fb = (bx[c] * aa - ax[c] * ab) / det;
+			a[c] = fa < 0.0f ? 0 : fa > 255.0f ? 255 : (int)(fa + 0.5f);
+			b[c] = fb < 0.0f ? 0 : fb > 255.0f ? 255 : (int)(fb + 0.5f);
+		}
+		unsigned int newColor0, newColor1;
+		unsigned char newLevels[16];
+		int newError = fitBC1Endpoints(rgba, a, b, newColor0, newColor1, newLevels);
+		if (newError >= error)
+			break;
+		error = newError;
+		color0 = newColor0;
+		color1 = newColor1;
+		memcpy(levels, newLevels, 16);
+	}
+
+	// Levels 0..3 go from color0 to color1 ; the indices are 0 : color0, 1 : color1, 2 and 3 in between
+	static const unsigned int levelToIndex[4] = { 0, 2, 3, 1 };
+	unsigned int indices = 0;
+	for (int i=0; i<16; i++)
+		indices |= levelToIndex[levels[i]] << (2 * i);
+	out[0] = (unsigned char)(color0 & 0xFF);
+	out[1] = (unsigned char)(color0 >> 8);
+	out[2] = (unsigned char)(color1 & 0xFF);
+	out[3] = (unsigned char)(color1 >> 8);
+	out[4] = (unsigned char)(indices & 0xFF);
+	out[5] = (unsigned char)((indices >> 8) & 0xFF);
+	out[6] = (unsigned char)((indices >> 16) & 0xFF);
+	out[7] = (unsigned char)(indices >> 24);
+}
+
+// Chooses the level of each value between the two endpoints, and returns the squared error.
+static int fitBC4Endpoints(const unsigned char * values, int minValue, int maxValue, unsigned char * out_levels){
+	projectValues(values, minValue, maxValue, out_levels);
+	int palette[8];
+	for (int level=0; level<8; level++)
+		palette[level] = (level * maxValue + (7 - level) * minValue + 3) / 7;
+	int error = 0;
+	for (int i=0; i<16; i++){
+		int d = values[i] - palette[out_levels[i]];
+		error += d * d;
+	}
+	return error;
+}
+
+static void encodeBC4Block(const unsigned char * rgba, int channel, unsigned char * out){
+
+	unsigned char values[16];
+	for (int i=0; i<16; i++)
+		values[i] = rgba[4 * i + channel];
+
+	int minValue, maxValue;
+#ifdef TEXTURECOMPRESSION_SSE2
+	__m128i v = _mm_loadu_si128((const __m128i *)values);
+	__m128i vmin = _mm_min_epu8(v, _mm_srli_si128(v, 8));
+	__m128i vmax = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+	vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 4));
+	vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 4));
+	vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 2));
+	vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 2));
+	vmin = _mm_min_epu8(vmin, _mm_srli_si128(vmin, 1));
+	vmax = _mm_max_epu8(vmax, _mm_srli_si128(vmax, 1));
+	minValue = _mm_cvtsi128_si32(vmin) & 0xFF;
+	maxValue = _mm_cvtsi128_si32(vmax) & 0xFF;
+#else
+	minValue = maxValue = values[0];
+	for (int i=1; i<16; i++){
+		if (values[i] < minValue) minValue = values[i];
+		if (values[i] > maxValue) maxValue = values[i];
+	}
+#endif
+
+	unsigned char levels[16];
+	int error = fitBC4Endpoints(values, minValue, maxValue, levels);
+
+	// Least squares endpoints for the levels that were chosen, while it gets better
+	for (int iteration=0; iteration<2 && error > 0; iteration++){
+		float aa = 0, ab = 0, bb = 0, ax = 0, bx = 0;
+		for (int i=0; i<16; i++){
+			float beta = levels[i] * (1.0f / 7.0f);
+			float alpha = 1.0f - beta;
+			aa += alpha * alpha; ab += alpha * beta; bb += beta * beta;
+			ax += alpha * values[i];
+			bx += beta  * values[i];
+		}
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) < 1e-3f)
+			break;
+		float fa = (ax * bb - bx * ab) / det;
+		float fb = (bx * aa - ax * ab) / det;
+		int newMin = fa < 0.0f ? 0 : fa > 255.0f ? 255 : (int)(fa + 0.5f);
+		int newMax = fb < 0.0f ? 0 : fb > 255.0f ? 255 : (int)(fb + 0.5f);
+		if (newMax <= newMin)
+			break;
+		unsigned char newLevels[16];
+		int newError = fitBC4Endpoints(values, newMin, newMax, newLevels);
+		if (newError >= error)
+			break;
+		error = newError;
+		minValue = newMin;
+		maxValue = newMax;
+		memcpy(levels, newLevels, 16);
+	}
+
+	// value0 > value1 : 8 values mode. Code 0 is value0 (level 7), code 1 value1 (level 0),
+	// and codes 2..7 the levels 6..1 in between.
+	unsigned long long codes = 0;
+	for (int i=0; i<16; i++){
+		unsigned int level = levels[i];
+		unsigned long long code = level == 7 ? 0 : level == 0 ? 1 : 8 - level;
+		codes |= code << (3 * i);
+	}
+	out[0] = (unsigned char)maxValue;
+	out[1] = (unsigned char)minValue;
+	for (int i=0; i<6; i++)
+		out[2 + i] = (unsigned char)(codes >> (8 * i));
+}
+
+void compressImage(
+	const unsigned char * pixels,
+	unsigned int width,
+	unsigned int height,
+	unsigned int channels,
+	BlockFormat format,
+	std::vector<unsigned char> & out_blocks,
+	unsigned int threadCount
+){
+	const unsigned int blockSize = getBlockSize(format);
+	const unsigned int blocksX = (width + 3) / 4;
+	const unsigned int blocksY = (height + 3) / 4;
+	out_blocks.resize((size_t)blocksX * blocksY * blockSize);
+	if (out_blocks.empty())
+		return;
+
+	// Starting a thread costs as much as compressing a few hundred blocks
+	if (threadCount == 0)
+		threadCount = std::thread::hardware_concurrency();
+	size_t maxThreads = (size_t)blocksX * blocksY / 1024;
+	if (threadCount > maxThreads) threadCount = (unsigned int)maxThreads;
+	if (threadCount > blocksY)    threadCount = blocksY;
+	if (threadCount < 1)          threadCount = 1;
+
+	unsigned char * blocks = &out_blocks[0];
+	runInParallel(threadCount, [&](size_t thread){
+		unsigned int firstRow = (unsigned int)(blocksY * thread / threadCount);
+		unsigned int lastRow  = (unsigned int)(blocksY * (thread + 1) / threadCount);
+		unsigned char rgba[64];
+		for (unsigned int blockY=firstRow; blockY<lastRow; blockY++){
+			for (unsigned int blockX=0; blockX<blocksX; blockX++){
+				loadBlock(pixels, width, height, channels, blockX, blockY, rgba);
+				unsigned char * block = blocks + ((size_t)blockY * blocksX + blockX) * blockSize;
+				switch (format){
+				case BLOCK_FORMAT_BC1:
+					encodeBC1Block(rgba, block);
+					break;
+				case BLOCK_FORMAT_BC3:
+					encodeBC4Block(rgba, 3, block);
+					encodeBC1Block(rgba, block + 8);
+					break;
+				case BLOCK_FORMAT_BC5:
+					encodeBC4Block(rgba, 0, block);
+					encodeBC4Block(rgba, 1, block + 8);
+					break;
+				}
+			}
+		}
+	});
+}
+
+// BC1 colors. In BC3 the colors are always in 4 colors mode.
+static void decodeBC1Block(const unsigned char * block, bool alwaysFourColors, unsigned char * rgba){
+	unsigned int color0 = block[0] | (block[1] << 8);
+	unsigned int color1 = block[2] | (block[3] << 8);
+	int palette[4][4];
+	unpackRGB565(color0, palette[0]);
+	unpackRGB565(color1, palette[1]);
+	palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+	for (int c=0; c<3; c++){
+		if (color0 > color1 || alwaysFourColors){
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}else{
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+		}
+	}
+	if (color0 <= color1 && !alwaysFourColors)
+		palette[3][3] = 0; // Transparent black
+
+	unsigned int indices = block[4] | (block[5] << 8) | (block[6] << 16) | ((unsigned int)block[7] << 24);
+	for (int i=0; i<16; i++){
+		const int * p = palette[(indices >> (2 * i)) & 3];
+		rgba[4 * i + 0] = (unsigned char)p[0];
+		rgba[4 * i + 1] = (unsigned char)p[1];
+		rgba[4 * i + 2] = (unsigned char)p[2];
+		rgba[4 * i + 3] = (unsigned char)p[3];
+	}
+}
+
+static void decodeBC4Block(const unsigned char * block, int channel, unsigned char * rgba){
+	int value0 = block[0];
+	int value1 = block[1];
+	int palette[8] = { value0, value1, 0, 0, 0, 0, 0, 255 };
+	if (value0 > value1){
+		for (int k=2; k<8; k++)
+			palette[k] = ((8 - k) * value0 + (k - 1) * value1 + 3) / 7;
+	}else{
+		for (int k=2; k<6; k++)
+			palette[k] = ((6 - k) * value0 + (k - 1) * value1 + 2) / 5;
+	}
+	unsigned long long codes = 0;
+	for (int i=0; i<6; i++)
+		codes |= (unsigned long long)block[2 + i] << (8 * i);
+	for (int i=0; i<16; i++)
+		rgba[4 * i + channel] = (unsigned char)palette[(codes >> (3 * i)) & 7];
+}
+
+void decompressImage(
+	const unsigned char * blocks,
+	unsigned int width,
+	unsigned int height,
+	BlockFormat format,
+	std::vector<unsigned char> & out_pixels
+){
+	const unsigned int blockSize = getBlockSize(format);
+	const unsigned int blocksX = (width + 3) / 4;
+	const unsigned int blocksY = (height + 3) / 4;
+	out_pixels.resize((size_t)width * height * 4);
+
+	unsigned char rgba[64];
+	for (unsigned int blockY=0; blockY<blocksY; blockY++){
+		for (unsigned int blockX=0; blockX<blocksX; blockX++){
+			const unsigned char * block = blocks + ((size_t)blockY * blocksX + blockX) * blockSize;
+			switch (format){
+			case BLOCK_FORMAT_BC1:
+				decodeBC1Block(block, false, rgba);
+				break;
+			case BLOCK_FORMAT_BC3:
+				decodeBC1Block(block + 8, true, rgba);
+				decodeBC4Block(block, 3, rgba);
+				break;
+			case BLOCK_FORMAT_BC5:
+				for (int i=0; i<16; i++){
+					rgba[4 * i + 2] = 0;
+					rgba[4 * i + 3] = 255;
+				}
+				decodeBC4Block(block, 0, rgba);
+				decodeBC4Block(block + 8, 1, rgba);
+				break;
+			}
+			// Only the part of the block that is in the image
+			for (unsigned int y=0; y<4 && blockY * 4 + y < height; y++){
+				unsigned int columns = width - blockX * 4 < 4 ? width - blockX * 4 : 4;
+				memcpy(&out_pixels[(((size_t)blockY * 4 + y) * width + blockX * 4) * 4], rgba + y * 16, columns * 4);
+			}
+		}
+	}
+}
+
+double computePSNR(
+	const unsigned char * a, unsigned int aChannels,
+	const unsigned char * b, unsigned int bChannels,
+	size_t pixelCount,
+	unsigned int channels
+){
+	unsigned long long squaredError = 0;
+	for (size_t i=0; i<pixelCount; i++){
+		for (unsigned int c=0; c<channels; c++){
+			int d = (int)a[i * aChannels + c] - (int)b[i * bChannels + c];
+			squaredError += (unsigned long long)(d * d);
+		}
+	}
+	if (squaredError == 0)
+		return HUGE_VAL;
+	double meanSquaredError = (double)squaredError / ((double)pixelCount * channels);
+	return 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+}
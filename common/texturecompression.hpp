@@ -0,0 +1,57 @@
+#ifndef TEXTURECOMPRESSION_HPP
+#define TEXTURECOMPRESSION_HPP
+
+#include <vector>
+
+// Block compression on the CPU : the image is cut in blocks of 4x4 pixels, and each
+// block is stored in 8 or 16 bytes, which the GPU decodes on the fly.
+// - BC1 (DXT1)  : RGB, 8 bytes per block. 1/6 of the size of 24 bits RGB.
+// - BC3 (DXT5)  : RGBA, 16 bytes per block : the alpha like BC4, then the colors like BC1.
+// - BC5 (RGTC2) : two channels, 16 bytes per block : each one like BC4. For normal maps :
+//                 store X and Y, and compute Z = sqrt(1 - X*X - Y*Y) in the shader.
+enum BlockFormat{
+	BLOCK_FORMAT_BC1,
+	BLOCK_FORMAT_BC3,
+	BLOCK_FORMAT_BC5
+};
+
+// Bytes per 4x4 block
+unsigned int getBlockSize(BlockFormat format);
+
+// Bytes of a compressed image. Incomplete blocks on the right and bottom edges count as whole blocks.
+size_t getCompressedImageSize(BlockFormat format, unsigned int width, unsigned int height);
+
+// Compresses width*height pixels of "channels" bytes each (1 to 4 : R, RG, RGB, RGBA), row after row.
+// BC5 keeps R and G, BC1 R, G and B. Missing channels are 0, and alpha 255.
+// Blocks are in the same order as the pixels : the first row of blocks holds the first 4 rows of pixels.
+// The rows of blocks are shared between threadCount threads (0 : one per core).
+void compressImage(
+	const unsigned char * pixels,
+	unsigned int width,
+	unsigned int height,
+	unsigned int channels,
+	BlockFormat format,
+	std::vector<unsigned char> & out_blocks,
+	unsigned int threadCount = 0
+);
+
+// Gives back width*height RGBA pixels, 4 bytes each, for the CPU code that needs texels.
+// BC1 has alpha = 255, BC5 has B = 0 and alpha = 255.
+void decompressImage(
+	const unsigned char * blocks,
+	unsigned int width,
+	unsigned int height,
+	BlockFormat format,
+	std::vector<unsigned char> & out_pixels
+);
+
+// Peak signal-to-noise ratio in dB between two images, on their first "channels" channels.
+// a has aChannels bytes per pixel, and b bChannels. Identical images give +infinity.
+double computePSNR(
+	const unsigned char * a, unsigned int aChannels,
+	const unsigned char * b, unsigned int bChannels,
+	size_t pixelCount,
+	unsigned int channels
+);
+
+#endif
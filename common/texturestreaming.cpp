@@ -0,0 +1,342 @@
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include "file_utils.hpp"
+#include "texture.hpp"
+#include "texturestreaming.hpp"
+
+struct StreamedLevel{
+	unsigned int width, height;
+	size_t offset; // In StreamedTexture::data
+};
+
+struct StreamedTexture{
+	GLuint texture;
+	std::string path;
+
+	// Filled by the thread that reads the file
+	bool ok;
+	GLenum internalFormat;
+	GLenum format, type;    // 0 when compressed
+	unsigned int blockSize; // Bytes per 4x4 block when compressed, per pixel otherwise
+	std::vector<StreamedLevel> levels; // Level 0 first
+	std::vector<unsigned char> data;
+
+	// Upload : level and row (of pixels, or of blocks when compressed) that go next.
+	// Starts at the smallest level, once the file is read.
+	int nextLevel;
+	unsigned int nextRow;
+};
+
+// Rows of a level : rows of 4x4 blocks when the texture is compressed
+static unsigned int getRowCount(const StreamedTexture & t, const StreamedLevel & level){
+	return t.format == 0 ? (level.height + 3) / 4 : level.height;
+}
+
+static size_t getRowSize(const StreamedTexture & t, const StreamedLevel & level){
+	return t.format == 0 ? (size_t)((level.width + 3) / 4) * t.blockSize : (size_t)level.width * t.blockSize;
+}
+
+std::vector<std::thread> StreamingThreads;
+std::mutex StreamingMutex;
+std::condition_variable StreamingCondition;
+bool StreamingStop = false;
+std::deque<StreamedTexture *> StreamingToRead;     // Waiting for a thread
+std::deque<StreamedTexture *> StreamingRead;       // Read, waiting for updateTextureStreaming()
+std::vector<StreamedTexture *> StreamingUploading; // Main thread only
+unsigned int StreamingCount = 0;                   // Main thread only
+
+// Pixel buffer object. The uploads are written one after the other in it, and
+// it is orphaned when it is full : the driver gives a new one if the GPU still
+// reads the old one, instead of waiting for it.
+GLuint StreamingBuffer = 0;
+size_t StreamingBufferSize = 0;
+size_t StreamingBufferOffset = 0;
+unsigned int StreamingStagingSize = 0;
+
+static bool readDDSLevels(StreamedTexture & t){
+	MappedFile file;
+	if (!mapFile(t.path.c_str(), file)){
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", t.path.c_str());
+		return false;
+	}
+	// Copying the mapping is what reads the file, here instead of in the render thread
+	t.data.assign(file.data, file.data + file.size);
+	unmapFile(file);
+
+	DDSImage image;
+	if (t.data.empty() || !parseDDS(&t.data[0], t.data.size(), image))
+		return false;
+	if (image.target != GL_TEXTURE_2D){
+		printf("%s : only 2D textures can be streamed, use loadDDS()\n", t.path.c_str());
+		return false;
+	}
+	t.internalFormat = image.internalFormat;
+	t.format = image.format;
+	t.type = image.type;
+	t.blockSize = image.blockSize;
+	size_t offset = image.data - &t.data[0];
+	for (unsigned int level=0; level<image.mipCount; level++){
+		StreamedLevel l;
+		l.width  = image.width  >> level ? image.width  >> level : 1;
+		l.height = image.height >> level ? image.height >> level : 1;
+		l.offset = offset;
+		t.levels.push_back(l);
+		offset += getDDSLevelSize(image, level);
+	}
+	return true;
+}
+
+static bool readBMPLevels(StreamedTexture & t){
+	unsigned long long fileSize;
+	long long modificationTime;
+	if (!getFileInfo(t.path.c_str(), fileSize, modificationTime)){
+		// readBMP() would wait for a key press, which a thread can't do
+		printf("%s could not be opened. Are you in the right directory ? Don't forget to read the FAQ !\n", t.path.c_str());
+		return false;
+	}
+	unsigned int width, height, channels;
+	std::vector<unsigned char> pixels, smaller;
+	if (!readBMP(t.path.c_str(), width, height, channels, pixels))
+		return false;
+
+	t.internalFormat = channels == 4 ? GL_RGBA8 : GL_RGB8;
+	t.format = channels == 4 ? GL_RGBA : GL_RGB;
+	t.type = GL_UNSIGNED_BYTE;
+	t.blockSize = channels;
+	while (true){
+		StreamedLevel l = { width, height, t.data.size() };
+		t.levels.push_back(l);
+		t.data.insert(t.data.end(), pixels.begin(), pixels.end());
+		if (width == 1 && height == 1)
+			break;
+		// Each file is read by one thread already
+		downsampleImage(&pixels[0], width, height, channels, true, smaller, 1);
+		pixels.swap(smaller);
+		width  = width  > 1 ? width  / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return true;
+}
+
+static void streamingThread(){
+	while (true){
+		StreamedTexture * t;
+		{
+			std::unique_lock<std::mutex> lock(StreamingMutex);
+			while (!StreamingStop && StreamingToRead.empty())
+				StreamingCondition.wait(lock);
+			if (StreamingStop)
+				return;
+			t = StreamingToRead.front();
+			StreamingToRead.pop_front();
+		}
+
+		size_t length = t->path.size();
+		bool dds = length >= 4 && (t->path.compare(length - 4, 4, ".DDS") == 0 || t->path.compare(length - 4, 4, ".dds") == 0);
+		t->ok = dds ? readDDSLevels(*t) : readBMPLevels(*t);
+
+		std::lock_guard<std::mutex> lock(StreamingMutex);
+		StreamingRead.push_back(t);
+	}
+}
+
+void initTextureStreaming(unsigned int threadCount, unsigned int stagingSize){
+	StreamingStop = false;
+	StreamingStagingSize = stagingSize;
+	glGenBuffers(1, &StreamingBuffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, StreamingBuffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, stagingSize, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	StreamingBufferSize = stagingSize;
+	StreamingBufferOffset = 0;
+
+	if (threadCount == 0)
+		threadCount = 1;
+	for (unsigned int i=0; i<threadCount; i++)
+		StreamingThreads.push_back(std::thread(streamingThread));
+}
+
+GLuint streamTexture(const char * imagepath){
+
+	GLuint textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+
+	// Grey until the file is read
+	const unsigned char grey[4] = { 128, 128, 128, 255 };
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	StreamedTexture * t = new StreamedTexture();
+	t->texture = textureID;
+	t->path = imagepath;
+	t->ok = false;
+	t->nextLevel = -1;
+	t->nextRow = 0;
+	StreamingCount++;
+	{
+		std::lock_guard<std::mutex> lock(StreamingMutex);
+		StreamingToRead.push_back(t);
+	}
+	StreamingCondition.notify_one();
+	return textureID;
+}
+
+// Copies as many rows of the next level as fit in a pixel buffer object, and uploads them.
+// Returns true when the texture is complete.
+static bool uploadNextRows(StreamedTexture & t){
+	const StreamedLevel & l = t.levels[t.nextLevel];
+	size_t rowSize = getRowSize(t, l);
+	unsigned int rowCount = getRowCount(t, l);
+	unsigned int rows = (unsigned int)(StreamingStagingSize / rowSize);
+	if (rows < 1)
+		rows = 1;
+	if (rows > rowCount - t.nextRow)
+		rows = rowCount - t.nextRow;
+	size_t size = rows * rowSize;
+
+	glBindTexture(GL_TEXTURE_2D, t.texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT,1);
+	if (t.nextRow == 0){
+		// The level gets its size when its upload starts, so that big levels
+		// don't cost anything before. It isn't sampled until it is complete.
+		if (t.format == 0)
+			glCompressedTexImage2D(GL_TEXTURE_2D, t.nextLevel, t.internalFormat, l.width, l.height, 0, (GLsizei)(rowSize * rowCount), NULL);
+		else
+			glTexImage2D(GL_TEXTURE_2D, t.nextLevel, t.internalFormat, l.width, l.height, 0, t.format, t.type, NULL);
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, StreamingBuffer);
+	if (StreamingBufferOffset + size > StreamingBufferSize){
+		StreamingBufferSize = size > StreamingStagingSize ? size : StreamingStagingSize;
+		StreamingBufferOffset = 0;
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, StreamingBufferSize, NULL, GL_STREAM_DRAW);
+	}
+	// Nothing reads this part of the buffer yet : no need to wait for the GPU
+	size_t offset = StreamingBufferOffset;
+	void * staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (staging == NULL){
+		// Nothing was uploaded : the same rows are tried again at the next update,
+		// and the level isn't sampled before they are there.
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return false;
+	}
+	StreamingBufferOffset += (size + 15) & ~(size_t)15;
+	memcpy(staging, &t.data[l.offset + t.nextRow * rowSize], size);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	if (t.format == 0){
+		GLint y = t.nextRow * 4;
+		GLsizei height = (GLsizei)l.height - y < (GLsizei)rows * 4 ? (GLsizei)l.height - y : (GLsizei)rows * 4;
+		glCompressedTexSubImage2D(GL_TEXTURE_2D, t.nextLevel, 0, y, l.width, height, t.internalFormat, (GLsizei)size, (void*)offset);
+	}else{
+		glTexSubImage2D(GL_TEXTURE_2D, t.nextLevel, 0, t.nextRow, l.width, rows, t.format, t.type, (void*)offset);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	t.nextRow += rows;
+	if (t.nextRow < rowCount)
+		return false;
+
+	// This level can be used now
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, t.nextLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)t.levels.size() - 1);
+	t.nextLevel--;
+	t.nextRow = 0;
+	return t.nextLevel < 0;
+}
+
+void updateTextureStreaming(double budgetMilliseconds){
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	{
+		std::lock_guard<std::mutex> lock(StreamingMutex);
+		while (!StreamingRead.empty()){
+			StreamedTexture * t = StreamingRead.front();
+			StreamingRead.pop_front();
+			if (t->ok && !t->levels.empty()){
+				t->nextLevel = (int)t->levels.size() - 1;
+				StreamingUploading.push_back(t);
+			}else{
+				printf("%s can't be streamed\n", t->path.c_str());
+				StreamingCount--;
+				delete t;
+			}
+		}
+	}
+
+	while (!StreamingUploading.empty()){
+		// The texture whose next level is the smallest : all the textures get
+		// their small levels before any big one is uploaded.
+		size_t best = 0;
+		size_t bestSize = (size_t)-1;
+		for (size_t i=0; i<StreamingUploading.size(); i++){
+			const StreamedTexture & t = *StreamingUploading[i];
+			const StreamedLevel & l = t.levels[t.nextLevel];
+			size_t size = getRowSize(t, l) * getRowCount(t, l);
+			if (size < bestSize){
+				best = i;
+				bestSize = size;
+			}
+		}
+		StreamedTexture * t = StreamingUploading[best];
+		int level = t->nextLevel;
+		unsigned int row = t->nextRow;
+		if (uploadNextRows(*t)){
+			StreamingUploading.erase(StreamingUploading.begin() + best);
+			StreamingCount--;
+			delete t;
+		}else if (t->nextLevel == level && t->nextRow == row){
+			break; // The staging buffer couldn't be mapped : try again at the next update
+		}
+
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		if (elapsed >= budgetMilliseconds)
+			break;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+unsigned int getStreamingTextureCount(){
+	return StreamingCount;
+}
+
+void cleanupTextureStreaming(){
+	{
+		std::lock_guard<std::mutex> lock(StreamingMutex);
+		StreamingStop = true;
+	}
+	StreamingCondition.notify_all();
+	for (size_t i=0; i<StreamingThreads.size(); i++)
+		StreamingThreads[i].join();
+	StreamingThreads.clear();
+
+	for (size_t i=0; i<StreamingToRead.size(); i++)
+		delete StreamingToRead[i];
+	for (size_t i=0; i<StreamingRead.size(); i++)
+		delete StreamingRead[i];
+	for (size_t i=0; i<StreamingUploading.size(); i++)
+		delete StreamingUploading[i];
+	StreamingToRead.clear();
+	StreamingRead.clear();
+	StreamingUploading.clear();
+	StreamingCount = 0;
+
+	glDeleteBuffers(1, &StreamingBuffer);
+	StreamingBuffer = 0;
+}
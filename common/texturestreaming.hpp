@@ -0,0 +1,30 @@
+#ifndef TEXTURESTREAMING_HPP
+#define TEXTURESTREAMING_HPP
+
+// Texture loading that doesn't block the render loop.
+// Background threads read and decode the files ; updateTextureStreaming(), called once
+// per frame, gives them to OpenGL through pixel buffer objects, without spending more
+// than its time budget. The smallest mip levels are uploaded first, so every texture
+// can be used right away, and gets sharper as its bigger levels arrive.
+//
+// .DDS files (2D textures only, see loadDDS) are uploaded as they are. .BMP files get
+// their mipmaps computed on the CPU by the thread that reads them.
+
+// threadCount : how many files are read at the same time.
+// stagingSize : size of the pixel buffer object. Bigger levels are sent in several parts.
+void initTextureStreaming(unsigned int threadCount = 1, unsigned int stagingSize = 4 << 20);
+
+// Returns a texture right away : 1 grey pixel until the file is read.
+GLuint streamTexture(const char * imagepath);
+
+// Uploads what the threads have read, until budgetMilliseconds are spent.
+// At least one part of a level is uploaded at each call, so loading always progresses.
+void updateTextureStreaming(double budgetMilliseconds);
+
+// Textures that are still being read or uploaded
+unsigned int getStreamingTextureCount();
+
+// Waits for the threads. The textures aren't deleted.
+void cleanupTextureStreaming();
+
+#endif
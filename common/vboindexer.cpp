@@ -1,5 +1,7 @@
 #include <vector>
-#include <map>
+#include <limits>
+#include <stdio.h>
+#include <math.h>
 
 #include <glm/glm.hpp>
 
@@ -13,37 +15,188 @@ bool is_near(float v1, float v2){
 	return fabs( v1-v2 ) < 0.01f;
 }
 
-// Searches through all already-exported vertices
-// for a similar one.
-// Similar = same position + same UVs + same normal
-bool getSimilarVertexIndex( 
-	glm::vec3 & in_vertex, 
-	glm::vec2 & in_uv, 
-	glm::vec3 & in_normal, 
+// Finds already-exported vertices that is_near() a new one, without looking at all of them.
+// Positions are put in a grid of cells a bit bigger than the is_near tolerance, so a
+// similar vertex can only be in the same cell or in one of the 26 around it.
+// UVs and normals don't pick the cell : they are only compared on the candidates.
+struct VertexWeldGrid{
+	struct Cell{
+		int x, y, z;
+		unsigned int first; // Vertices of a cell are chained by increasing index,
+		unsigned int last;  // from first to last through "next". emptyCell if unused.
+	};
+	static const unsigned int emptyCell = 0xFFFFFFFFu;
+
+	std::vector<Cell> cells; // Open addressing, at most half full
+	size_t used;
+	std::vector<unsigned int> next; // Next vertex in the same cell, for each vertex
+
+	explicit VertexWeldGrid(size_t expectedCount) : used(0){
+		size_t capacity = 64;
+		while (capacity < expectedCount * 2)
+			capacity *= 2;
+		Cell empty = {0, 0, 0, emptyCell, emptyCell};
+		cells.assign(capacity, empty);
+	}
+
+	static unsigned int hashCell(int x, int y, int z){
+		unsigned long long h = (unsigned int)x * 0x9E3779B97F4A7C15ull;
+		h = (h ^ (unsigned int)y) * 0xC2B2AE3D27D4EB4Full;
+		h = (h ^ (unsigned int)z) * 0x165667B19E3779F9ull;
+		return (unsigned int)(h >> 32);
+	}
+
+	// Slot of the cell, or the empty slot where it would go
+	size_t findSlot(int x, int y, int z) const {
+		size_t mask = cells.size() - 1;
+		size_t s = hashCell(x, y, z) & mask;
+		while (cells[s].first != emptyCell && (cells[s].x != x || cells[s].y != y || cells[s].z != z))
+			s = (s + 1) & mask;
+		return s;
+	}
+
+	// Vertices must be added by increasing index
+	void add(unsigned int vertex, int x, int y, int z){
+		unsigned int none = emptyCell; // resize() takes a reference, emptyCell has no storage
+		if (next.size() <= vertex)
+			next.resize(vertex + 1, none);
+		size_t s = findSlot(x, y, z);
+		Cell & cell = cells[s];
+		if (cell.first == emptyCell){
+			cell.x = x; cell.y = y; cell.z = z;
+			cell.first = cell.last = vertex;
+			used++;
+			growIfNeeded();
+		}else{
+			next[cell.last] = vertex;
+			cell.last = vertex;
+		}
+	}
+
+	void growIfNeeded(){
+		if ((used + 1) * 2 <= cells.size())
+			return;
+		std::vector<Cell> old;
+		old.swap(cells);
+		Cell empty = {0, 0, 0, emptyCell, emptyCell};
+		cells.assign(old.size() * 2, empty);
+		for (size_t i=0; i<old.size(); i++){
+			if (old[i].first != emptyCell)
+				cells[findSlot(old[i].x, old[i].y, old[i].z)] = old[i];
+		}
+	}
+};
+
+// is_near accepts |v1-v2| < 0.01, and v1-v2 itself can be rounded up a bit :
+// cells slightly bigger than 0.01 make sure that such values are at most one cell apart.
+static const double weldCellSize = 0.0101;
+
+static inline int weldCellCoordinate(float v){
+	double c = floor((double)v / weldCellSize);
+	// Huge coordinates all end up in the border cells : slower, but still correct.
+	if (c < -1e9) c = -1e9;
+	if (c > 1e9) c = 1e9;
+	return (int)c;
+}
+
+static inline bool isFiniteVertex(const glm::vec3 & v){
+	// NaNs and infinities give NaN here, and NaN != 0
+	return (v.x - v.x) == 0.0f && (v.y - v.y) == 0.0f && (v.z - v.z) == 0.0f;
+}
+
+// Shared by indexVBO_slow and indexVBO_TBN. in_tangents, in_bitangents, out_tangents and
+// out_bitangents may be NULL ; if not, the tangents of welded vertices are summed.
+// Gives the same result as comparing against every exported vertex in order,
+// since the lowest matching index is always the one that is used.
+static void weldVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+	std::vector<glm::vec3> * in_tangents,
+	std::vector<glm::vec3> * in_bitangents,
+
+	std::vector<unsigned short> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals,
-	unsigned short & result
+	std::vector<glm::vec3> * out_tangents,
+	std::vector<glm::vec3> * out_bitangents
 ){
-	// Lame linear search
+	// Closed meshes usually have about 6 triangle corners per unique vertex, and
+	// close vertices often share a cell
+	VertexWeldGrid grid(out_vertices.size() + in_vertices.size() / 4);
+	out_indices.reserve(out_indices.size() + in_vertices.size());
+
+	// Vertices that were already in out_XXXX can be reused too
 	for ( unsigned int i=0; i<out_vertices.size(); i++ ){
-		if (
-			is_near( in_vertex.x , out_vertices[i].x ) &&
-			is_near( in_vertex.y , out_vertices[i].y ) &&
-			is_near( in_vertex.z , out_vertices[i].z ) &&
-			is_near( in_uv.x     , out_uvs     [i].x ) &&
-			is_near( in_uv.y     , out_uvs     [i].y ) &&
-			is_near( in_normal.x , out_normals [i].x ) &&
-			is_near( in_normal.y , out_normals [i].y ) &&
-			is_near( in_normal.z , out_normals [i].z )
-		){
-			result = i;
-			return true;
+		const glm::vec3 & v = out_vertices[i];
+		if (isFiniteVertex(v))
+			grid.add(i, weldCellCoordinate(v.x), weldCellCoordinate(v.y), weldCellCoordinate(v.z));
+	}
+
+	// For each input vertex
+	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
+
+		const glm::vec3 & position = in_vertices[i];
+		const glm::vec2 & uv       = in_uvs[i];
+		const glm::vec3 & normal   = in_normals[i];
+
+		// A non-finite position is never near anything : it always gets its own vertex
+		bool finite = isFiniteVertex(position);
+		int cx = 0, cy = 0, cz = 0;
+		unsigned int best = VertexWeldGrid::emptyCell;
+
+		if (finite){
+			cx = weldCellCoordinate(position.x);
+			cy = weldCellCoordinate(position.y);
+			cz = weldCellCoordinate(position.z);
+
+			// Try to find a similar vertex in the 27 cells around this one
+			for (int dz=-1; dz<=1; dz++)
+			for (int dy=-1; dy<=1; dy++)
+			for (int dx=-1; dx<=1; dx++){
+				size_t s = grid.findSlot(cx+dx, cy+dy, cz+dz);
+				// Chains are sorted, so we can stop at the first match, or at "best"
+				for (unsigned int j = grid.cells[s].first; j < best; j = grid.next[j]){
+					if (
+						is_near( position.x , out_vertices[j].x ) &&
+						is_near( position.y , out_vertices[j].y ) &&
+						is_near( position.z , out_vertices[j].z ) &&
+						is_near( uv.x       , out_uvs     [j].x ) &&
+						is_near( uv.y       , out_uvs     [j].y ) &&
+						is_near( normal.x   , out_normals [j].x ) &&
+						is_near( normal.y   , out_normals [j].y ) &&
+						is_near( normal.z   , out_normals [j].z )
+					){
+						best = j;
+						break;
+					}
+				}
+			}
+		}
+
+		if ( best != VertexWeldGrid::emptyCell ){ // A similar vertex is already in the VBO, use it instead !
+			out_indices.push_back( (unsigned short)best );
+
+			// Average the tangents and the bitangents
+			if (out_tangents){
+				(*out_tangents)[best] += (*in_tangents)[i];
+				(*out_bitangents)[best] += (*in_bitangents)[i];
+			}
+		}else{ // If not, it needs to be added in the output data.
+			unsigned int newindex = (unsigned int)out_vertices.size();
+			out_vertices.push_back( position );
+			out_uvs     .push_back( uv );
+			out_normals .push_back( normal );
+			if (out_tangents){
+				out_tangents  ->push_back( (*in_tangents)[i] );
+				out_bitangents->push_back( (*in_bitangents)[i] );
+			}
+			out_indices .push_back( (unsigned short)newindex );
+			if (finite)
+				grid.add(newindex, cx, cy, cz);
 		}
 	}
-	// No other vertex could be used instead.
-	// Looks like we'll have to add it to the VBO.
-	return false;
 }
 
 void indexVBO_slow(
@@ -56,82 +209,175 @@ void indexVBO_slow(
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
-	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
+	weldVBO(in_vertices, in_uvs, in_normals, NULL, NULL,
+		out_indices, out_vertices, out_uvs, out_normals, NULL, NULL);
+}
 
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
+// Open-addressing hash table from a vertex to its index in out_XXXX.
+// Each slot keeps the full hash, so that most mismatches are rejected
+// without looking at the vertex data, and so that growing doesn't rehash anything.
+struct VertexHashTable{
+	struct Slot{
+		unsigned int hash;
+		unsigned int index; // emptySlot if unused
+	};
+	static const unsigned int emptySlot = 0xFFFFFFFFu;
 
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
-		}
+	std::vector<Slot> slots;
+	size_t used;
+
+	explicit VertexHashTable(size_t expectedCount) : used(0){
+		size_t capacity = 64;
+		while (capacity < expectedCount * 2)
+			capacity *= 2;
+		Slot empty = {0, emptySlot};
+		slots.assign(capacity, empty);
 	}
-}
 
-struct PackedVertex{
-	glm::vec3 position;
-	glm::vec2 uv;
-	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const{
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))>0;
-	};
+	// Keep the table at most half full
+	void growIfNeeded(){
+		if ((used + 1) * 2 <= slots.size())
+			return;
+		std::vector<Slot> old;
+		old.swap(slots);
+		Slot empty = {0, emptySlot};
+		slots.assign(old.size() * 2, empty);
+		size_t mask = slots.size() - 1;
+		for (size_t i=0; i<old.size(); i++){
+			if (old[i].index == emptySlot)
+				continue;
+			size_t s = old[i].hash & mask;
+			while (slots[s].index != emptySlot)
+				s = (s + 1) & mask;
+			slots[s] = old[i];
+		}
+	}
 };
 
-bool getSimilarVertexIndex_fast( 
-	PackedVertex & packed, 
-	std::map<PackedVertex,unsigned short> & VertexToOutIndex,
-	unsigned short & result
+static inline unsigned int hashVertex(const glm::vec3 & position, const glm::vec2 & uv, const glm::vec3 & normal){
+	unsigned int words[8];
+	memcpy(&words[0], &position, sizeof(glm::vec3));
+	memcpy(&words[3], &uv,       sizeof(glm::vec2));
+	memcpy(&words[5], &normal,   sizeof(glm::vec3));
+	unsigned long long h = 0;
+	for (int i=0; i<8; i++)
+		h = (h ^ words[i]) * 0x9E3779B97F4A7C15ull;
+	return (unsigned int)(h >> 32) ^ (unsigned int)h;
+}
+
+// Same bits = same vertex, like the std::map<PackedVertex> this replaces
+static inline bool sameVertex(
+	const glm::vec3 & p1, const glm::vec2 & uv1, const glm::vec3 & n1,
+	const glm::vec3 & p2, const glm::vec2 & uv2, const glm::vec3 & n2
 ){
-	std::map<PackedVertex,unsigned short>::iterator it = VertexToOutIndex.find(packed);
-	if ( it == VertexToOutIndex.end() ){
-		return false;
-	}else{
-		result = it->second;
-		return true;
-	}
+	return memcmp(&p1, &p2, sizeof(glm::vec3)) == 0 && memcmp(&uv1, &uv2, sizeof(glm::vec2)) == 0 && memcmp(&n1, &n2, sizeof(glm::vec3)) == 0;
 }
 
-void indexVBO(
+template <typename IndexType>
+bool indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<IndexType> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
 ){
-	std::map<PackedVertex,unsigned short> VertexToOutIndex;
+	const size_t maxIndex = std::numeric_limits<IndexType>::max();
+
+	// Closed meshes usually have about 6 triangle corners per unique vertex
+	VertexHashTable table(in_vertices.size() / 4);
+	out_indices.reserve(out_indices.size() + in_vertices.size());
 
 	// For each input vertex
 	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
 
-		PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
-		
+		const glm::vec3 & position = in_vertices[i];
+		const glm::vec2 & uv       = in_uvs[i];
+		const glm::vec3 & normal   = in_normals[i];
+		unsigned int hash = hashVertex(position, uv, normal);
 
 		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex_fast( packed, VertexToOutIndex, index);
+		size_t mask = table.slots.size() - 1;
+		size_t s = hash & mask;
+		bool found = false;
+		while (table.slots[s].index != VertexHashTable::emptySlot){
+			const VertexHashTable::Slot & slot = table.slots[s];
+			if (slot.hash == hash && sameVertex(position, uv, normal, out_vertices[slot.index], out_uvs[slot.index], out_normals[slot.index])){
+				found = true;
+				break;
+			}
+			s = (s + 1) & mask;
+		}
 
 		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
+			out_indices.push_back( (IndexType)table.slots[s].index );
 		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			unsigned short newindex = (unsigned short)out_vertices.size() - 1;
-			out_indices .push_back( newindex );
-			VertexToOutIndex[ packed ] = newindex;
+			size_t newindex = out_vertices.size();
+			if (newindex > maxIndex){
+				printf("indexVBO : too many unique vertices for %u-bit indices\n", (unsigned int)(8*sizeof(IndexType)));
+				return false;
+			}
+			out_vertices.push_back( position );
+			out_uvs     .push_back( uv );
+			out_normals .push_back( normal );
+			out_indices .push_back( (IndexType)newindex );
+
+			table.slots[s].hash = hash;
+			table.slots[s].index = (unsigned int)newindex;
+			table.used++;
+			table.growIfNeeded();
 		}
 	}
+	return true;
 }
 
+template bool indexVBO<unsigned short>(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned short> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+template bool indexVBO<unsigned int>(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+unsigned int indexVBO_narrowest(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned short> & out_indices16,
+	std::vector<unsigned int> & out_indices32,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+){
+	out_indices16.clear();
+	out_indices32.clear();
+	indexVBO(in_vertices, in_uvs, in_normals, out_indices32, out_vertices, out_uvs, out_normals);
+
+	if (out_vertices.size() > 65536)
+		return sizeof(unsigned int);
+
+	// Everything fits in 16 bits : half the memory for the index buffer
+	out_indices16.assign(out_indices32.begin(), out_indices32.end());
+	std::vector<unsigned int>().swap(out_indices32);
+	return sizeof(unsigned short);
+}
 
 
 
@@ -152,26 +398,6 @@ void indexVBO_TBN(
 	std::vector<glm::vec3> & out_tangents,
 	std::vector<glm::vec3> & out_bitangents
 ){
-	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex(in_vertices[i], in_uvs[i], in_normals[i],     out_vertices, out_uvs, out_normals, index);
-
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-
-			// Average the tangents and the bitangents
-			out_tangents[index] += in_tangents[i];
-			out_bitangents[index] += in_bitangents[i];
-		}else{ // If not, it needs to be added in the output data.
-			out_vertices.push_back( in_vertices[i]);
-			out_uvs     .push_back( in_uvs[i]);
-			out_normals .push_back( in_normals[i]);
-			out_tangents .push_back( in_tangents[i]);
-			out_bitangents .push_back( in_bitangents[i]);
-			out_indices .push_back( (unsigned short)out_vertices.size() - 1 );
-		}
-	}
+	weldVBO(in_vertices, in_uvs, in_normals, &in_tangents, &in_bitangents,
+		out_indices, out_vertices, out_uvs, out_normals, &out_tangents, &out_bitangents);
 }
@@ -1,12 +1,32 @@
 #ifndef VBOINDEXER_HPP
 #define VBOINDEXER_HPP
 
-void indexVBO(
+// Builds an indexed VBO : identical vertices are stored only once.
+// IndexType is unsigned short or unsigned int. Returns false if there are more
+// unique vertices than IndexType can address.
+template <typename IndexType>
+bool indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<IndexType> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals
+);
+
+// Same as indexVBO, but picks the narrowest index type that fits.
+// Returns the size of an index in bytes :
+// - 2 : out_indices16 is filled, draw with GL_UNSIGNED_SHORT
+// - 4 : out_indices32 is filled, draw with GL_UNSIGNED_INT
+unsigned int indexVBO_narrowest(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned short> & out_indices16,
+	std::vector<unsigned int> & out_indices32,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
 	std::vector<glm::vec3> & out_normals
@@ -0,0 +1,307 @@
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VERTEXFORMAT_SSE2 1
+#endif
+
+#include "vertexformat.hpp"
+
+static unsigned int formatSize(VertexAttribute attribute, VertexFormat format){
+	switch (format){
+		case VERTEX_FORMAT_FLOAT:            return attribute == VERTEX_UV ? 2*sizeof(float) : 3*sizeof(float);
+		case VERTEX_FORMAT_HALF:             return 2*sizeof(unsigned short);
+		case VERTEX_FORMAT_UNORM16:          return 4*sizeof(unsigned short);
+		case VERTEX_FORMAT_SNORM_10_10_10_2: return sizeof(unsigned int);
+		case VERTEX_FORMAT_OCTAHEDRAL:       return 2*sizeof(short);
+	}
+	return 0;
+}
+
+static bool isValidFormat(VertexAttribute attribute, VertexFormat format){
+	switch (format){
+		case VERTEX_FORMAT_FLOAT:            return true;
+		case VERTEX_FORMAT_HALF:             return attribute == VERTEX_UV;
+		case VERTEX_FORMAT_UNORM16:          return attribute == VERTEX_POSITION;
+		case VERTEX_FORMAT_SNORM_10_10_10_2:
+		case VERTEX_FORMAT_OCTAHEDRAL:       return attribute == VERTEX_NORMAL || attribute == VERTEX_TANGENT || attribute == VERTEX_BITANGENT;
+	}
+	return false;
+}
+
+bool createVertexLayout(const VertexAttributeDesc * attributes, unsigned int count, VertexLayout & layout){
+
+	layout.attributes.clear();
+	layout.offsets.clear();
+	layout.stride = 0;
+
+	bool used[VERTEX_BITANGENT+1] = {false};
+	for (unsigned int i=0; i<count; i++){
+		const VertexAttributeDesc & desc = attributes[i];
+		if (desc.attribute < VERTEX_POSITION || desc.attribute > VERTEX_BITANGENT || used[desc.attribute]){
+			printf("createVertexLayout : attribute %u is invalid or used twice\n", i);
+			return false;
+		}
+		if (!isValidFormat(desc.attribute, desc.format)){
+			printf("createVertexLayout : attribute %u can't use format %d\n", i, (int)desc.format);
+			return false;
+		}
+		used[desc.attribute] = true;
+		layout.attributes.push_back(desc);
+		layout.offsets.push_back(layout.stride);
+		layout.stride += formatSize(desc.attribute, desc.format);
+	}
+	return true;
+}
+
+// The conversion is done in blocks of vertices, so that the temporary
+// float and integer values stay in the L1 cache.
+static const size_t blockSize = 1024;
+
+// out[i] = round(clamp(in[i], lo, hi) * scale[i%4]), halfway cases rounded away from zero,
+// which is exactly what glm's packing functions do.
+// "scale" repeats every 4 values : 2-component formats give it twice.
+static void quantize(const float * in, int * out, size_t count, float lo, float hi, const float scale[4]){
+	size_t i = 0;
+#ifdef VERTEXFORMAT_SSE2
+	const __m128 vlo = _mm_set1_ps(lo);
+	const __m128 vhi = _mm_set1_ps(hi);
+	const __m128 vscale = _mm_loadu_ps(scale);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 minusHalf = _mm_set1_ps(-0.5f);
+	for (; i + 4 <= count; i += 4){
+		__m128 v = _mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), vlo), vhi), vscale);
+		// Truncate, then add or remove 1 where the fractional part is at least one half.
+		// v - trunc(v) is exact, so this is the same as round().
+		__m128i t = _mm_cvttps_epi32(v);
+		__m128 fraction = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+		t = _mm_sub_epi32(t, _mm_castps_si128(_mm_cmpge_ps(fraction, half)));      // true = -1
+		t = _mm_add_epi32(t, _mm_castps_si128(_mm_cmple_ps(fraction, minusHalf)));
+		_mm_storeu_si128((__m128i *)(out + i), t);
+	}
+#endif
+	for (; i < count; i++){
+		float v = in[i] < lo ? lo : (in[i] > hi ? hi : in[i]);
+		v *= scale[i % 4];
+		int t = (int)v;
+		float fraction = v - (float)t;
+		out[i] = t + (fraction >= 0.5f) - (fraction <= -0.5f);
+	}
+}
+
+static inline glm::vec3 safeNormalize(const glm::vec3 & v){
+	float length = glm::length(v);
+	return length > 0.0f ? v / length : glm::vec3(0.0f); // Also catches NaNs
+}
+
+// Maps a unit vector on the octahedron |x|+|y|+|z| = 1, then unfolds the
+// lower half (z < 0) on the corners of the [-1,1] square.
+static inline glm::vec2 octahedralEncode(const glm::vec3 & n){
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (!(l1 > 0.0f))
+		return glm::vec2(0.0f);
+	glm::vec2 p(n.x / l1, n.y / l1);
+	if (n.z < 0.0f){
+		glm::vec2 folded(1.0f - fabsf(p.y), 1.0f - fabsf(p.x));
+		p.x = p.x >= 0.0f ? folded.x : -folded.x;
+		p.y = p.y >= 0.0f ? folded.y : -folded.y;
+	}
+	return p;
+}
+
+// Writes one attribute of vertices [first, first+count) into the interleaved buffer.
+static void convertBlock(
+	const VertexAttributeDesc & desc,
+	const VertexStreams & streams,
+	size_t first, size_t count,
+	const glm::vec3 & boxMin, float boxScale,
+	unsigned char * out, unsigned int stride,
+	float * tmpFloats, int * tmpInts
+){
+	const glm::vec3 * vectors = NULL;
+	switch (desc.attribute){
+		case VERTEX_POSITION:  vectors = streams.vertices;   break;
+		case VERTEX_NORMAL:    vectors = streams.normals;    break;
+		case VERTEX_TANGENT:   vectors = streams.tangents;   break;
+		case VERTEX_BITANGENT: vectors = streams.bitangents; break;
+		case VERTEX_UV: break;
+	}
+
+	switch (desc.format){
+
+	case VERTEX_FORMAT_FLOAT:
+		if (desc.attribute == VERTEX_UV){
+			for (size_t i=0; i<count; i++)
+				memcpy(out + i*stride, &streams.uvs[first+i], sizeof(glm::vec2));
+		}else{
+			for (size_t i=0; i<count; i++)
+				memcpy(out + i*stride, &vectors[first+i], sizeof(glm::vec3));
+		}
+		break;
+
+	case VERTEX_FORMAT_HALF:
+		for (size_t i=0; i<count; i++){
+			glm::uint packed = glm::packHalf2x16(streams.uvs[first+i]);
+			memcpy(out + i*stride, &packed, sizeof(packed));
+		}
+		break;
+
+	case VERTEX_FORMAT_UNORM16: {
+		for (size_t i=0; i<count; i++){
+			glm::vec3 p = (vectors[first+i] - boxMin) * boxScale;
+			tmpFloats[4*i+0] = p.x;
+			tmpFloats[4*i+1] = p.y;
+			tmpFloats[4*i+2] = p.z;
+			tmpFloats[4*i+3] = 1.0f;
+		}
+		const float scale[4] = {65535.0f, 65535.0f, 65535.0f, 65535.0f};
+		quantize(tmpFloats, tmpInts, 4*count, 0.0f, 1.0f, scale);
+		for (size_t i=0; i<count; i++){
+			unsigned short packed[4] = {
+				(unsigned short)tmpInts[4*i+0], (unsigned short)tmpInts[4*i+1],
+				(unsigned short)tmpInts[4*i+2], (unsigned short)tmpInts[4*i+3]
+			};
+			memcpy(out + i*stride, packed, sizeof(packed));
+		}
+		break;
+	}
+
+	case VERTEX_FORMAT_SNORM_10_10_10_2: {
+		for (size_t i=0; i<count; i++){
+			glm::vec3 v = safeNormalize(vectors[first+i]);
+			float w = 1.0f;
+			// Handedness of the tangent basis, only known if we have the 3 vectors
+			if (desc.attribute == VERTEX_TANGENT && streams.normals != NULL && streams.bitangents != NULL){
+				if (glm::dot(glm::cross(streams.normals[first+i], vectors[first+i]), streams.bitangents[first+i]) < 0.0f)
+					w = -1.0f;
+			}
+			tmpFloats[4*i+0] = v.x;
+			tmpFloats[4*i+1] = v.y;
+			tmpFloats[4*i+2] = v.z;
+			tmpFloats[4*i+3] = w;
+		}
+		const float scale[4] = {511.0f, 511.0f, 511.0f, 1.0f};
+		quantize(tmpFloats, tmpInts, 4*count, -1.0f, 1.0f, scale);
+		for (size_t i=0; i<count; i++){
+			unsigned int packed =
+				 ((unsigned int)tmpInts[4*i+0] & 0x3FF)        |
+				(((unsigned int)tmpInts[4*i+1] & 0x3FF) << 10) |
+				(((unsigned int)tmpInts[4*i+2] & 0x3FF) << 20) |
+				(((unsigned int)tmpInts[4*i+3] & 0x3)   << 30);
+			memcpy(out + i*stride, &packed, sizeof(packed));
+		}
+		break;
+	}
+
+	case VERTEX_FORMAT_OCTAHEDRAL: {
+		for (size_t i=0; i<count; i++){
+			glm::vec2 e = octahedralEncode(vectors[first+i]);
+			tmpFloats[2*i+0] = e.x;
+			tmpFloats[2*i+1] = e.y;
+		}
+		const float scale[4] = {32767.0f, 32767.0f, 32767.0f, 32767.0f};
+		quantize(tmpFloats, tmpInts, 2*count, -1.0f, 1.0f, scale);
+		for (size_t i=0; i<count; i++){
+			short packed[2] = { (short)tmpInts[2*i+0], (short)tmpInts[2*i+1] };
+			memcpy(out + i*stride, packed, sizeof(packed));
+		}
+		break;
+	}
+	}
+}
+
+bool interleaveVertices(
+	const VertexLayout & layout,
+	const VertexStreams & streams,
+	std::vector<unsigned char> & out_data,
+	glm::mat4 & out_dequantization
+){
+	out_dequantization = glm::mat4(1.0f);
+	out_data.clear();
+
+	// Check that we have everything, and find the bounding box if positions are quantized
+	glm::vec3 boxMin(0.0f);
+	float boxScale = 1.0f;
+	for (size_t a=0; a<layout.attributes.size(); a++){
+		const VertexAttributeDesc & desc = layout.attributes[a];
+		const void * data = NULL;
+		switch (desc.attribute){
+			case VERTEX_POSITION:  data = streams.vertices;   break;
+			case VERTEX_UV:        data = streams.uvs;        break;
+			case VERTEX_NORMAL:    data = streams.normals;    break;
+			case VERTEX_TANGENT:   data = streams.tangents;   break;
+			case VERTEX_BITANGENT: data = streams.bitangents; break;
+		}
+		if (data == NULL && streams.count > 0){
+			printf("interleaveVertices : the layout uses attribute %d, which is missing\n", (int)desc.attribute);
+			return false;
+		}
+
+		if (desc.attribute == VERTEX_POSITION && desc.format == VERTEX_FORMAT_UNORM16 && streams.count > 0){
+			glm::vec3 boxMax = streams.vertices[0];
+			boxMin = streams.vertices[0];
+			for (size_t i=1; i<streams.count; i++){
+				boxMin = glm::min(boxMin, streams.vertices[i]);
+				boxMax = glm::max(boxMax, streams.vertices[i]);
+			}
+			// Same scale on all axes : the dequantization is then a similarity,
+			// and can go in the model matrix without breaking the normals.
+			glm::vec3 extent = boxMax - boxMin;
+			float size = glm::max(extent.x, glm::max(extent.y, extent.z));
+			if (size > 0.0f){
+				boxScale = 1.0f / size;
+				out_dequantization = glm::scale(glm::translate(glm::mat4(1.0f), boxMin), glm::vec3(size));
+			}else{
+				boxScale = 0.0f;
+				out_dequantization = glm::translate(glm::mat4(1.0f), boxMin);
+			}
+		}
+	}
+
+	out_data.resize(streams.count * layout.stride);
+
+	std::vector<float> tmpFloats(4 * blockSize);
+	std::vector<int> tmpInts(4 * blockSize);
+
+	for (size_t first=0; first<streams.count; first+=blockSize){
+		size_t count = streams.count - first < blockSize ? streams.count - first : blockSize;
+		unsigned char * vertex = &out_data[first * layout.stride];
+		for (size_t a=0; a<layout.attributes.size(); a++){
+			convertBlock(layout.attributes[a], streams, first, count, boxMin, boxScale,
+				vertex + layout.offsets[a], layout.stride, &tmpFloats[0], &tmpInts[0]);
+		}
+	}
+	return true;
+}
+
+void enableVertexLayout(const VertexLayout & layout){
+	for (size_t a=0; a<layout.attributes.size(); a++){
+		const VertexAttributeDesc & desc = layout.attributes[a];
+		GLint size = 3;
+		GLenum type = GL_FLOAT;
+		GLboolean normalized = GL_FALSE;
+		switch (desc.format){
+			case VERTEX_FORMAT_FLOAT:            size = desc.attribute == VERTEX_UV ? 2 : 3; break;
+			case VERTEX_FORMAT_HALF:             size = 2; type = GL_HALF_FLOAT;              break;
+			case VERTEX_FORMAT_UNORM16:          size = 4; type = GL_UNSIGNED_SHORT;          normalized = GL_TRUE; break;
+			case VERTEX_FORMAT_SNORM_10_10_10_2: size = 4; type = GL_INT_2_10_10_10_REV;      normalized = GL_TRUE; break;
+			case VERTEX_FORMAT_OCTAHEDRAL:       size = 2; type = GL_SHORT;                   normalized = GL_TRUE; break;
+		}
+		glEnableVertexAttribArray(desc.location);
+		glVertexAttribPointer(desc.location, size, type, normalized, layout.stride, (void*)(size_t)layout.offsets[a]);
+	}
+}
+
+void disableVertexLayout(const VertexLayout & layout){
+	for (size_t a=0; a<layout.attributes.size(); a++)
+		glDisableVertexAttribArray(layout.attributes[a].location);
+}
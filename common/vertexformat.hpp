@@ -0,0 +1,90 @@
+#ifndef VERTEXFORMAT_HPP
+#define VERTEXFORMAT_HPP
+
+// Builds a single interleaved vertex buffer out of the separate arrays that
+// loadOBJ / indexVBO / computeTangentBasis produce, optionally quantized :
+//
+//   positions, uvs, normals (floats)       : 32 bytes per vertex
+//   UNORM16 + HALF + SNORM_10_10_10_2      : 16 bytes per vertex
+//
+// The layout is described once with a list of VertexAttributeDesc, then used
+// both to fill the buffer (interleaveVertices) and to set up the vertex
+// attributes (enableVertexLayout).
+
+enum VertexAttribute{
+	VERTEX_POSITION,
+	VERTEX_UV,
+	VERTEX_NORMAL,
+	VERTEX_TANGENT,
+	VERTEX_BITANGENT
+};
+
+enum VertexFormat{
+	// Any attribute : 32-bit floats, as given. 12 bytes (8 for UVs).
+	VERTEX_FORMAT_FLOAT,
+	// UVs only : 2 16-bit floats (GL_HALF_FLOAT). 4 bytes.
+	VERTEX_FORMAT_HALF,
+	// Positions only : 16 bits per coordinate, normalized inside the bounding box,
+	// and w = 1. 8 bytes. The shader gets values in [0,1] : multiply them by the
+	// dequantization matrix returned by interleaveVertices().
+	VERTEX_FORMAT_UNORM16,
+	// Normals, tangents, bitangents : normalized, then 10 bits per coordinate
+	// (GL_INT_2_10_10_10_REV). 4 bytes. Tangents keep the handedness of the
+	// tangent basis in w, so the bitangent can be rebuilt as cross(normal, tangent.xyz) * tangent.w
+	VERTEX_FORMAT_SNORM_10_10_10_2,
+	// Normals, tangents, bitangents : octahedral mapping, 2 x 16 bits. 4 bytes,
+	// but about 25x more precise than SNORM_10_10_10_2. The shader has to decode it :
+	//   vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	//   float t = max(-n.z, 0.0);
+	//   n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	//   n = normalize(n);
+	VERTEX_FORMAT_OCTAHEDRAL
+};
+
+struct VertexAttributeDesc{
+	VertexAttribute attribute;
+	VertexFormat format;
+	unsigned int location; // layout(location = ...) in the vertex shader
+};
+
+struct VertexLayout{
+	std::vector<VertexAttributeDesc> attributes;
+	std::vector<unsigned int> offsets; // Byte offset of each attribute in a vertex
+	unsigned int stride;               // Bytes per vertex, always a multiple of 4
+};
+
+// The vertex data to interleave. Attributes that the layout doesn't use can be NULL.
+struct VertexStreams{
+	size_t count;
+	const glm::vec3 * vertices;
+	const glm::vec2 * uvs;
+	const glm::vec3 * normals;
+	const glm::vec3 * tangents;
+	const glm::vec3 * bitangents;
+};
+
+// Computes the offsets and the stride. Returns false if a format can't be used
+// for its attribute (UNORM16 normals, for instance), or if an attribute is there twice.
+bool createVertexLayout(const VertexAttributeDesc * attributes, unsigned int count, VertexLayout & layout);
+
+// Fills out_data with streams.count vertices of layout.stride bytes.
+// out_dequantization maps the stored positions back to model space : use
+// ModelMatrix * out_dequantization instead of ModelMatrix. It is the identity
+// if positions are floats, and a translation + uniform scale otherwise, so
+// normals aren't distorted by it.
+// Returns false if the layout needs an attribute that streams doesn't have.
+bool interleaveVertices(
+	const VertexLayout & layout,
+	const VertexStreams & streams,
+	std::vector<unsigned char> & out_data,
+	glm::mat4 & out_dequantization
+);
+
+// glEnableVertexAttribArray + glVertexAttribPointer for every attribute of the layout,
+// reading from the GL_ARRAY_BUFFER that is currently bound.
+void enableVertexLayout(const VertexLayout & layout);
+
+// glDisableVertexAttribArray for every attribute of the layout.
+void disableVertexLayout(const VertexLayout & layout);
+
+#endif
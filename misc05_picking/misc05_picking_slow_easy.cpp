@@ -23,6 +23,7 @@ using namespace glm;
 
 #include <common/shader.hpp>
 #include <common/texture.hpp>
+#include <common/texturecache.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
@@ -101,8 +102,12 @@ int main( void )
 	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
 	GLuint PickingMatrixID = glGetUniformLocation(pickingProgramID, "MVP");
 
-	// Load the texture
-	GLuint Texture = loadDDS("uvmap.DDS");
+	// Load the textures. Each monkey asks for its own, but they are all the same file :
+	// the texture cache only loads it once, and hands the same texture to every monkey.
+	setTextureCacheBudget(256 << 20);
+	std::vector<GLuint> Textures(100);
+	for(int i=0; i<100; i++)
+		Textures[i] = acquireTexture("uvmap.DDS");
 	
 	// Get a handle for our "myTextureSampler" uniform
 	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
@@ -320,7 +325,7 @@ int main( void )
 
 			// Bind our texture in Texture Unit 0
 			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, Texture);
+			glBindTexture(GL_TEXTURE_2D, Textures[i]);
 			// Set our "myTextureSampler" sampler to use Texture Unit 0
 			glUniform1i(TextureID, 0);
 
@@ -392,7 +397,11 @@ int main( void )
 	glDeleteBuffers(1, &normalbuffer);
 	glDeleteBuffers(1, &elementbuffer);
 	glDeleteProgram(programID);
-	glDeleteTextures(1, &Texture);
+	for(int i=0; i<100; i++)
+		releaseTexture(Textures[i]);
+	TextureCacheStats textureStats = getTextureCacheStats();
+	printf("Texture cache : %llu hits, %llu misses, %llu evictions, %llu bytes\n", textureStats.hits + textureStats.contentHits, textureStats.misses, textureStats.evictions, textureStats.residentBytes);
+	cleanupTextureCache();
 	glDeleteVertexArrays(1, &VertexArrayID);
 
 	// Close OpenGL window and terminate GLFW
@@ -0,0 +1,156 @@
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <chrono>
+
+// Include GLEW : only for the GL constants of the .DDS formats, no window is opened
+#include <GL/glew.h>
+
+#include <common/file_utils.hpp>
+#include <common/texture.hpp>
+#include <common/texturecompression.hpp>
+
+// Measures the quality and the speed of the block compression of common/texturecompression.cpp
+// on the images of the tutorials. .DDS files are decoded first, and compressed again from their texels.
+//
+// Usage : misc06_texture_compression [image.bmp|image.DDS ...]
+
+typedef std::chrono::steady_clock Clock;
+
+// Runs "task" again and again for at least 0.2 seconds. Returns the average time of a run, in seconds.
+template <typename Task>
+static double timeTask(const Task & task){
+	int runs = 0;
+	Clock::time_point start = Clock::now();
+	double elapsed;
+	do{
+		task();
+		runs++;
+		elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+	}while (elapsed < 0.2);
+	return elapsed / runs;
+}
+
+// DXT3 (BC2) isn't one of the formats of texturecompression.hpp, but the .DDS files of the
+// tutorials use it : 4 bits of alpha per pixel, then a BC1 color block that always has 4 colors.
+static void decompressDXT3(const unsigned char * blocks, unsigned int width, unsigned int height, std::vector<unsigned char> & out_pixels){
+	out_pixels.resize((size_t)width * height * 4);
+	unsigned int blocksPerRow = (width + 3) / 4;
+	for (unsigned int by=0; by<(height + 3) / 4; by++){
+		for (unsigned int bx=0; bx<blocksPerRow; bx++){
+			const unsigned char * block = blocks + ((size_t)by * blocksPerRow + bx) * 16;
+			unsigned char colors[4][3];
+			for (int e=0; e<2; e++){
+				unsigned int c = block[8 + 2*e] | (block[9 + 2*e] << 8);
+				colors[e][0] = (unsigned char)(((c >> 11) & 31) * 255 / 31);
+				colors[e][1] = (unsigned char)(((c >> 5) & 63) * 255 / 63);
+				colors[e][2] = (unsigned char)((c & 31) * 255 / 31);
+			}
+			for (int k=0; k<3; k++){
+				colors[2][k] = (unsigned char)((2 * colors[0][k] + colors[1][k]) / 3);
+				colors[3][k] = (unsigned char)((colors[0][k] + 2 * colors[1][k]) / 3);
+			}
+			unsigned int indices = block[12] | (block[13] << 8) | (block[14] << 16) | ((unsigned int)block[15] << 24);
+			for (unsigned int i=0; i<16; i++){
+				unsigned int x = bx * 4 + i % 4, y = by * 4 + i / 4;
+				if (x >= width || y >= height)
+					continue;
+				unsigned char * pixel = &out_pixels[((size_t)y * width + x) * 4];
+				const unsigned char * color = colors[(indices >> (2 * i)) & 3];
+				pixel[0] = color[0];
+				pixel[1] = color[1];
+				pixel[2] = color[2];
+				pixel[3] = (unsigned char)(((block[i / 2] >> (4 * (i & 1))) & 15) * 17);
+			}
+		}
+	}
+}
+
+// RGBA texels of a .BMP file, or of the first level of a DXT1, DXT3, DXT5 or BC5 .DDS file
+static bool loadImage(const char * path, unsigned int & width, unsigned int & height, std::vector<unsigned char> & rgba){
+	size_t length = strlen(path);
+	if (length > 4 && (strcmp(path + length - 4, ".DDS") == 0 || strcmp(path + length - 4, ".dds") == 0)){
+		MappedFile file;
+		if (!mapFile(path, file)){
+			printf("%s could not be opened\n", path);
+			return false;
+		}
+		DDSImage image;
+		bool ok = parseDDS((const unsigned char *)file.data, file.size, image);
+		if (ok){
+			width = image.width;
+			height = image.height;
+			switch (image.internalFormat){
+			case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: decompressImage(image.data, width, height, BLOCK_FORMAT_BC1, rgba); break;
+			case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: decompressDXT3(image.data, width, height, rgba); break;
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: decompressImage(image.data, width, height, BLOCK_FORMAT_BC3, rgba); break;
+			case GL_COMPRESSED_RG_RGTC2:           decompressImage(image.data, width, height, BLOCK_FORMAT_BC5, rgba); break;
+			default:
+				printf("%s : only DXT1, DXT3, DXT5 and BC5 .DDS files can be decoded\n", path);
+				ok = false;
+			}
+		}
+		unmapFile(file);
+		return ok;
+	}
+
+	unsigned int channels;
+	std::vector<unsigned char> data;
+	if (!readBMP(path, width, height, channels, data))
+		return false;
+	// 24 bits files get their green channel as alpha, so that BC3 has a real alpha to encode
+	size_t pixelCount = (size_t)width * height;
+	rgba.resize(pixelCount * 4);
+	for (size_t i=0; i<pixelCount; i++){
+		for (unsigned int c=0; c<channels; c++)
+			rgba[4*i+c] = data[channels*i+c];
+		if (channels == 3)
+			rgba[4*i+3] = data[3*i+1];
+	}
+	return true;
+}
+
+int main(int argc, char * argv[])
+{
+	std::vector<std::string> paths;
+	for (int i=1; i<argc; i++)
+		paths.push_back(argv[i]);
+	if (paths.empty()){
+		paths.push_back("../tutorial05_textured_cube/uvtemplate.bmp");
+		paths.push_back("../tutorial13_normal_mapping/normal.bmp");
+		paths.push_back("../misc05_picking/screenshot.bmp");
+		paths.push_back("../tutorial15_lightmaps/lightmap.DDS");
+		paths.push_back("../tutorial13_normal_mapping/diffuse.DDS");
+	}
+
+	const char * formatNames[3] = { "BC1", "BC3", "BC5" };
+	const BlockFormat formats[3] = { BLOCK_FORMAT_BC1, BLOCK_FORMAT_BC3, BLOCK_FORMAT_BC5 };
+	const unsigned int comparedChannels[3] = { 3, 4, 2 }; // BC1 : RGB, BC3 : RGBA, BC5 : RG
+
+	printf("\n%-40s %-6s %9s %14s %14s %12s\n", "image", "format", "PSNR", "encode 1 thr.", "encode all", "decode");
+	for (size_t i=0; i<paths.size(); i++){
+		unsigned int width, height;
+		std::vector<unsigned char> pixels;
+		if (!loadImage(paths[i].c_str(), width, height, pixels))
+			continue;
+		double megaPixels = (double)width * height / 1000000.0;
+
+		for (int f=0; f<3; f++){
+			std::vector<unsigned char> blocks, decoded;
+			double encodeSingle = timeTask([&](){ compressImage(&pixels[0], width, height, 4, formats[f], blocks, 1); });
+			double encodeAll    = timeTask([&](){ compressImage(&pixels[0], width, height, 4, formats[f], blocks, 0); });
+			double decode       = timeTask([&](){ decompressImage(&blocks[0], width, height, formats[f], decoded); });
+			double psnr = computePSNR(&pixels[0], 4, &decoded[0], 4, (size_t)width * height, comparedChannels[f]);
+
+			char name[64];
+			snprintf(name, sizeof(name), "%s %ux%u", paths[i].substr(paths[i].find_last_of("/\\") + 1).c_str(), width, height);
+			printf("%-40s %-6s %6.1f dB %9.1f MP/s %9.1f MP/s %7.1f MP/s\n", f == 0 ? name : "", formatNames[f], psnr,
+				megaPixels / encodeSingle, megaPixels / encodeAll, megaPixels / decode);
+		}
+	}
+
+	return 0;
+}
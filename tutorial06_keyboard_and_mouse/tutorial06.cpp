@@ -17,6 +17,7 @@ using namespace glm;
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
+#include <common/mainloop.hpp>
 
 int main( void )
 {
@@ -180,7 +181,16 @@ int main( void )
 	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(g_uv_buffer_data), g_uv_buffer_data, GL_STATIC_DRAW);
 
+	// The camera moves by steps of 1/120 s, and at most 120 frames per second are drawn
+	initMainLoop(1.0/120.0, 1.0/120.0);
+	double lastTitleTime = glfwGetTime();
+
 	do{
+		// Read the mouse and the keyboard, then simulate the steps that are due
+		beginMainLoopFrame();
+		pollControls();
+		while (stepMainLoop())
+			updateControls((float)getMainLoopStep());
 
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -188,8 +198,8 @@ int main( void )
 		// Use our shader
 		glUseProgram(programID);
 
-		// Compute the MVP matrix from keyboard and mouse input
-		computeMatricesFromInputs();
+		// Compute the MVP matrix from the camera, between its last two steps
+		interpolateControls(getMainLoopAlpha());
 		glm::mat4 ProjectionMatrix = getProjectionMatrix();
 		glm::mat4 ViewMatrix = getViewMatrix();
 		glm::mat4 ModelMatrix = glm::mat4(1.0);
@@ -237,12 +247,22 @@ int main( void )
 
 		// Swap buffers
 		glfwSwapBuffers(window);
-		glfwPollEvents();
+		endMainLoopFrame();
+
+		// Once per second, show how long the frames take
+		if (glfwGetTime() - lastTitleTime > 1.0){
+			char title[128];
+			sprintf(title, "Tutorial 0 - Keyboard and Mouse - %.2f ms per frame, %.2f ms of input latency", getMainLoopFrameTime(), getMainLoopLatency());
+			glfwSetWindowTitle(window, title);
+			lastTitleTime = glfwGetTime();
+		}
 
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
 
+	cleanupMainLoop();
+
 	// Cleanup VBO and shader
 	glDeleteBuffers(1, &vertexbuffer);
 	glDeleteBuffers(1, &uvbuffer);
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <vector>
+#include <string>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -16,10 +17,72 @@ GLFWwindow* window;
 using namespace glm;
 
 #include <common/shader.hpp>
+#include <common/shaderreflection.hpp>
 #include <common/texture.hpp>
+#include <common/textureatlas.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/meshcache.hpp>
+#include <common/vertexformat.hpp>
+#include <common/meshlod.hpp>
+#include <common/meshlet.hpp>
+
+// Distance from the camera to the bounding sphere of an object
+static float distanceToObject(const glm::mat4 & ModelMatrix, const glm::vec3 & sphereCenter, float sphereRadius, const glm::vec3 & cameraPosition){
+	glm::vec3 center = glm::vec3(ModelMatrix * glm::vec4(sphereCenter, 1.0f));
+	return glm::max(glm::length(cameraPosition - center) - sphereRadius, 0.0f);
+}
+
+// Puts the triangles of the most detailed level in meshlet order, so that each meshlet
+// is a range of the index buffer, and computes the bounds of the meshlets.
+template <typename IndexType>
+static void sortInMeshlets(IndexType * levelIndices, unsigned int indexCount, const std::vector<glm::vec3> & vertices, std::vector<Meshlet> & meshlets, std::vector<MeshletBounds> & bounds){
+	std::vector<IndexType> indices(levelIndices, levelIndices + indexCount);
+	std::vector<unsigned int> meshletVertices;
+	std::vector<unsigned char> meshletTriangles;
+	buildMeshlets(indices, vertices, meshlets, meshletVertices, meshletTriangles);
+	getMeshletIndices(meshlets, meshletVertices, meshletTriangles, indices);
+	for (size_t i=0; i<indices.size(); i++)
+		levelIndices[i] = indices[i];
+	bounds.resize(meshlets.size());
+	for (size_t i=0; i<meshlets.size(); i++)
+		bounds[i] = computeMeshletBounds(meshlets[i], meshletVertices, meshletTriangles, vertices);
+}
+
+// Draws the meshlets that the camera can see, with one draw call for each group of
+// visible meshlets that are next to each other in the index buffer.
+// Returns the number of triangles drawn.
+static unsigned int drawVisibleMeshlets(
+	const std::vector<Meshlet> & meshlets, const std::vector<MeshletBounds> & bounds,
+	const glm::mat4 & MVP, const glm::mat4 & ModelMatrix, const glm::vec3 & cameraPosition,
+	const MeshLOD & lod, GLenum indexType, unsigned int indexSize
+){
+	// Culling is done in model space
+	glm::vec3 cameraPosition_modelspace = glm::vec3(glm::inverse(ModelMatrix) * glm::vec4(cameraPosition, 1.0f));
+	static std::vector<unsigned int> visible;
+	static std::vector<GLsizei> counts;
+	static std::vector<const GLvoid *> offsets;
+	cullMeshlets(bounds, MVP, cameraPosition_modelspace, visible);
+
+	counts.clear();
+	offsets.clear();
+	unsigned int triangles = 0;
+	for (size_t i=0; i<visible.size(); i++){
+		const Meshlet & meshlet = meshlets[visible[i]];
+		size_t first = lod.indexOffset + (size_t)meshlet.triangleOffset * 3;
+		if (i > 0 && visible[i] == visible[i-1] + 1)
+			counts.back() += meshlet.triangleCount * 3;
+		else {
+			counts.push_back(meshlet.triangleCount * 3);
+			offsets.push_back((const GLvoid *)(first * indexSize));
+		}
+		triangles += meshlet.triangleCount;
+	}
+	if (!counts.empty())
+		glMultiDrawElements(GL_TRIANGLES, &counts[0], indexType, &offsets[0], (GLsizei)counts.size());
+	return triangles;
+}
 
 int main( void )
 {
@@ -81,61 +144,130 @@ int main( void )
 	glBindVertexArray(VertexArrayID);
 
 	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders( "StandardShading.vertexshader", "StandardShading.fragmentshader" );
-
-	// Get a handle for our "MVP" uniform
-	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-	GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
-	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
-
-	// Load the texture
-	GLuint Texture = loadDDS("uvmap.DDS");
+	// SHARED_UNIFORMS : the fragment shader takes the light from the shared buffer too
+	GLuint programID = LoadShaders( "StandardShadingAtlas.vertexshader", "StandardShading.fragmentshader", "SHARED_UNIFORMS" );
+
+	// Ask the driver for all the uniforms at once. The camera and the light are in
+	// uniform buffers shared by all the programs : see common/SharedUniforms.glsl.
+	ProgramReflection reflection;
+	reflectProgram(programID, reflection);
+	initSharedUniforms();
+
+	// Get a handle for our "M" uniform. MVP is computed by the shader, from View.VP.
+	GLint ModelMatrixID = getUniformLocation(reflection, "M");
+
+	// Load the textures in a single atlas : the objects use different textures, but
+	// there is only one texture to bind. Each one only needs to know where its part is.
+	std::vector<std::string> texturePaths;
+	texturePaths.push_back("uvmap.DDS");
+	texturePaths.push_back("../tutorial05_textured_cube/uvtemplate.DDS");
+	std::vector<TextureAtlas> atlases;
+	std::vector<AtlasPlacement> placements;
+	if (!buildTextureAtlases(texturePaths, false, 2048, 16, atlases, placements) || atlases.size() != 1){
+		fprintf( stderr, "Failed to build the texture atlas.\n" );
+		getchar();
+		glfwTerminate();
+		return -1;
+	}
+	GLuint Texture = atlases[0].texture;
+	GLint UVScaleOffsetID = getUniformLocation(reflection, "UVScaleOffset");
 	
 	// Get a handle for our "myTextureSampler" uniform
-	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
-
-	// Read our .obj file
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals;
-	bool res = loadOBJ("suzanne.obj", vertices, uvs, normals);
-
-	std::vector<unsigned short> indices;
-	std::vector<glm::vec3> indexed_vertices;
-	std::vector<glm::vec2> indexed_uvs;
-	std::vector<glm::vec3> indexed_normals;
-	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
-
-	// Load it into a VBO
+	GLint TextureID  = getUniformLocation(reflection, "myTextureSampler");
+
+	// Read our .obj file, indexed, with its levels of detail. The result is cached
+	// in suzanne.obj.meshcache, so only the first launch has to parse the OBJ.
+	MeshCacheView mesh;
+	bool res = loadOBJCached("suzanne.obj", mesh);
+
+	// Pack positions, UVs and normals in a single VBO, 16 bytes per vertex instead of 32 :
+	// 16-bit positions, half-float UVs, 10-bit normals. The shader doesn't change,
+	// but positions are in [0,1] : the matrices given to the shader are multiplied by "Dequantization".
+	VertexAttributeDesc attributes[] = {
+		{ VERTEX_POSITION, VERTEX_FORMAT_UNORM16,          0 },
+		{ VERTEX_UV,       VERTEX_FORMAT_HALF,             1 },
+		{ VERTEX_NORMAL,   VERTEX_FORMAT_SNORM_10_10_10_2, 2 },
+	};
+	VertexLayout layout;
+	createVertexLayout(attributes, 3, layout);
+
+	VertexStreams streams = { mesh.vertexCount, mesh.vertices, mesh.uvs, mesh.normals, NULL, NULL };
+	std::vector<unsigned char> vertexData;
+	glm::mat4 Dequantization;
+	interleaveVertices(layout, streams, vertexData, Dequantization);
+	printf("Vertex buffer : %u bytes (%u with floats)\n", (unsigned int)vertexData.size(), mesh.vertexCount * (unsigned int)(2*sizeof(glm::vec3) + sizeof(glm::vec2)));
 
 	GLuint vertexbuffer;
 	glGenBuffers(1, &vertexbuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
-
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, vertexData.size(), vertexData.empty() ? NULL : &vertexData[0], GL_STATIC_DRAW);
+
+	// Generate a buffer for the indices as well. It holds all the levels of detail,
+	// one after the other : "lods" says where each one is.
+	// The most detailed level is split in meshlets, so that the parts of close objects
+	// that are out of the screen or facing away are not drawn.
+	GLenum indexType = (mesh.indexSize == 2) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	unsigned int indexSize = mesh.indexSize;
+	std::vector<MeshLOD> lods(mesh.lods, mesh.lods + mesh.lodCount);
+	std::vector<unsigned char> indexData((const unsigned char *)mesh.indices, (const unsigned char *)mesh.indices + mesh.indexCount * mesh.indexSize);
+	std::vector<glm::vec3> positions(mesh.vertices, mesh.vertices + mesh.vertexCount);
+	std::vector<Meshlet> meshlets;
+	std::vector<MeshletBounds> meshletBounds;
+	if (indexSize == 2)
+		sortInMeshlets((unsigned short *)&indexData[0] + lods[0].indexOffset, lods[0].indexCount, positions, meshlets, meshletBounds);
+	else
+		sortInMeshlets((unsigned int *)&indexData[0] + lods[0].indexOffset, lods[0].indexCount, positions, meshlets, meshletBounds);
+	printf("%u meshlets\n", (unsigned int)meshlets.size());
 
-	GLuint normalbuffer;
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-
-	// Generate a buffer for the indices as well
 	GLuint elementbuffer;
 	glGenBuffers(1, &elementbuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0] , GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), &indexData[0], GL_STATIC_DRAW);
+
+	// Bounding sphere, to know how far from the camera the objects are
+	glm::vec3 boxMin = mesh.vertexCount > 0 ? mesh.vertices[0] : glm::vec3(0.0f);
+	glm::vec3 boxMax = boxMin;
+	for (unsigned int i=0; i<mesh.vertexCount; i++){
+		boxMin = glm::min(boxMin, mesh.vertices[i]);
+		boxMax = glm::max(boxMax, mesh.vertices[i]);
+	}
+	glm::vec3 sphereCenter = (boxMin + boxMax) * 0.5f;
+	float sphereRadius = glm::length(boxMax - boxMin) * 0.5f;
+
+	// Everything is in the VBOs now
+	closeMeshCache(mesh);
 
-	// Get a handle for our "LightPosition" uniform
 	glUseProgram(programID);
-	GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
+
+	// Our sampler always uses Texture Unit 0 : this is part of the program, it only has to be set once
+	glUniform1i(TextureID, 0);
+
+	// Levels of detail : the coarsest level that is less than 1 pixel away from the real mesh.
+	// Press L to compare with and without.
+	bool useLODs = true;
+	bool lKeyWasPressed = false;
+	float projectionScale = getLODProjectionScale(glm::radians(45.0f), 768.0f);
+	LODSelector selector1 = { 0, 1.0f, 0.25f };
+	LODSelector selector2 = { 0, 1.0f, 0.25f };
+
+	// Press C to draw the most detailed level without culling its meshlets
+	bool useMeshletCulling = true;
+	bool cKeyWasPressed = false;
+
+	// Many more objects, further away : this is where LODs help
+	const int crowdSize = 100;
+	LODSelector crowdSelectors[crowdSize];
+	glm::vec3 crowdPositions[crowdSize];
+	for (int i=0; i<crowdSize; i++){
+		LODSelector selector = { 0, 1.0f, 0.25f };
+		crowdSelectors[i] = selector;
+		crowdPositions[i] = glm::vec3(-18.0f + 4.0f * (i % 10), 0.0f, -10.0f - 15.0f * (i / 10));
+	}
 
 	// For speed computation
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
+	unsigned long long nbTriangles = 0;
 
 	do{
 
@@ -144,11 +276,21 @@ int main( void )
 		nbFrames++;
 		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
 			// printf and reset
-			printf("%f ms/frame\n", 1000.0/double(nbFrames));
+			printf("%f ms/frame, %llu triangles/frame (LODs %s, meshlet culling %s)\n", 1000.0/double(nbFrames), nbTriangles/nbFrames, useLODs ? "on" : "off", useMeshletCulling ? "on" : "off");
 			nbFrames = 0;
+			nbTriangles = 0;
 			lastTime += 1.0;
 		}
 
+		bool lKeyIsPressed = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS;
+		if (lKeyIsPressed && !lKeyWasPressed)
+			useLODs = !useLODs;
+		lKeyWasPressed = lKeyIsPressed;
+		bool cKeyIsPressed = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+		if (cKeyIsPressed && !cKeyWasPressed)
+			useMeshletCulling = !useMeshletCulling;
+		cKeyWasPressed = cKeyIsPressed;
+
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -157,6 +299,7 @@ int main( void )
 		computeMatricesFromInputs();
 		glm::mat4 ProjectionMatrix = getProjectionMatrix();
 		glm::mat4 ViewMatrix = getViewMatrix();
+		glm::vec3 cameraPosition = glm::vec3(glm::inverse(ViewMatrix)[3]);
 		
 		
 		////// Start of the rendering of the first object //////
@@ -164,71 +307,52 @@ int main( void )
 		// Use our shader
 		glUseProgram(programID);
 	
+		// The light and the camera don't change between objects, nor between programs :
+		// they are sent once per frame, in the shared uniform buffers
 		glm::vec3 lightPos = glm::vec3(4,4,4);
-		glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
-		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]); // This one doesn't change between objects, so this can be done once for all objects that use "programID"
+		FrameUniforms frameUniforms = { glm::vec4(lightPos, 1.0f), (float)currentTime, { 0.0f, 0.0f, 0.0f } };
+		updateFrameUniforms(frameUniforms);
+		ViewUniforms viewUniforms = { ViewMatrix, ProjectionMatrix, ProjectionMatrix * ViewMatrix, glm::vec4(cameraPosition, 1.0f) };
+		updateViewUniforms(viewUniforms);
 		
 		glm::mat4 ModelMatrix1 = glm::mat4(1.0);
-		glm::mat4 MVP1 = ProjectionMatrix * ViewMatrix * ModelMatrix1;
+		glm::mat4 QuantizedModelMatrix1 = ModelMatrix1 * Dequantization;
 
 		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP1[0][0]);
-		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix1[0][0]);
+		// in the "M" uniform
+		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &QuantizedModelMatrix1[0][0]);
 
 
 		// Bind our texture in Texture Unit 0
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, Texture);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureID, 0);
+		glUniform4f(UVScaleOffsetID, placements[0].uvScale[0], placements[0].uvScale[1], placements[0].uvOffset[0], placements[0].uvOffset[1]);
 
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
+		// Vertices, UVs and normals, all in the same buffer
 		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute
-			2,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glVertexAttribPointer(
-			2,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
+		enableVertexLayout(layout);
 
 		// Index buffer
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 
+		// Pick the level of detail from the distance
+		unsigned int level1 = 0;
+		if (useLODs)
+			level1 = selectLOD(&lods[0], (unsigned int)lods.size(), distanceToObject(ModelMatrix1, sphereCenter, sphereRadius, cameraPosition), projectionScale, selector1);
+
 		// Draw the triangles !
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			indices.size(),    // count
-			GL_UNSIGNED_SHORT,   // type
-			(void*)0           // element array buffer offset
-		);
+		if (level1 == 0 && useMeshletCulling){
+			// Only the meshlets that can be seen
+			nbTriangles += drawVisibleMeshlets(meshlets, meshletBounds, ProjectionMatrix * ViewMatrix * ModelMatrix1, ModelMatrix1, cameraPosition, lods[0], indexType, indexSize);
+		} else {
+			glDrawElements(
+				GL_TRIANGLES,                                   // mode
+				lods[level1].indexCount,                        // count
+				indexType,                                      // type
+				(void*)(size_t)(lods[level1].indexOffset * indexSize) // element array buffer offset
+			);
+			nbTriangles += lods[level1].indexCount / 3;
+		}
 
 
 
@@ -241,63 +365,71 @@ int main( void )
 		//glUseProgram(programID);
 		
 		// Similarly : don't re-set the light position and camera matrix in programID,
-		// it's still valid !
-		// *** You would have to do it if you used another shader ! ***
-		//glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+		// they are still valid ! (And they are in the shared buffers, for every shader.)
 		//glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]); // This one doesn't change between objects, so this can be done once for all objects that use "programID"
 
 		
 		// Again : this is already done, but this only works because we use the same shader.
+		// The second texture is in the same atlas, so the texture doesn't change either.
 		//// Bind our texture in Texture Unit 0
 		//glActiveTexture(GL_TEXTURE0);
 		//glBindTexture(GL_TEXTURE_2D, Texture);
 		//// Set our "myTextureSampler" sampler to use Texture Unit 0
 		//glUniform1i(TextureID, 0);
+		// Only the part of the atlas changes
+		glUniform4f(UVScaleOffsetID, placements[1].uvScale[0], placements[1].uvScale[1], placements[1].uvOffset[0], placements[1].uvOffset[1]);
 		
 		
-		// BUT the Model matrix is different (and the MVP too)
+		// BUT the Model matrix is different. MVP is computed by the shader.
 		glm::mat4 ModelMatrix2 = glm::mat4(1.0);
 		ModelMatrix2 = glm::translate(ModelMatrix2, glm::vec3(2.0f, 0.0f, 0.0f));
-		glm::mat4 MVP2 = ProjectionMatrix * ViewMatrix * ModelMatrix2;
+		glm::mat4 QuantizedModelMatrix2 = ModelMatrix2 * Dequantization;
 
 		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP2[0][0]);
-		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix2[0][0]);
+		// in the "M" uniform
+		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &QuantizedModelMatrix2[0][0]);
 
 
-		// The rest is exactly the same as the first object
-		
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+		// The rest is exactly the same as the first object, and the same mesh :
+		// the vertex and index buffers are still bound.
 
 		// Draw the triangles !
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_SHORT, (void*)0);
+		unsigned int level2 = 0;
+		if (useLODs)
+			level2 = selectLOD(&lods[0], (unsigned int)lods.size(), distanceToObject(ModelMatrix2, sphereCenter, sphereRadius, cameraPosition), projectionScale, selector2);
+		if (level2 == 0 && useMeshletCulling){
+			nbTriangles += drawVisibleMeshlets(meshlets, meshletBounds, ProjectionMatrix * ViewMatrix * ModelMatrix2, ModelMatrix2, cameraPosition, lods[0], indexType, indexSize);
+		} else {
+			glDrawElements(GL_TRIANGLES, lods[level2].indexCount, indexType, (void*)(size_t)(lods[level2].indexOffset * indexSize));
+			nbTriangles += lods[level2].indexCount / 3;
+		}
 
 
 		////// End of rendering of the second object //////
+		////// The crowd : same thing, in a loop //////
+
+		for (int i=0; i<crowdSize; i++){
+			glm::mat4 CrowdModelMatrix = glm::translate(glm::mat4(1.0), crowdPositions[i]);
+			glm::mat4 QuantizedCrowdModelMatrix = CrowdModelMatrix * Dequantization;
+			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &QuantizedCrowdModelMatrix[0][0]);
+			const AtlasPlacement & placement = placements[i % placements.size()];
+			glUniform4f(UVScaleOffsetID, placement.uvScale[0], placement.uvScale[1], placement.uvOffset[0], placement.uvOffset[1]);
+
+			unsigned int level = 0;
+			if (useLODs)
+				level = selectLOD(&lods[0], (unsigned int)lods.size(), distanceToObject(CrowdModelMatrix, sphereCenter, sphereRadius, cameraPosition), projectionScale, crowdSelectors[i]);
+			if (level == 0 && useMeshletCulling){
+				nbTriangles += drawVisibleMeshlets(meshlets, meshletBounds, ProjectionMatrix * ViewMatrix * CrowdModelMatrix, CrowdModelMatrix, cameraPosition, lods[0], indexType, indexSize);
+			} else {
+				glDrawElements(GL_TRIANGLES, lods[level].indexCount, indexType, (void*)(size_t)(lods[level].indexOffset * indexSize));
+				nbTriangles += lods[level].indexCount / 3;
+			}
+		}
 
 
 
 
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		disableVertexLayout(layout);
 
 		// Swap buffers
 		glfwSwapBuffers(window);
@@ -309,11 +441,10 @@ int main( void )
 
 	// Cleanup VBO and shader
 	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteBuffers(1, &normalbuffer);
 	glDeleteBuffers(1, &elementbuffer);
 	glDeleteProgram(programID);
 	glDeleteTextures(1, &Texture);
+	cleanupSharedUniforms();
 	glDeleteVertexArrays(1, &VertexArrayID);
 
 	// Close OpenGL window and terminate GLFW
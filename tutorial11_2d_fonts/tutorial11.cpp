@@ -235,6 +235,7 @@ int main( void )
 		char text[256];
 		sprintf(text,"%.2f sec", glfwGetTime() );
 		printText2D(text, 10, 500, 60);
+		flushText2D();
 
 		// Swap buffers
 		glfwSwapBuffers(window);
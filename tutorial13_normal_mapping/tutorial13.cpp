@@ -17,6 +17,7 @@ using namespace glm;
 
 #include <common/shader.hpp>
 #include <common/texture.hpp>
+#include <common/texturestreaming.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
@@ -91,10 +92,12 @@ int main( void )
 	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
 	GLuint ModelView3x3MatrixID = glGetUniformLocation(programID, "MV3x3");
 
-	// Load the texture
-	GLuint DiffuseTexture = loadDDS("diffuse.DDS");
-	GLuint NormalTexture = loadBMP_custom("normal.bmp");
-	GLuint SpecularTexture = loadDDS("specular.DDS");
+	// Load the texture. The .DDS files are read in the background, and show up
+	// a few frames later, smallest mipmaps first.
+	initTextureStreaming();
+	GLuint DiffuseTexture = streamTexture("diffuse.DDS");
+	GLuint NormalTexture = loadBMP_compressed("normal.bmp", BLOCK_FORMAT_BC5);
+	GLuint SpecularTexture = streamTexture("specular.DDS");
 	
 	// Get a handle for our "myTextureSampler" uniform
 	GLuint DiffuseTextureID  = glGetUniformLocation(programID, "DiffuseTextureSampler");
@@ -107,22 +110,19 @@ int main( void )
 	std::vector<glm::vec3> normals;
 	bool res = loadOBJ("cylinder.obj", vertices, uvs, normals);
 
-	std::vector<glm::vec3> tangents;
-	std::vector<glm::vec3> bitangents;
-	computeTangentBasis(
-		vertices, uvs, normals, // input
-		tangents, bitangents    // output
-	);
-
 	std::vector<unsigned short> indices;
 	std::vector<glm::vec3> indexed_vertices;
 	std::vector<glm::vec2> indexed_uvs;
 	std::vector<glm::vec3> indexed_normals;
+	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+
+	// Tangents are computed directly on the indexed mesh : one per vertex,
+	// instead of one per triangle corner merged afterwards by indexVBO_TBN.
 	std::vector<glm::vec3> indexed_tangents;
 	std::vector<glm::vec3> indexed_bitangents;
-	indexVBO_TBN(
-		vertices, uvs, normals, tangents, bitangents, 
-		indices, indexed_vertices, indexed_uvs, indexed_normals, indexed_tangents, indexed_bitangents
+	computeTangentBasis(
+		indices, indexed_vertices, indexed_uvs, indexed_normals, // input
+		indexed_tangents, indexed_bitangents                     // output
 	);
 
 	// Load it into a VBO
@@ -168,6 +168,9 @@ int main( void )
 
 	do{
 
+		// Upload what was read since the last frame, for at most 2 ms
+		updateTextureStreaming(2.0);
+
 		// Measure speed
 		double currentTime = glfwGetTime();
 		nbFrames++;
@@ -383,6 +386,7 @@ int main( void )
 	glDeleteTextures(1, &NormalTexture);
 	glDeleteTextures(1, &SpecularTexture);
 	glDeleteVertexArrays(1, &VertexArrayID);
+	cleanupTextureStreaming();
 
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
@@ -20,6 +20,7 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/profiler.hpp>
 
 int main( void )
 {
@@ -217,10 +218,15 @@ int main( void )
 	GLuint quad_programID = LoadShaders( "Passthrough.vertexshader", "WobblyTexture.fragmentshader" );
 	GLuint texID = glGetUniformLocation(quad_programID, "renderedTexture");
 	GLuint timeID = glGetUniformLocation(quad_programID, "time");
+
+	// Where the time of the frames goes : printed, and written to profile.json at the end
+	initProfiler();
     
 	
 	do{
 		// Render to our framebuffer
+		beginCpuScope("Render to texture");
+		beginGpuScope("Render to texture");
 		glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
 		glViewport(0,0,windowWidth,windowHeight); // Render on the whole framebuffer, complete from the lower left corner to the upper right
 
@@ -303,9 +309,13 @@ int main( void )
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
 
+		endGpuScope();
+		endCpuScope();
 
 
 		// Render to the screen
+		beginCpuScope("Render to screen");
+		beginGpuScope("Render to screen");
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
         // Render on the whole framebuffer, complete from the lower left corner to the upper right
 		glViewport(0,0,windowWidth,windowHeight);
@@ -341,15 +351,24 @@ int main( void )
 
 		glDisableVertexAttribArray(0);
 
+		endGpuScope();
+		endCpuScope();
 
 		// Swap buffers
+		beginCpuScope("Swap buffers");
 		glfwSwapBuffers(window);
+		endCpuScope();
 		glfwPollEvents();
+		newProfilerFrame();
 
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
 
+	printProfilerReport();
+	writeProfilerTrace("profile.json");
+	cleanupProfiler();
+
 	// Cleanup VBO and shader
 	glDeleteBuffers(1, &vertexbuffer);
 	glDeleteBuffers(1, &uvbuffer);
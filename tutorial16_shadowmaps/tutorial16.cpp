@@ -20,6 +20,7 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/profiler.hpp>
 
 int main( void )
 {
@@ -87,8 +88,16 @@ int main( void )
 	glGenVertexArrays(1, &VertexArrayID);
 	glBindVertexArray(VertexArrayID);
 
-	// Create and compile our GLSL program from the shaders
-	GLuint depthProgramID = LoadShaders( "DepthRTT.vertexshader", "DepthRTT.fragmentshader" );
+	// Create and compile our GLSL programs from the shaders, all 3 at once :
+	// the driver can compile them in parallel.
+	ShaderProgramDesc programDescs[] = {
+		{ "DepthRTT.vertexshader",      "DepthRTT.fragmentshader",      NULL },
+		{ "Passthrough.vertexshader",   "SimpleTexture.fragmentshader", NULL },
+		{ "ShadowMapping.vertexshader", "ShadowMapping.fragmentshader", NULL },
+	};
+	GLuint programIDs[3];
+	LoadShaderPrograms(programDescs, 3, programIDs);
+	GLuint depthProgramID = programIDs[0];
 
 	// Get a handle for our "MVP" uniform
 	GLuint depthMatrixID = glGetUniformLocation(depthProgramID, "depthMVP");
@@ -178,13 +187,11 @@ int main( void )
 	glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(g_quad_vertex_buffer_data), g_quad_vertex_buffer_data, GL_STATIC_DRAW);
 
-	// Create and compile our GLSL program from the shaders
-	GLuint quad_programID = LoadShaders( "Passthrough.vertexshader", "SimpleTexture.fragmentshader" );
+	GLuint quad_programID = programIDs[1];
 	GLuint texID = glGetUniformLocation(quad_programID, "texture");
 
 
-	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders( "ShadowMapping.vertexshader", "ShadowMapping.fragmentshader" );
+	GLuint programID = programIDs[2];
 
 	// Get a handle for our "myTextureSampler" uniform
 	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
@@ -199,11 +206,14 @@ int main( void )
 	// Get a handle for our "LightPosition" uniform
 	GLuint lightInvDirID = glGetUniformLocation(programID, "LightInvDirection_worldspace");
 
-
+	// Where the time of the frames goes : printed, and written to profile.json at the end
+	initProfiler();
 	
 	do{
 
 		// Render to our framebuffer
+		beginCpuScope("Shadow map");
+		beginGpuScope("Shadow map");
 		glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
 		glViewport(0,0,1024,1024); // Render on the whole framebuffer, complete from the lower left corner to the upper right
 
@@ -261,9 +271,13 @@ int main( void )
 
 		glDisableVertexAttribArray(0);
 
+		endGpuScope();
+		endCpuScope();
 
 
 		// Render to the screen
+		beginCpuScope("Shadowed scene");
+		beginGpuScope("Shadowed scene");
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		glViewport(0,0,windowWidth,windowHeight); // Render on the whole framebuffer, complete from the lower left corner to the upper right
 
@@ -363,6 +377,9 @@ int main( void )
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
 
+		endGpuScope();
+		endCpuScope();
+
 
 		// Optionally render the shadowmap (for debug only)
 
@@ -397,13 +414,20 @@ int main( void )
 
 
 		// Swap buffers
+		beginCpuScope("Swap buffers");
 		glfwSwapBuffers(window);
+		endCpuScope();
 		glfwPollEvents();
+		newProfilerFrame();
 
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
 
+	printProfilerReport();
+	writeProfilerTrace("profile.json");
+	cleanupProfiler();
+
 	// Cleanup VBO and shader
 	glDeleteBuffers(1, &vertexbuffer);
 	glDeleteBuffers(1, &uvbuffer);
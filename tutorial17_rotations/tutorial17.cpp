@@ -24,6 +24,7 @@ using namespace glm;
  
  
 #include <common/shader.hpp>
+#include <common/shaderreflection.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
@@ -124,10 +125,14 @@ int main( void )
 	// Create and compile our GLSL program from the shaders
 	GLuint programID = LoadShaders( "StandardShading.vertexshader", "StandardShading.fragmentshader" );
  
-	// Get a handle for our "MVP" uniform
-	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-	GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
-	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
+	// Ask the driver for all the uniforms at once. The camera and the light are in
+	// uniform buffers shared by all the programs : see common/SharedUniforms.glsl.
+	ProgramReflection reflection;
+	reflectProgram(programID, reflection);
+	initSharedUniforms();
+ 
+	// Get a handle for our "M" uniform. MVP is computed by the shader, from View.VP.
+	GLint ModelMatrixID = getUniformLocation(reflection, "M");
  
 	// Get a handle for our buffers
 	GLuint vertexPosition_modelspaceID = glGetAttribLocation(programID, "vertexPosition_modelspace");
@@ -138,7 +143,7 @@ int main( void )
 	GLuint Texture = loadDDS("uvmap.DDS");
 	
 	// Get a handle for our "myTextureSampler" uniform
-	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
+	GLint TextureID  = getUniformLocation(reflection, "myTextureSampler");
  
 	// Read our .obj file
 	std::vector<glm::vec3> vertices;
@@ -175,9 +180,9 @@ int main( void )
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0] , GL_STATIC_DRAW);
  
-	// Get a handle for our "LightPosition" uniform
+	// Our sampler always uses Texture Unit 0 : this is part of the program, it only has to be set once
 	glUseProgram(programID);
-	GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
+	glUniform1i(TextureID, 0);
  
 	// For speed computation
 	double lastTime = glfwGetTime();
@@ -214,8 +219,6 @@ int main( void )
 		// Bind our texture in Texture Unit 0
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, Texture);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureID, 0);
  
 		// 1rst attribute buffer : vertices
 		glEnableVertexAttribArray(0);
@@ -256,8 +259,13 @@ int main( void )
 		// Index buffer
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
  
+		// The light and the camera are the same for both objects : they are sent
+		// once per frame, in the shared uniform buffers
 		glm::vec3 lightPos = glm::vec3(4,4,4);
-		glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+		FrameUniforms frameUniforms = { glm::vec4(lightPos, 1.0f), (float)currentTime, { 0.0f, 0.0f, 0.0f } };
+		updateFrameUniforms(frameUniforms);
+		ViewUniforms viewUniforms = { ViewMatrix, ProjectionMatrix, ProjectionMatrix * ViewMatrix, glm::vec4(0, 0, 7, 1) };
+		updateViewUniforms(viewUniforms);
  
 		{ // Euler
  
@@ -270,13 +278,9 @@ int main( void )
 			glm::mat4 ScalingMatrix = scale(mat4(), vec3(1.0f, 1.0f, 1.0f));
 			glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix * ScalingMatrix;
  
-			glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
- 
 			// Send our transformation to the currently bound shader, 
-			// in the "MVP" uniform
-			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+			// in the "M" uniform. MVP is computed by the shader.
 			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-			glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
  
  
  
@@ -308,13 +312,9 @@ int main( void )
 			glm::mat4 ScalingMatrix = scale(mat4(), vec3(1.0f, 1.0f, 1.0f));
 			glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix * ScalingMatrix;
  
-			glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
- 
 			// Send our transformation to the currently bound shader, 
-			// in the "MVP" uniform
-			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+			// in the "M" uniform. MVP is computed by the shader.
 			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-			glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
  
  
 			// Draw the triangles !
@@ -347,6 +347,7 @@ int main( void )
 	glDeleteBuffers(1, &normalbuffer);
 	glDeleteBuffers(1, &elementbuffer);
 	glDeleteProgram(programID);
+	cleanupSharedUniforms();
 	glDeleteTextures(1, &Texture);
  
 	// Close GUI and OpenGL window, and terminate GLFW
@@ -18,6 +18,7 @@ using namespace glm;
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
+#include <common/profiler.hpp>
 
 // CPU representation of a particle
 struct Particle{
@@ -172,6 +173,8 @@ int main( void )
 	glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW);
 
 
+	// Where the time of the frames goes : printed, and written to profile.json at the end
+	initProfiler();
 	
 	double lastTime = glfwGetTime();
 	do
@@ -200,6 +203,7 @@ int main( void )
 		// Generate 10 new particule each millisecond,
 		// but limit this to 16 ms (60 fps), or if you have 1 long frame (1sec),
 		// newparticles will be huge and the next frame even longer.
+		beginCpuScope("Emit particles");
 		int newparticles = (int)(delta*10000.0);
 		if (newparticles > (int)(0.016f*10000.0))
 			newparticles = (int)(0.016f*10000.0);
@@ -232,10 +236,12 @@ int main( void )
 			ParticlesContainer[particleIndex].size = (rand()%1000)/2000.0f + 0.1f;
 			
 		}
+		endCpuScope();
 
 
 
 		// Simulate all particles
+		beginCpuScope("Simulate particles");
 		int ParticlesCount = 0;
 		for(int i=0; i<MaxParticles; i++){
 
@@ -274,8 +280,11 @@ int main( void )
 
 			}
 		}
+		endCpuScope();
 
+		beginCpuScope("Sort particles");
 		SortParticles();
+		endCpuScope();
 
 
 		//printf("%d ",ParticlesCount);
@@ -286,7 +295,8 @@ int main( void )
 		// but this is outside the scope of this tutorial.
 		// http://www.opengl.org/wiki/Buffer_Object_Streaming
 
-
+		beginCpuScope("Upload particles");
+		beginGpuScope("Upload particles");
 		glBindBuffer(GL_ARRAY_BUFFER, particles_position_buffer);
 		glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW); // Buffer orphaning, a common way to improve streaming perf. See above link for details.
 		glBufferSubData(GL_ARRAY_BUFFER, 0, ParticlesCount * sizeof(GLfloat) * 4, g_particule_position_size_data);
@@ -294,7 +304,11 @@ int main( void )
 		glBindBuffer(GL_ARRAY_BUFFER, particles_color_buffer);
 		glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW); // Buffer orphaning, a common way to improve streaming perf. See above link for details.
 		glBufferSubData(GL_ARRAY_BUFFER, 0, ParticlesCount * sizeof(GLubyte) * 4, g_particule_color_data);
+		endGpuScope();
+		endCpuScope();
 
+		beginCpuScope("Draw particles");
+		beginGpuScope("Draw particles");
 
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -368,16 +382,25 @@ int main( void )
 		glDisableVertexAttribArray(0);
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
+		endGpuScope();
+		endCpuScope();
 
 		// Swap buffers
+		beginCpuScope("Swap buffers");
 		glfwSwapBuffers(window);
+		endCpuScope();
 		glfwPollEvents();
+		newProfilerFrame();
 
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
 
 
+	printProfilerReport();
+	writeProfilerTrace("profile.json");
+	cleanupProfiler();
+
 	delete[] g_particule_position_size_data;
 
 	// Cleanup VBO and shader